@@ -6,16 +6,158 @@
 #include "AsyncLog.h"
 #include <ctime>
 #include <time.h>
-#include <sys/timeb.h>
 #include <stdio.h>
 #include <string.h>
 #include <sstream>
 #include <iostream>
 #include <stdarg.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 #include "../base/Platform.h"
 
+#ifndef WIN32
+#include <limits.h> // for IOV_MAX
+#endif
+
 #define MAX_LINE_LENGTH 256
 #define DEFAULT_ROLL_SIZE 10 * 1024 * 1024
+#define DEFAULT_THREAD_BUFFER_SIZE 1024 * 1024
+// 写线程没有被唤醒时，每隔多少毫秒写出一次
+#define FLUSH_INTERVAL_MS 50
+
+namespace
+{
+    // 一个线程的日志缓冲区，所属线程放入、写线程取出的无锁环形缓冲区
+    struct LogBuffer
+    {
+        explicit LogBuffer(size_t size)
+            : data(new char[size]), capacity(size), head(0), tail(0), dropped(0), abandoned(false)
+        {
+        }
+
+        // 放入一行，空间不够时返回false，nUsed返回放入之后已用的字节数
+        bool push(const char *pszLine, size_t nLength, size_t &nUsed)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            uint64_t t = tail.load(std::memory_order_acquire);
+            if (capacity - static_cast<size_t>(h - t) < nLength)
+                return false;
+
+            size_t pos = static_cast<size_t>(h % capacity);
+            size_t first = std::min(nLength, capacity - pos);
+            memcpy(&data[pos], pszLine, first);
+            memcpy(&data[0], pszLine + first, nLength - first);
+            head.store(h + nLength, std::memory_order_release);
+            nUsed = static_cast<size_t>(h + nLength - t);
+            return true;
+        }
+
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        std::atomic<uint64_t> head;    // 所属线程放入到的位置，只增不减
+        std::atomic<uint64_t> tail;    // 写线程写出到的位置，只增不减
+        std::atomic<uint64_t> dropped; // 缓冲区满丢弃的行数
+        std::atomic<bool> abandoned;   // 所属线程已退出，写完后释放
+    };
+
+    std::mutex g_mutexBuffers;                         // 保护g_buffers
+    std::vector<std::shared_ptr<LogBuffer>> g_buffers; // 所有线程的缓冲区
+
+    // 线程退出、t_state析构之后置为true，之后该线程的日志同步写出
+    thread_local bool t_stateDestroyed = false;
+
+    // 每个线程的缓冲区和格式化日志时复用的状态
+    struct ThreadLogState
+    {
+        ThreadLogState() : cachedSecond(-1), cachedTimeLength(0)
+        {
+            std::ostringstream osThreadID;
+            osThreadID << std::this_thread::get_id();
+            snprintf(threadID, sizeof(threadID), "[%s]", osThreadID.str().c_str());
+            cachedTime[0] = 0;
+            line.reserve(1024);
+        }
+
+        ~ThreadLogState()
+        {
+            if (buffer)
+                buffer->abandoned.store(true, std::memory_order_release);
+            t_stateDestroyed = true;
+        }
+
+        std::shared_ptr<LogBuffer> buffer;
+        char threadID[32];
+        int64_t cachedSecond;    // cachedTime对应的秒数
+        char cachedTime[32];     // 毫秒之前的时间部分，如"[[2025-06-06 12:00:00:"
+        size_t cachedTimeLength;
+        std::string line;        // 格式化日志用，避免每行分配内存
+    };
+
+    thread_local ThreadLogState t_state;
+
+    const char *const kLevelNames[] = {"[TRACE]", "[DEBUG]", "[INFO]", "[WARN]", "[ERROR]", "[SYSE]", "[FATAL]", "[CRITICAL]"};
+
+    size_t formatSecond(char *pszTime, size_t nTimeStrLength, time_t now)
+    {
+        tm time;
+#ifdef _WIN32
+        localtime_s(&time, &now);
+#else
+        localtime_r(&now, &time);
+#endif
+        int n = snprintf(pszTime, nTimeStrLength, "[[%04d-%02d-%02d %02d:%02d:%02d:", time.tm_year + 1900, time.tm_mon + 1, time.tm_mday, time.tm_hour, time.tm_min, time.tm_sec);
+        return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+
+    // 把一组缓冲区片段写到文件，分批写直到全部写完
+    bool writeSlices(FILE *fp, const std::vector<std::pair<const char *, size_t>> &slices)
+    {
+#ifdef WIN32
+        for (const auto &slice : slices)
+        {
+            if (fwrite(slice.first, 1, slice.second, fp) != slice.second)
+                return false;
+        }
+        fflush(fp);
+        return true;
+#else
+        std::vector<struct iovec> iov(slices.size());
+        for (size_t i = 0; i < slices.size(); ++i)
+        {
+            iov[i].iov_base = const_cast<char *>(slices[i].first);
+            iov[i].iov_len = slices[i].second;
+        }
+
+        // 绕过stdio直接writev，先写出stdio缓冲里的内容以保持顺序
+        fflush(fp);
+        int fd = fileno(fp);
+        size_t index = 0;
+        while (index < iov.size())
+        {
+            int count = static_cast<int>(std::min<size_t>(iov.size() - index, IOV_MAX));
+            ssize_t n = ::writev(fd, &iov[index], count);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+
+            // 跳过已经写完的片段，部分写出的片段从剩余的位置继续写
+            size_t written = static_cast<size_t>(n);
+            while (index < iov.size() && written >= iov[index].iov_len)
+                written -= iov[index++].iov_len;
+            if (index < iov.size() && written > 0)
+            {
+                iov[index].iov_base = static_cast<char *>(iov[index].iov_base) + written;
+                iov[index].iov_len -= written;
+            }
+        }
+        return true;
+#endif
+    }
+}
 
 bool CAsyncLog::m_bTruncateLongLog = false;
 FILE *CAsyncLog::m_hLogFile = NULL;
@@ -24,12 +166,15 @@ std::string CAsyncLog::m_strFileNamePID = "";
 LOG_LEVEL CAsyncLog::m_nCurrentLevel = LOG_LEVEL_INFO;
 int64_t CAsyncLog::m_nFileRollSize = DEFAULT_ROLL_SIZE;
 int64_t CAsyncLog::m_nCurrentWrittenSize = 0;
-std::list<std::string> CAsyncLog::m_listLinesToWrite;
+size_t CAsyncLog::m_nThreadBufferSize = DEFAULT_THREAD_BUFFER_SIZE;
+LOG_OVERFLOW_POLICY CAsyncLog::m_nOverflowPolicy = LOG_OVERFLOW_DROP;
 std::unique_ptr<std::thread> CAsyncLog::m_spWriteThread;
 std::mutex CAsyncLog::m_mutexWrite;
+std::mutex CAsyncLog::m_mutexWakeup;
 std::condition_variable CAsyncLog::m_cvWrite;
-bool CAsyncLog::CAsyncLog::m_bExit = false;
-bool CAsyncLog::m_bRunning = false;
+std::atomic<bool> CAsyncLog::m_bFlushRequested(false);
+std::atomic<bool> CAsyncLog::m_bExit(false);
+std::atomic<bool> CAsyncLog::m_bRunning(false);
 
 bool CAsyncLog::init(const char *pszLogFileName /* = nullptr*/, bool bTruncateLongLine /* = false*/, int64_t nRollSize /* = 10 * 1024 * 1024*/)
 {
@@ -54,6 +199,8 @@ bool CAsyncLog::init(const char *pszLogFileName /* = nullptr*/, bool bTruncateLo
 
     // TODO：创建文件夹
 
+    // 写线程开始运行之前输出的日志在缓冲区中等待，不会因为BLOCK策略而被丢弃
+    m_bRunning = true;
     m_spWriteThread.reset(new std::thread(writeThreadProc));
 
     return true;
@@ -61,13 +208,17 @@ bool CAsyncLog::init(const char *pszLogFileName /* = nullptr*/, bool bTruncateLo
 
 void CAsyncLog::uninit()
 {
+    if (!m_spWriteThread)
+        return;
+
     m_bExit = true;
 
-    m_cvWrite.notify_one();
+    requestFlush();
 
     if (m_spWriteThread->joinable())
         m_spWriteThread->join();
 
+    std::lock_guard<std::mutex> guard(m_mutexWrite);
     if (m_hLogFile != nullptr)
     {
         fclose(m_hLogFile);
@@ -75,6 +226,16 @@ void CAsyncLog::uninit()
     }
 }
 
+void CAsyncLog::setBuffering(size_t nThreadBufferSize, LOG_OVERFLOW_POLICY nPolicy)
+{
+    // 缓冲区至少能放下几行截断的长日志
+    if (nThreadBufferSize < 4 * 1024)
+        nThreadBufferSize = 4 * 1024;
+
+    m_nThreadBufferSize = nThreadBufferSize;
+    m_nOverflowPolicy = nPolicy;
+}
+
 void CAsyncLog::setLevel(LOG_LEVEL nLevel)
 {
     if (nLevel < LOG_LEVEL_TRACE || nLevel > LOG_LEVEL_FATAL)
@@ -90,198 +251,135 @@ bool CAsyncLog::isRunning()
 
 bool CAsyncLog::output(long nLevel, const char *pszFmt, ...)
 {
-    if (nLevel != LOG_LEVEL_CRITICAL)
-    {
-        if (nLevel < m_nCurrentLevel)
-            return false;
-    }
-
-    std::string strLine;
-    makeLinePrefix(nLevel, strLine);
-
-    // log正文
-    std::string strLogMsg;
-
-    // 先计算一下不定参数的长度，以便于分配空间
     va_list ap;
     va_start(ap, pszFmt);
-    int nLogMsgLength = vsnprintf(NULL, 0, pszFmt, ap);
+    bool bResult = outputV(nLevel, NULL, 0, pszFmt, ap);
     va_end(ap);
 
-    // 容量必须算上最后一个\0
-    if ((int)strLogMsg.capacity() < nLogMsgLength + 1)
-    {
-        strLogMsg.resize(nLogMsgLength + 1);
-    }
-    va_list aq;
-    va_start(aq, pszFmt);
-    vsnprintf((char *)strLogMsg.data(), strLogMsg.capacity(), pszFmt, aq);
-    va_end(aq);
-
-    // string内容正确但length不对，恢复一下其length
-    std::string strMsgFormal;
-    strMsgFormal.append(strLogMsg.c_str(), nLogMsgLength);
+    return bResult;
+}
 
-    // 如果日志开启截断，长日志只取前MAX_LINE_LENGTH个字符
-    if (m_bTruncateLongLog)
-        strMsgFormal = strMsgFormal.substr(0, MAX_LINE_LENGTH);
+bool CAsyncLog::output(long nLevel, const char *pszFileName, int nLineNo, const char *pszFmt, ...)
+{
+    va_list ap;
+    va_start(ap, pszFmt);
+    bool bResult = outputV(nLevel, pszFileName, nLineNo, pszFmt, ap);
+    va_end(ap);
 
-    strLine += strMsgFormal;
+    return bResult;
+}
 
-    // 不是输出到控制台才会在每一行末尾加一个换行符
-    if (!m_strFileName.empty())
+bool CAsyncLog::outputV(long nLevel, const char *pszFileName, int nLineNo, const char *pszFmt, va_list ap)
+{
+    if (nLevel != LOG_LEVEL_CRITICAL)
     {
-        strLine += "\n";
+        if (nLevel < m_nCurrentLevel)
+            return false;
     }
 
-    if (nLevel != LOG_LEVEL_FATAL)
+    // 线程的t_state析构之后（如线程退出时析构的对象输出日志）不能再使用它
+    std::string strFallbackLine;
+    std::string &strLine = t_stateDestroyed ? strFallbackLine : t_state.line;
+
+    // 级别
+    strLine = (nLevel >= LOG_LEVEL_TRACE && nLevel <= LOG_LEVEL_CRITICAL) ? kLevelNames[nLevel] : "[INFO]";
+
+    // 时间，年月日时分秒部分每秒只格式化一次
+    int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    int64_t nowSecond = nowUs / 1000000;
+    int millisecond = static_cast<int>(nowUs % 1000000 / 1000);
+    char szTime[32];
+    if (t_stateDestroyed)
     {
-        std::lock_guard<std::mutex> lock_guard(m_mutexWrite);
-        m_listLinesToWrite.push_back(strLine);
-        m_cvWrite.notify_one();
+        size_t nLength = formatSecond(szTime, sizeof(szTime), static_cast<time_t>(nowSecond));
+        strLine.append(szTime, nLength);
     }
     else
     {
-        // 为了让FATAL级别的日志能立即crash程序，采取同步写日志的方法
-        std::cout << strLine << std::endl;
-#ifdef _WIN32
-        OutputDebugStringA(strLine.c_str());
-        OutputDebugStringA("\n");
-#endif
-
-        if (!m_strFileName.empty())
+        ThreadLogState &state = t_state;
+        if (state.cachedSecond != nowSecond)
         {
-            if (m_hLogFile == nullptr)
-            {
-                // 新建文件
-                char szNow[64];
-                time_t now = time(NULL);
-                tm time;
-#ifdef _WIN32
-                localtime_s(&time, &now);
-#else
-                localtime_r(&now, &time);
-#endif
-                strftime(szNow, sizeof(szNow), "%Y%m%d%H%M%S", &time);
-
-                std::string strNewFileName(m_strFileName);
-                strNewFileName += ".";
-                strNewFileName += szNow;
-                strNewFileName += ".";
-                strNewFileName += m_strFileNamePID;
-                strNewFileName += ".log";
-                if (!createNewFile(strNewFileName.c_str()))
-                    return false;
-            } // end inner if
-
-            writeToFile(strLine);
-
-        } // end outer-if
-
-        // 让程序主动crash掉
-        crash();
+            state.cachedTimeLength = formatSecond(state.cachedTime, sizeof(state.cachedTime), static_cast<time_t>(nowSecond));
+            state.cachedSecond = nowSecond;
+        }
+        strLine.append(state.cachedTime, state.cachedTimeLength);
     }
+    snprintf(szTime, sizeof(szTime), "%03d]]", millisecond);
+    strLine += szTime;
 
-    return true;
-}
-
-bool CAsyncLog::output(long nLevel, const char *pszFileName, int nLineNo, const char *pszFmt, ...)
-{
-    if (nLevel != LOG_LEVEL_CRITICAL)
+    // 当前线程信息
+    if (t_stateDestroyed)
     {
-        if (nLevel < m_nCurrentLevel)
-            return false;
+        std::ostringstream osThreadID;
+        osThreadID << std::this_thread::get_id();
+        strLine += "[" + osThreadID.str() + "]";
+    }
+    else
+    {
+        strLine += t_state.threadID;
     }
-
-    std::string strLine;
-    makeLinePrefix(nLevel, strLine);
 
     // 函数签名
-    char szFileName[512] = {0};
-    snprintf(szFileName, sizeof(szFileName), "[%s:%d]", pszFileName, nLineNo);
-    strLine += szFileName;
-
-    // 日志正文
-    std::string strLogMsg;
+    if (pszFileName != NULL)
+    {
+        char szFileName[512];
+        snprintf(szFileName, sizeof(szFileName), "[%s:%d]", pszFileName, nLineNo);
+        strLine += szFileName;
+    }
 
-    // 先计算一下不定参数的长度，以便于分配空间
-    va_list ap;
-    va_start(ap, pszFmt);
-    int nLogMsgLength = vsnprintf(NULL, 0, pszFmt, ap);
-    va_end(ap);
+    // 日志正文直接格式化到strLine的剩余空间，放不下时扩容再格式化一次
+    size_t nPrefixLength = strLine.size();
+    size_t nAvailable = std::max<size_t>(strLine.capacity() - nPrefixLength, MAX_LINE_LENGTH);
+    strLine.resize(nPrefixLength + nAvailable);
 
-    // 容量必须算上最后一个\0
-    if ((int)strLogMsg.capacity() < nLogMsgLength + 1)
+    va_list aq;
+    va_copy(aq, ap);
+    int nLogMsgLength = vsnprintf(&strLine[nPrefixLength], nAvailable, pszFmt, ap);
+    if (nLogMsgLength < 0)
+        nLogMsgLength = 0;
+    if (static_cast<size_t>(nLogMsgLength) >= nAvailable)
     {
-        strLogMsg.resize(nLogMsgLength + 1);
+        // 容量必须算上最后一个\0
+        strLine.resize(nPrefixLength + nLogMsgLength + 1);
+        vsnprintf(&strLine[nPrefixLength], nLogMsgLength + 1, pszFmt, aq);
     }
-    va_list aq;
-    va_start(aq, pszFmt);
-    vsnprintf((char *)strLogMsg.data(), strLogMsg.capacity(), pszFmt, aq);
     va_end(aq);
 
-    // string内容正确但length不对，恢复一下其length
-    std::string strMsgFormal;
-    strMsgFormal.append(strLogMsg.c_str(), nLogMsgLength);
-
     // 如果日志开启截断，长日志只取前MAX_LINE_LENGTH个字符
-    if (m_bTruncateLongLog)
-        strMsgFormal = strMsgFormal.substr(0, MAX_LINE_LENGTH);
+    if (m_bTruncateLongLog && nLogMsgLength > MAX_LINE_LENGTH)
+        nLogMsgLength = MAX_LINE_LENGTH;
 
-    strLine += strMsgFormal;
+    // 一行最多占缓冲区的一半，超出的部分截断
+    size_t nMaxMsgLength = m_nThreadBufferSize / 2 > nPrefixLength + 1 ? m_nThreadBufferSize / 2 - nPrefixLength - 1 : 0;
+    if (static_cast<size_t>(nLogMsgLength) > nMaxMsgLength)
+        nLogMsgLength = static_cast<int>(nMaxMsgLength);
 
-    // 不是输出到控制台才会在每一行末尾加一个换行符
-    if (!m_strFileName.empty())
-    {
-        strLine += "\n";
-    }
+    strLine.resize(nPrefixLength + nLogMsgLength);
+    strLine += "\n";
 
-    if (nLevel != LOG_LEVEL_FATAL)
-    {
-        std::lock_guard<std::mutex> lock_guard(m_mutexWrite);
-        m_listLinesToWrite.push_back(strLine);
-        m_cvWrite.notify_one();
-    }
-    else
+    if (nLevel == LOG_LEVEL_FATAL)
     {
-        // 为了让FATAL级别的日志能立即crash程序，采取同步写日志的方法
-        std::cout << strLine << std::endl;
-#ifdef _WIN32
-        OutputDebugStringA(strLine.c_str());
-        OutputDebugStringA("\n");
-#endif
-
-        if (!m_strFileName.empty())
+        // 先让写线程写出缓冲区中的日志，便于查看崩溃之前发生了什么
+        if (m_bRunning)
         {
-            if (m_hLogFile == nullptr)
-            {
-                // 新建文件
-                char szNow[64];
-                time_t now = time(NULL);
-                tm time;
-#ifdef _WIN32
-                localtime_s(&time, &now);
-#else
-                localtime_r(&now, &time);
-#endif
-                strftime(szNow, sizeof(szNow), "%Y%m%d%H%M%S", &time);
-
-                std::string strNewFileName(m_strFileName);
-                strNewFileName += ".";
-                strNewFileName += szNow;
-                strNewFileName += ".";
-                strNewFileName += m_strFileNamePID;
-                strNewFileName += ".log";
-                if (!createNewFile(strNewFileName.c_str()))
-                    return false;
-            } // end inner if
+            requestFlush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2 * FLUSH_INTERVAL_MS));
+        }
 
-            writeToFile(strLine);
-        } // end outer-if
+        // 为了让FATAL级别的日志能立即crash程序，采取同步写日志的方法
+        writeSync(strLine);
 
         // 让程序主动crash掉
         crash();
     }
+    else if (t_stateDestroyed)
+    {
+        writeSync(strLine);
+    }
+    else
+    {
+        appendLine(strLine.data(), strLine.size());
+    }
 
     return true;
 }
@@ -325,13 +423,77 @@ bool CAsyncLog::outputBinary(unsigned char *buffer, size_t size)
         }
     }
 
-    std::lock_guard<std::mutex> lock_guard(m_mutexWrite);
-    m_listLinesToWrite.push_back(os.str());
-    m_cvWrite.notify_one();
+    std::string strBinary = os.str();
+    if (t_stateDestroyed)
+        writeSync(strBinary);
+    else
+        appendLine(strBinary.data(), strBinary.size());
 
     return true;
 }
 
+void CAsyncLog::appendLine(const char *pszLine, size_t nLength)
+{
+    ThreadLogState &state = t_state;
+    if (!state.buffer)
+    {
+        state.buffer = std::make_shared<LogBuffer>(m_nThreadBufferSize);
+        std::lock_guard<std::mutex> guard(g_mutexBuffers);
+        g_buffers.push_back(state.buffer);
+    }
+
+    // 比整个缓冲区还长的日志只保留能放下的部分
+    LogBuffer &buffer = *state.buffer;
+    if (nLength > buffer.capacity)
+        nLength = buffer.capacity;
+
+    size_t nUsed = 0;
+    while (!buffer.push(pszLine, nLength, nUsed))
+    {
+        requestFlush();
+
+        // 写线程没有运行时等待没有意义，只能丢弃
+        if (m_nOverflowPolicy != LOG_OVERFLOW_BLOCK || !m_bRunning || m_bExit)
+        {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // 缓冲区过半时不等定时写出，立即唤醒写线程
+    if (nUsed > buffer.capacity / 2)
+        requestFlush();
+}
+
+void CAsyncLog::requestFlush()
+{
+    // 已经请求过、写线程还没有处理时不重复唤醒
+    if (m_bFlushRequested.exchange(true))
+        return;
+
+    std::lock_guard<std::mutex> guard(m_mutexWakeup);
+    m_cvWrite.notify_one();
+}
+
+void CAsyncLog::writeSync(const std::string &strLine)
+{
+    std::lock_guard<std::mutex> guard(m_mutexWrite);
+
+    fwrite(strLine.data(), 1, strLine.size(), stdout);
+    fflush(stdout);
+#ifdef _WIN32
+    OutputDebugStringA(strLine.c_str());
+#endif
+
+    if (!m_strFileName.empty() && rollFileIfNeeded())
+    {
+        writeToFile(strLine);
+        m_nCurrentWrittenSize += strLine.length();
+    }
+}
+
 const char *CAsyncLog::ullto4Str(int n)
 {
     static char buf[64 + 1];
@@ -376,58 +538,6 @@ char *CAsyncLog::formLog(int &index, char *szbuf, size_t size_buf, unsigned char
     return szbuf;
 }
 
-void CAsyncLog::makeLinePrefix(long nLevel, std::string &strPrefix)
-{
-    // 级别
-    strPrefix = "[INFO]";
-    if (nLevel == LOG_LEVEL_TRACE)
-        strPrefix = "[TRACE]";
-    else if (nLevel == LOG_LEVEL_DEBUG)
-        strPrefix = "[DEBUG]";
-    else if (nLevel == LOG_LEVEL_WARNING)
-        strPrefix = "[WARN]";
-    else if (nLevel == LOG_LEVEL_ERROR)
-        strPrefix = "[ERROR]";
-    else if (nLevel == LOG_LEVEL_SYSERROR)
-        strPrefix = "[SYSE]";
-    else if (nLevel == LOG_LEVEL_FATAL)
-        strPrefix = "[FATAL]";
-    else if (nLevel == LOG_LEVEL_CRITICAL)
-        strPrefix = "[CRITICAL]";
-
-    // 时间
-    char szTime[64] = {0};
-    getTime(szTime, sizeof(szTime));
-
-    strPrefix += "[";
-    strPrefix += szTime;
-    strPrefix += "]";
-
-    // 当前线程信息
-    char szThreadID[32] = {0};
-    std::ostringstream osThreadID;
-    osThreadID << std::this_thread::get_id();
-    snprintf(szThreadID, sizeof(szThreadID), "[%s]", osThreadID.str().c_str());
-    strPrefix += szThreadID;
-}
-
-void CAsyncLog::getTime(char *pszTime, int nTimeStrLength)
-{
-    struct timeb tp;
-    ftime(&tp);
-
-    time_t now = tp.time;
-    tm time;
-#ifdef _WIN32
-    localtime_s(&time, &now);
-#else
-    localtime_r(&now, &time);
-#endif
-
-    snprintf(pszTime, nTimeStrLength, "[%04d-%02d-%02d %02d:%02d:%02d:%03d]", time.tm_year + 1900, time.tm_mon + 1, time.tm_mday, time.tm_hour, time.tm_min, time.tm_sec, tp.millitm);
-    // strftime(pszTime, nTimeStrLength, "[%Y-%m-%d %H:%M:%S:]", &time);
-}
-
 bool CAsyncLog::createNewFile(const char *pszLogFileName)
 {
     if (m_hLogFile != nullptr)
@@ -472,71 +582,126 @@ void CAsyncLog::crash()
     *p = 0;
 }
 
+bool CAsyncLog::rollFileIfNeeded()
+{
+    if (m_hLogFile != nullptr && m_nCurrentWrittenSize < m_nFileRollSize)
+        return true;
+
+    // 重置m_nCurrentWrittenSize大小
+    m_nCurrentWrittenSize = 0;
+
+    // 第一次或者文件大小超过rollsize，均新建文件
+    char szNow[64];
+    time_t now = time(NULL);
+    tm time;
+#ifdef _WIN32
+    localtime_s(&time, &now);
+#else
+    localtime_r(&now, &time);
+#endif
+    strftime(szNow, sizeof(szNow), "%Y%m%d%H%M%S", &time);
+
+    std::string strNewFileName(m_strFileName);
+    strNewFileName += ".";
+    strNewFileName += szNow;
+    strNewFileName += ".";
+    strNewFileName += m_strFileNamePID;
+    strNewFileName += ".log";
+    return createNewFile(strNewFileName.c_str());
+}
+
 void CAsyncLog::writeThreadProc()
 {
     m_bRunning = true;
 
+    std::vector<std::shared_ptr<LogBuffer>> buffers;
+    std::vector<uint64_t> heads;
+    std::vector<std::pair<const char *, size_t>> slices;
+    std::string strDropped;
+
     while (true)
     {
-        if (!m_strFileName.empty())
         {
-            if (m_hLogFile == nullptr || m_nCurrentWrittenSize >= m_nFileRollSize)
-            {
-                // 重置m_nCurrentWrittenSize大小
-                m_nCurrentWrittenSize = 0;
+            std::unique_lock<std::mutex> guard(m_mutexWakeup);
+            if (!m_bFlushRequested && !m_bExit)
+                m_cvWrite.wait_for(guard, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        }
+        m_bFlushRequested = false;
+
+        // 退出前最后再写出一次所有缓冲区
+        bool bExit = m_bExit;
 
-                // 第一次或者文件大小超过rollsize，均新建文件
-                char szNow[64];
-                time_t now = time(NULL);
-                tm time;
-#ifdef _WIN32
-                localtime_s(&time, &now);
-#else
-                localtime_r(&now, &time);
-#endif
-                strftime(szNow, sizeof(szNow), "%Y%m%d%H%M%S", &time);
-
-                std::string strNewFileName(m_strFileName);
-                strNewFileName += ".";
-                strNewFileName += szNow;
-                strNewFileName += ".";
-                strNewFileName += m_strFileNamePID;
-                strNewFileName += ".log";
-                if (!createNewFile(strNewFileName.c_str()))
-                    return;
-            } // end inner if
-        } // end outer-if
-
-        std::string strLine;
         {
-            std::unique_lock<std::mutex> guard(m_mutexWrite);
-            while (m_listLinesToWrite.empty())
-            {
-                if (m_bExit)
-                    return;
+            std::lock_guard<std::mutex> guard(g_mutexBuffers);
+            buffers = g_buffers;
+        }
 
-                m_cvWrite.wait(guard);
+        // 取出每个线程缓冲区中已放入的日志，一个缓冲区最多两个片段
+        slices.clear();
+        strDropped.clear();
+        heads.resize(buffers.size());
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            LogBuffer &buffer = *buffers[i];
+            uint64_t t = buffer.tail.load(std::memory_order_relaxed);
+            uint64_t h = buffer.head.load(std::memory_order_acquire);
+            heads[i] = h;
+
+            if (h != t)
+            {
+                size_t pos = static_cast<size_t>(t % buffer.capacity);
+                size_t nLength = static_cast<size_t>(h - t);
+                size_t first = std::min(nLength, buffer.capacity - pos);
+                slices.emplace_back(&buffer.data[pos], first);
+                if (nLength > first)
+                    slices.emplace_back(&buffer.data[0], nLength - first);
             }
 
-            strLine = m_listLinesToWrite.front();
-            m_listLinesToWrite.pop_front();
+            uint64_t dropped = buffer.dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0)
+            {
+                char szDropped[128];
+                snprintf(szDropped, sizeof(szDropped), "[WARN][%llu log lines dropped, log writer fell behind]\n", (unsigned long long)dropped);
+                strDropped += szDropped;
+            }
         }
+        if (!strDropped.empty())
+            slices.emplace_back(strDropped.data(), strDropped.size());
 
-        std::cout << strLine << std::endl;
+        if (!slices.empty())
+        {
+            std::lock_guard<std::mutex> guard(m_mutexWrite);
 
-#ifdef _WIN32
-        OutputDebugStringA(strLine.c_str());
-        OutputDebugStringA("\n");
-#endif
+            writeSlices(stdout, slices);
 
-        if (!m_strFileName.empty())
-        {
-            if (!writeToFile(strLine))
-                return;
+            if (!m_strFileName.empty() && rollFileIfNeeded())
+            {
+                writeSlices(m_hLogFile, slices);
+                for (const auto &slice : slices)
+                    m_nCurrentWrittenSize += slice.second;
+            }
+        }
 
-            m_nCurrentWrittenSize += strLine.length();
+        // 写出之后才把空间还给各线程
+        for (size_t i = 0; i < buffers.size(); ++i)
+            buffers[i]->tail.store(heads[i], std::memory_order_release);
+
+        // 释放已退出线程的空缓冲区
+        {
+            std::lock_guard<std::mutex> guard(g_mutexBuffers);
+            g_buffers.erase(std::remove_if(g_buffers.begin(), g_buffers.end(),
+                                           [](const std::shared_ptr<LogBuffer> &buffer)
+                                           {
+                                               return buffer->abandoned.load(std::memory_order_acquire) &&
+                                                      buffer->head.load(std::memory_order_acquire) == buffer->tail.load(std::memory_order_relaxed);
+                                           }),
+                            g_buffers.end());
         }
+        buffers.clear();
+
+        if (bExit)
+            break;
     } // end outer-while-loop
 
     m_bRunning = false;
-}
\ No newline at end of file
+}
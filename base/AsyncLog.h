@@ -7,8 +7,10 @@
 #define __ASYNC_LOG_H__
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <string>
-#include <list>
+#include <atomic>
 #include <thread>
 #include <memory>
 #include <mutex>
@@ -34,16 +36,34 @@ enum LOG_LEVEL
     LOG_LEVEL_CRITICAL  // Critical logs that are always printed, regardless of log level
 };
 
+/**
+ * What a thread does when its log buffer is full because the writer thread fell behind.
+ */
+enum LOG_OVERFLOW_POLICY
+{
+    LOG_OVERFLOW_DROP, // Drop the line, the writer logs how many lines were dropped
+    LOG_OVERFLOW_BLOCK // Wait for the writer to make room
+};
+
 /**
  * Logging macro definitions.
  * Automatically include source file and line number for better debugging context.
+ * The level is checked before the arguments are evaluated, so a disabled level
+ * costs no formatting and no temporary strings such as peerAddress().toIpPort().
  */
-#define LOGT(...) CAsyncLog::output(LOG_LEVEL_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOGD(...) CAsyncLog::output(LOG_LEVEL_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define LOGI(...) CAsyncLog::output(LOG_LEVEL_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define LOGW(...) CAsyncLog::output(LOG_LEVEL_WARNING, __FILE__, __LINE__, __VA_ARGS__)
-#define LOGE(...) CAsyncLog::output(LOG_LEVEL_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define LOGSYSE(...) CAsyncLog::output(LOG_LEVEL_SYSERROR, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_IF_ENABLED(level, ...)                                             \
+    do                                                                         \
+    {                                                                          \
+        if (CAsyncLog::isLevelEnabled(level))                                  \
+            CAsyncLog::output(level, __FILE__, __LINE__, __VA_ARGS__);         \
+    } while (0)
+
+#define LOGT(...) LOG_IF_ENABLED(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOGD(...) LOG_IF_ENABLED(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOGI(...) LOG_IF_ENABLED(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOGW(...) LOG_IF_ENABLED(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOGE(...) LOG_IF_ENABLED(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOGSYSE(...) LOG_IF_ENABLED(LOG_LEVEL_SYSERROR, __VA_ARGS__)
 
 /**
  * FATAL logs are written synchronously and immediately cause the program to terminate.
@@ -66,9 +86,18 @@ public:
     static bool init(const char *pszLogFileName = nullptr, bool bTruncateLongLine = false, int64_t nRollSize = 10 * 1024 * 1024);
     static void uninit();
 
+    // 每个线程的日志缓冲区大小和缓冲区满时的策略，须在init之前和其他线程输出日志之前调用
+    static void setBuffering(size_t nThreadBufferSize, LOG_OVERFLOW_POLICY nPolicy);
+
     static void setLevel(LOG_LEVEL nLevel);
     static bool isRunning();
 
+    // 该级别的日志是否会输出，在格式化参数之前检查
+    static bool isLevelEnabled(long nLevel)
+    {
+        return nLevel == LOG_LEVEL_CRITICAL || nLevel >= m_nCurrentLevel;
+    }
+
     // 不输出线程ID号和所在函数签名、行号
     static bool output(long nLevel, const char *pszFmt, ...);
     // 输出线程ID号和所在函数签名、行号
@@ -83,9 +112,16 @@ private:
     CAsyncLog(const CAsyncLog &rhs) = delete;
     CAsyncLog &operator=(const CAsyncLog &rhs) = delete;
 
-    static void makeLinePrefix(long nLevel, std::string &strPrefix);
-    static void getTime(char *pszTime, int nTimeStrLength);
+    // 格式化一行日志并放入本线程的缓冲区，pszFileName为NULL时不输出文件名和行号
+    static bool outputV(long nLevel, const char *pszFileName, int nLineNo, const char *pszFmt, va_list ap);
+    // 把一行完整的日志放入本线程的缓冲区
+    static void appendLine(const char *pszLine, size_t nLength);
+    // 唤醒写线程立即写出
+    static void requestFlush();
+    // 不经过缓冲区直接写出，用于FATAL日志和线程退出之后输出的日志
+    static void writeSync(const std::string &strLine);
     static bool createNewFile(const char *pszLogFileName);
+    static bool rollFileIfNeeded();
     static bool writeToFile(const std::string &data);
     // 让程序主动崩溃
     static void crash();
@@ -104,12 +140,15 @@ private:
     static LOG_LEVEL m_nCurrentLevel;                 // 当前日志级别
     static int64_t m_nFileRollSize;                   // 单个日志文件的最大字节数
     static int64_t m_nCurrentWrittenSize;             // 已经写入的字节数目
-    static std::list<std::string> m_listLinesToWrite; // 待写入的日志
+    static size_t m_nThreadBufferSize;                // 每个线程的日志缓冲区大小
+    static LOG_OVERFLOW_POLICY m_nOverflowPolicy;     // 缓冲区满时的策略
     static std::unique_ptr<std::thread> m_spWriteThread;
-    static std::mutex m_mutexWrite;
+    static std::mutex m_mutexWrite;                   // 保护日志文件的写入
+    static std::mutex m_mutexWakeup;                  // 配合m_cvWrite唤醒写线程
     static std::condition_variable m_cvWrite;
-    static bool m_bExit;    // 退出标志
-    static bool m_bRunning; // 运行标志
+    static std::atomic<bool> m_bFlushRequested;       // 有线程的缓冲区过半或已满，写线程立即写出
+    static std::atomic<bool> m_bExit;                 // 退出标志
+    static std::atomic<bool> m_bRunning;              // 运行标志
 };
 
 #endif // !__ASYNC_LOG_H__
\ No newline at end of file
@@ -0,0 +1,214 @@
+/**
+ * xiebaoma
+ * 2025-06-06
+ */
+
+#include "Metrics.h"
+
+#include <stdio.h>
+
+MetricCounter::MetricCounter(int shards)
+    : m_shardCount(shards > 0 ? shards : 1),
+      m_shards(new Shard[m_shardCount]())
+{
+}
+
+uint64_t MetricCounter::value() const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < m_shardCount; ++i)
+        total += m_shards[i].value.load(std::memory_order_relaxed);
+    return total;
+}
+
+MetricHistogram::MetricHistogram(int shards)
+    : m_shardCount(shards > 0 ? shards : 1),
+      m_shards(new Shard[m_shardCount]())
+{
+}
+
+void MetricHistogram::record(int64_t us)
+{
+    Shard &shard = m_shards[m_shardCount == 1 ? 0 : metricsThreadIndex() % m_shardCount];
+    uint64_t value = us > 0 ? static_cast<uint64_t>(us) : 0;
+    shard.buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void MetricHistogram::snapshot(std::vector<uint64_t> &buckets, uint64_t &count, uint64_t &sum) const
+{
+    buckets.assign(kBuckets, 0);
+    count = 0;
+    sum = 0;
+    for (int i = 0; i < m_shardCount; ++i)
+    {
+        for (int b = 0; b < kBuckets; ++b)
+            buckets[b] += m_shards[i].buckets[b].load(std::memory_order_relaxed);
+        sum += m_shards[i].sum.load(std::memory_order_relaxed);
+    }
+
+    // The count is taken from the buckets so it always matches them
+    for (int b = 0; b < kBuckets; ++b)
+        count += buckets[b];
+}
+
+int MetricHistogram::bucketOf(uint64_t us)
+{
+    // Buckets are closed at the top, bucket b counts (bucketUpperBound(b - 1), bucketUpperBound(b)]
+    uint64_t v = us > 0 ? us - 1 : 0;
+    if (v < static_cast<uint64_t>(kSubBuckets))
+        return static_cast<int>(v);
+
+    int exponent = 63 - __builtin_clzll(v);
+    if (exponent > kMaxExponent)
+        return kBuckets - 1;
+
+    int sub = static_cast<int>((v >> (exponent - kSubBucketBits)) & (kSubBuckets - 1));
+    return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+uint64_t MetricHistogram::bucketUpperBound(int bucket)
+{
+    if (bucket < kSubBuckets)
+        return static_cast<uint64_t>(bucket) + 1;
+
+    int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % kSubBuckets);
+    return (kSubBuckets + sub + 1) << (exponent - kSubBucketBits);
+}
+
+void MetricsRegistry::add(const std::string &name, const std::string &help, const std::string &labels, const MetricCounter *metric)
+{
+    addEntry(name, help, labels, kCounter, metric);
+}
+
+void MetricsRegistry::add(const std::string &name, const std::string &help, const std::string &labels, const MetricGauge *metric)
+{
+    addEntry(name, help, labels, kGauge, metric);
+}
+
+void MetricsRegistry::add(const std::string &name, const std::string &help, const std::string &labels, const MetricHistogram *metric)
+{
+    addEntry(name, help, labels, kHistogram, metric);
+}
+
+void MetricsRegistry::addEntry(const std::string &name, const std::string &help, const std::string &labels, Type type, const void *metric)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    auto iter = m_families.find(name);
+    if (iter == m_families.end())
+    {
+        Family family;
+        family.help = help;
+        family.type = type;
+        iter = m_families.insert(std::make_pair(name, family)).first;
+    }
+
+    Entry entry;
+    entry.labels = labels;
+    entry.metric = metric;
+    iter->second.entries.push_back(entry);
+}
+
+void MetricsRegistry::remove(const void *metric)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    for (auto iter = m_families.begin(); iter != m_families.end();)
+    {
+        std::vector<Entry> &entries = iter->second.entries;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (entries[i].metric == metric)
+            {
+                entries.erase(entries.begin() + i);
+                break;
+            }
+        }
+
+        if (entries.empty())
+            iter = m_families.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+namespace
+{
+    // Histogram buckets exported to Prometheus, 8us to about 4.8 hours
+    const int kFirstExportedExponent = 3;
+    const int kLastExportedExponent = 34;
+
+    void appendSample(std::string &out, const std::string &name, const std::string &labels, const char *extraLabel, double value)
+    {
+        out += name;
+        if (!labels.empty() || extraLabel != NULL)
+        {
+            out += '{';
+            out += labels;
+            if (extraLabel != NULL)
+            {
+                if (!labels.empty())
+                    out += ',';
+                out += extraLabel;
+            }
+            out += '}';
+        }
+
+        char buf[64];
+        snprintf(buf, sizeof(buf), " %.15g\n", value);
+        out += buf;
+    }
+}
+
+std::string MetricsRegistry::render() const
+{
+    std::string out;
+    std::vector<uint64_t> buckets;
+    char le[64];
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    for (const auto &family : m_families)
+    {
+        const std::string &name = family.first;
+        static const char *const typeNames[] = {"counter", "gauge", "histogram"};
+        out += "# HELP " + name + " " + family.second.help + "\n";
+        out += "# TYPE " + name + " " + typeNames[family.second.type] + "\n";
+
+        for (const Entry &entry : family.second.entries)
+        {
+            if (family.second.type == kCounter)
+            {
+                appendSample(out, name, entry.labels, NULL, static_cast<double>(static_cast<const MetricCounter *>(entry.metric)->value()));
+                continue;
+            }
+
+            if (family.second.type == kGauge)
+            {
+                appendSample(out, name, entry.labels, NULL, static_cast<const MetricGauge *>(entry.metric)->value());
+                continue;
+            }
+
+            uint64_t count;
+            uint64_t sum;
+            static_cast<const MetricHistogram *>(entry.metric)->snapshot(buckets, count, sum);
+
+            // Every power of two is the upper bound of a bucket, the counts below it add up exactly
+            uint64_t cumulative = 0;
+            int bucket = 0;
+            for (int exponent = kFirstExportedExponent; exponent <= kLastExportedExponent; ++exponent)
+            {
+                uint64_t bound = static_cast<uint64_t>(1) << exponent;
+                while (bucket < MetricHistogram::kBuckets && MetricHistogram::bucketUpperBound(bucket) <= bound)
+                    cumulative += buckets[bucket++];
+
+                snprintf(le, sizeof(le), "le=\"%.6f\"", static_cast<double>(bound) / 1000000);
+                appendSample(out, name + "_bucket", entry.labels, le, static_cast<double>(cumulative));
+            }
+            appendSample(out, name + "_bucket", entry.labels, "le=\"+Inf\"", static_cast<double>(count));
+            appendSample(out, name + "_sum", entry.labels, NULL, static_cast<double>(sum) / 1000000);
+            appendSample(out, name + "_count", entry.labels, NULL, static_cast<double>(count));
+        }
+    }
+
+    return out;
+}
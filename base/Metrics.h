@@ -0,0 +1,235 @@
+/**
+ * @file Metrics.h
+ * @brief Lock-free counters and latency histograms, exported in the Prometheus text format
+ *
+ * Recording never takes a lock: a counter or histogram is split into shards and a
+ * thread only adds to the shard picked by its thread index, so threads recording the
+ * same metric do not share cache lines. Readers sum the shards when the metrics are
+ * scraped. Metrics with a single writer, such as the ones of an EventLoop, use one shard.
+ *
+ * @author xiebaoma
+ * @date 2025-06-06
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Microseconds of a monotonic clock, for measuring durations
+ */
+inline int64_t monotonicMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Index of the calling thread, picks the shard it records into
+ */
+inline int metricsThreadIndex()
+{
+    static std::atomic<int> nextIndex(0);
+    thread_local int index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+/**
+ * @class MetricCounter
+ * @brief Monotonic counter
+ */
+class MetricCounter
+{
+public:
+    static const int kDefaultShards = 16;
+
+    /**
+     * @param shards Number of shards, 1 for a counter written by one thread
+     */
+    explicit MetricCounter(int shards = kDefaultShards);
+
+    MetricCounter(const MetricCounter &) = delete;
+    MetricCounter &operator=(const MetricCounter &) = delete;
+
+    /**
+     * @brief Adds to the counter, thread safe
+     */
+    void add(uint64_t n = 1)
+    {
+        m_shards[m_shardCount == 1 ? 0 : metricsThreadIndex() % m_shardCount].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sum of the shards
+     */
+    uint64_t value() const;
+
+private:
+    struct Shard
+    {
+        std::atomic<uint64_t> value;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    int m_shardCount;
+    std::unique_ptr<Shard[]> m_shards;
+};
+
+/**
+ * @class MetricGauge
+ * @brief Value sampled when the metrics are scraped
+ */
+class MetricGauge
+{
+public:
+    /**
+     * @param sampler Returns the current value, called from the scraping thread
+     */
+    explicit MetricGauge(const std::function<double()> &sampler) : m_sampler(sampler) {}
+
+    MetricGauge(const MetricGauge &) = delete;
+    MetricGauge &operator=(const MetricGauge &) = delete;
+
+    double value() const { return m_sampler(); }
+
+private:
+    std::function<double()> m_sampler;
+};
+
+/**
+ * @class MetricHistogram
+ * @brief Distribution of durations in microseconds
+ *
+ * Buckets are log-linear like an HDR histogram: every power of two is split into
+ * kSubBuckets buckets, so a recorded value is known to within 12.5% from 16us up to
+ * days, in a fixed array of kBuckets counters per shard.
+ */
+class MetricHistogram
+{
+public:
+    static const int kDefaultShards = 16;
+    static const int kSubBucketBits = 3;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kMaxExponent = 40;
+    static const int kBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+    /**
+     * @param shards Number of shards, 1 for a histogram written by one thread
+     */
+    explicit MetricHistogram(int shards = kDefaultShards);
+
+    MetricHistogram(const MetricHistogram &) = delete;
+    MetricHistogram &operator=(const MetricHistogram &) = delete;
+
+    /**
+     * @brief Records a duration, thread safe
+     * @param us Duration in microseconds, negative values count as 0
+     */
+    void record(int64_t us);
+
+    /**
+     * @brief Sums the shards
+     * @param buckets Set to the count of each bucket
+     * @param count Set to the number of recorded values
+     * @param sum Set to the sum of the recorded values in microseconds
+     */
+    void snapshot(std::vector<uint64_t> &buckets, uint64_t &count, uint64_t &sum) const;
+
+    /**
+     * @brief Bucket counting a value, each bucket counts the values above the previous
+     *        bucket's upper bound up to its own
+     */
+    static int bucketOf(uint64_t us);
+
+    /**
+     * @brief Largest value in microseconds counted by a bucket
+     */
+    static uint64_t bucketUpperBound(int bucket);
+
+private:
+    struct Shard
+    {
+        std::atomic<uint64_t> buckets[kBuckets];
+        std::atomic<uint64_t> sum;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    int m_shardCount;
+    std::unique_ptr<Shard[]> m_shards;
+};
+
+/**
+ * @class MetricsRegistry
+ * @brief Named metrics, rendered for a Prometheus scrape
+ *
+ * Metrics are owned by whoever records them and registered by address under a name
+ * and a label set such as loop="1". An owner that goes away before the process
+ * must remove its metrics first. Used through Singleton<MetricsRegistry>; the first
+ * use must happen before other threads start, the main EventLoop takes care of that.
+ */
+class MetricsRegistry
+{
+public:
+    MetricsRegistry() = default;
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    /**
+     * @brief Registers a metric, thread safe
+     * @param name Metric name, the same for every label set
+     * @param help Description, taken from the first registration of the name
+     * @param labels Label set without braces, e.g. cmd="upload", may be empty
+     * @param metric The metric, must stay alive until removed
+     */
+    void add(const std::string &name, const std::string &help, const std::string &labels, const MetricCounter *metric);
+    void add(const std::string &name, const std::string &help, const std::string &labels, const MetricGauge *metric);
+    void add(const std::string &name, const std::string &help, const std::string &labels, const MetricHistogram *metric);
+
+    /**
+     * @brief Unregisters a metric, thread safe
+     */
+    void remove(const void *metric);
+
+    /**
+     * @brief Renders every metric in the Prometheus text exposition format 0.0.4
+     *
+     * Histograms are in seconds, with a bucket per power of two microseconds.
+     */
+    std::string render() const;
+
+private:
+    enum Type
+    {
+        kCounter,
+        kGauge,
+        kHistogram
+    };
+
+    struct Entry
+    {
+        std::string labels;
+        const void *metric;
+    };
+
+    struct Family
+    {
+        std::string help;
+        Type type;
+        std::vector<Entry> entries;
+    };
+
+    void addEntry(const std::string &name, const std::string &help, const std::string &labels, Type type, const void *metric);
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Family> m_families; ///< Metric name to its label sets, sorted for stable output
+};
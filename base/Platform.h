@@ -108,6 +108,7 @@ typedef int SOCKET;
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/syscall.h>
 
 // Ensure compatibility on Ubuntu for readv() usage
@@ -45,6 +45,9 @@ namespace net
         // Starts listening for incoming connections.
         void listen();
 
+        // Returns the listening socket.
+        SOCKET fd() const { return m_acceptSocket.fd(); }
+
     private:
         // Internal handler for read events on the listening socket.
         void handleRead();
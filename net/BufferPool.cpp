@@ -0,0 +1,99 @@
+/*
+xiebaoma
+2025-06-06
+*/
+
+#include "BufferPool.h"
+
+#include <utility>
+
+#include "../base/Timestamp.h"
+
+using namespace net;
+
+namespace
+{
+    // Free entries that stay unused this long are released to the heap
+    const int64_t kTrimIntervalUs = 10 * Timestamp::kMicroSecondsPerSecond;
+}
+
+const size_t BufferPool::kMinClassSize;
+const int BufferPool::kClassCount;
+const size_t BufferPool::kMaxClassBytes;
+const size_t BufferPool::kScratchSize;
+
+BufferPool::BufferPool()
+    : m_scratch(kScratchSize),
+      m_lastTrim(Timestamp::now().microSecondsSinceEpoch()),
+      m_pooledBytes(0)
+{
+    for (int i = 0; i < kClassCount; ++i)
+        m_classes[i].minEntries = 0;
+}
+
+int BufferPool::classOf(size_t size)
+{
+    for (int i = 0; i < kClassCount; ++i)
+    {
+        if (size <= classSize(i))
+            return i;
+    }
+
+    return -1;
+}
+
+std::vector<char> BufferPool::acquire(size_t size)
+{
+    trimIfDue();
+
+    int index = classOf(size);
+    if (index < 0)
+        return std::vector<char>(size);
+
+    FreeList &freeList = m_classes[index];
+    if (freeList.entries.empty())
+        return std::vector<char>(classSize(index));
+
+    std::vector<char> storage(std::move(freeList.entries.back()));
+    freeList.entries.pop_back();
+    if (freeList.entries.size() < freeList.minEntries)
+        freeList.minEntries = freeList.entries.size();
+    m_pooledBytes.fetch_sub(storage.size(), std::memory_order_relaxed);
+    return storage;
+}
+
+void BufferPool::release(std::vector<char> &storage)
+{
+    trimIfDue();
+
+    // Only storage made by acquire() has exactly the size and capacity of its class
+    int index = classOf(storage.size());
+    if (index >= 0 && storage.size() == classSize(index) && storage.capacity() == storage.size())
+    {
+        FreeList &freeList = m_classes[index];
+        if ((freeList.entries.size() + 1) * classSize(index) <= kMaxClassBytes)
+        {
+            m_pooledBytes.fetch_add(storage.size(), std::memory_order_relaxed);
+            freeList.entries.push_back(std::move(storage));
+        }
+    }
+
+    std::vector<char>().swap(storage);
+}
+
+void BufferPool::trimIfDue()
+{
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    if (now - m_lastTrim < kTrimIntervalUs)
+        return;
+
+    m_lastTrim = now;
+    for (int i = 0; i < kClassCount; ++i)
+    {
+        FreeList &freeList = m_classes[i];
+        size_t unused = freeList.minEntries;
+        freeList.entries.resize(freeList.entries.size() - unused);
+        m_pooledBytes.fetch_sub(unused * classSize(i), std::memory_order_relaxed);
+        freeList.minEntries = freeList.entries.size();
+    }
+}
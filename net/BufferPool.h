@@ -0,0 +1,72 @@
+/*
+xiebaoma
+2025-06-06
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+namespace net
+{
+    /**
+     * @brief Free lists of ByteBuffer storage in a few size classes, one pool per EventLoop.
+     *
+     * The input buffers of a loop's connections take their storage from the pool when
+     * they grow and give it back once they are drained, so memory left over from a burst
+     * of large packages stays with the loop, bounded per class, instead of with every
+     * connection. Entries that were not needed for a whole trim period are freed.
+     *
+     * Not thread-safe, only the loop thread uses it. pooledBytes() may be read anywhere.
+     */
+    class BufferPool
+    {
+    public:
+        static const size_t kMinClassSize = 4 * 1024;         // Classes are 4KB, 16KB, 64KB, 256KB and 1MB
+        static const int kClassCount = 5;
+        static const size_t kMaxClassBytes = 2 * 1024 * 1024; // Free bytes kept per class
+        static const size_t kScratchSize = 65536;             // Size of scratch()
+
+        BufferPool();
+
+        BufferPool(const BufferPool &rhs) = delete;
+        BufferPool &operator=(const BufferPool &rhs) = delete;
+
+        // Storage of at least size bytes, its size() is the usable size.
+        std::vector<char> acquire(size_t size);
+
+        // Takes the storage back, it is kept if it is of a class that has room. storage is left empty.
+        void release(std::vector<char> &storage);
+
+        // Scratch space of kScratchSize bytes for reads that do not fit a buffer.
+        char *scratch() { return &m_scratch[0]; }
+
+        // Bytes held in the free lists.
+        size_t pooledBytes() const { return m_pooledBytes.load(std::memory_order_relaxed); }
+
+    private:
+        struct FreeList
+        {
+            std::vector<std::vector<char>> entries; // Free storage of the class.
+            size_t minEntries;                      // Fewest entries since the last trim.
+        };
+
+        static size_t classSize(int index) { return kMinClassSize << (2 * index); }
+
+        // Smallest class holding size bytes, -1 if it is larger than all of them.
+        static int classOf(size_t size);
+
+        // Frees the entries no acquire() needed since the last trim.
+        void trimIfDue();
+
+    private:
+        FreeList m_classes[kClassCount];
+        std::vector<char> m_scratch;
+        int64_t m_lastTrim;                 // Microseconds since epoch of the last trim.
+        std::atomic<size_t> m_pooledBytes;
+    };
+
+} // namespace net
@@ -13,8 +13,17 @@ const size_t ByteBuffer::kInitialSize;
 
 int32_t ByteBuffer::readFd(int fd, int *savedErrno)
 {
+    // A pooled buffer reads through the scratch space of its loop instead of the stack
+    if (m_pool != NULL)
+        return readFd(fd, savedErrno, m_pool->scratch(), BufferPool::kScratchSize);
+
     // saved an ioctl()/FIONREAD call to tell how much to read
     char extrabuf[65536];
+    return readFd(fd, savedErrno, extrabuf, sizeof extrabuf);
+}
+
+int32_t ByteBuffer::readFd(int fd, int *savedErrno, char *extrabuf, size_t extrabufSize)
+{
     const size_t writable = writableBytes();
 #ifndef WIN32
     struct iovec vec[2];
@@ -22,13 +31,13 @@ int32_t ByteBuffer::readFd(int fd, int *savedErrno)
     vec[0].iov_base = begin() + m_writerIndex;
     vec[0].iov_len = writable;
     vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof extrabuf;
+    vec[1].iov_len = extrabufSize;
     // when there is enough space in this ByteBuffer, don't read into extrabuf.
     // when extrabuf is used, we read 128k-1 bytes at most.
-    const int iovcnt = (writable < sizeof extrabuf) ? 2 : 1;
+    const int iovcnt = (writable < extrabufSize) ? 2 : 1;
     const ssize_t n = sockets::readv(fd, vec, iovcnt);
 #else
-    const int32_t n = sockets::read(fd, extrabuf, sizeof(extrabuf));
+    const int32_t n = sockets::read(fd, extrabuf, static_cast<int32_t>(extrabufSize));
 #endif
     if (n <= 0)
     {
@@ -64,3 +73,16 @@ int32_t ByteBuffer::readFd(int fd, int *savedErrno)
     // }
     return n;
 }
+
+void ByteBuffer::growFromPool(size_t len)
+{
+    // Grow at least twofold, buffers larger than the classes must not be copied on every read
+    size_t readable = readableBytes();
+    size_t size = std::max(kCheapPrepend + readable + len, m_buffer.size() * 2);
+    std::vector<char> storage = m_pool->acquire(size);
+    std::copy(begin() + m_readerIndex, begin() + m_writerIndex, storage.begin() + kCheapPrepend);
+    m_buffer.swap(storage);
+    m_pool->release(storage);
+    m_readerIndex = kCheapPrepend;
+    m_writerIndex = m_readerIndex + readable;
+}
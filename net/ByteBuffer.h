@@ -13,6 +13,7 @@ xiebaoma
 #include "../base/Platform.h"
 #include "Sockets.h"
 #include "Endian.h"
+#include "BufferPool.h"
 
 namespace net
 {
@@ -33,10 +34,30 @@ namespace net
         explicit ByteBuffer(size_t initialSize = kInitialSize)
             : m_buffer(kCheapPrepend + initialSize),
               m_readerIndex(kCheapPrepend),
-              m_writerIndex(kCheapPrepend)
+              m_writerIndex(kCheapPrepend),
+              m_pool(NULL)
         {
         }
 
+        /// Makes the buffer grow into storage of the pool, and lets releaseToPool() return it.
+        /// The pool is only used by the thread that owns it, so must the buffer be.
+        void setPool(BufferPool *pool)
+        {
+            m_pool = pool;
+        }
+
+        /// Gives the storage back to the pool if the buffer is empty and holds more than
+        /// keepBytes, the buffer then grows from the pool again on the next append.
+        void releaseToPool(size_t keepBytes)
+        {
+            if (m_pool == NULL || readableBytes() > 0 || m_buffer.size() <= keepBytes)
+                return;
+
+            m_pool->release(m_buffer);
+            m_buffer.resize(kCheapPrepend);
+            retrieveAll();
+        }
+
         void swap(ByteBuffer &rhs)
         {
             m_buffer.swap(rhs.m_buffer);
@@ -433,6 +454,12 @@ namespace net
             // kCheapPrepend为保留的空间
             if (writableBytes() + prependableBytes() < len + kCheapPrepend)
             {
+                if (m_pool != NULL)
+                {
+                    growFromPool(len);
+                    return;
+                }
+
                 // FIXME: move readable data
                 m_buffer.resize(m_writerIndex + len);
             }
@@ -452,10 +479,16 @@ namespace net
             }
         }
 
+        // Moves the readable data into larger storage from the pool.
+        void growFromPool(size_t len);
+
+        int32_t readFd(int fd, int *savedErrno, char *extrabuf, size_t extrabufSize);
+
     private:
         std::vector<char> m_buffer;
         size_t m_readerIndex;
         size_t m_writerIndex;
+        BufferPool *m_pool; // Where the storage comes from, NULL for the heap.
 
         static const char kCRLF[];
     };
@@ -91,6 +91,9 @@ namespace net
         // Check if writing is currently enabled
         bool isWriting() const { return m_events & kWriteEvent; }
 
+        // Check if reading is currently enabled
+        bool isReading() const { return m_events & kReadEvent; }
+
         // Get the index used by the poller (e.g., epoll)
         int index() { return m_index; }
 
@@ -5,15 +5,12 @@
 #include <string.h>
 
 #include "../base/AsyncLog.h"
+#include "../base/Singleton.h"
 #include "Channel.h"
 #include "Sockets.h"
 #include "InetAddress.h"
 
-#ifdef WIN32
-#include "SelectPoller.h"
-#else
-#include "EpollPoller.h"
-#endif
+#include "Poller.h"
 
 using namespace net;
 
@@ -22,7 +19,13 @@ using namespace net;
 
 thread_local EventLoop *t_loopInThisThread = 0;
 
+// Poll timeout while a frame functor is set, it runs once per iteration
 const int kPollTimeMs = 1;
+// Longest poll without timers due, wakeup() interrupts it
+const int kMaxPollTimeMs = 10000;
+
+// Source of loop indexes, the metrics label of each loop
+static std::atomic<int> g_nextLoopIndex(0);
 
 EventLoop *getEventLoopOfCurrentThread()
 {
@@ -37,18 +40,30 @@ EventLoop::EventLoop() : m_looping(false),
                          m_threadId(std::this_thread::get_id()),
                          m_timerQueue(new TimerQueue(this)),
                          m_iteration(0L),
-                         currentActiveChannel_(NULL)
+                         currentActiveChannel_(NULL),
+                         m_wakeupPending(false),
+                         m_connectionCount(0),
+                         m_pendingOutputBytes(0),
+                         m_index(g_nextLoopIndex++),
+                         m_iterationTime(1),
+                         m_taskDelay(1),
+                         m_bytesReceived(1),
+                         m_bytesSent(1),
+                         m_connectionGauge([this]()
+                                           { return static_cast<double>(connectionCount()); }),
+                         m_pendingOutputGauge([this]()
+                                              { return static_cast<double>(pendingOutputBytes()); }),
+                         m_bufferPoolGauge([this]()
+                                           { return static_cast<double>(m_bufferPool.pooledBytes()); })
 {
     createWakeupfd();
 
 #ifdef WIN32
     m_wakeupChannel.reset(new Channel(this, m_wakeupFdRecv));
-    m_poller.reset(new SelectPoller(this));
-
 #else
     m_wakeupChannel.reset(new Channel(this, m_wakeupFd));
-    m_poller.reset(new EPollPoller(this));
 #endif
+    m_poller.reset(Poller::newDefaultPoller(this));
 
     if (t_loopInThisThread)
     {
@@ -61,6 +76,8 @@ EventLoop::EventLoop() : m_looping(false),
     m_wakeupChannel->setReadCallback(std::bind(&EventLoop::handleRead, this));
     // we are always reading the wakeupfd
     m_wakeupChannel->enableReading();
+
+    registerMetrics();
 }
 
 EventLoop::~EventLoop()
@@ -68,6 +85,15 @@ EventLoop::~EventLoop()
     assertInLoopThread();
     LOGD("EventLoop 0x%x destructs.", this);
 
+    MetricsRegistry &registry = Singleton<MetricsRegistry>::Instance();
+    registry.remove(&m_iterationTime);
+    registry.remove(&m_taskDelay);
+    registry.remove(&m_bytesReceived);
+    registry.remove(&m_bytesSent);
+    registry.remove(&m_connectionGauge);
+    registry.remove(&m_pendingOutputGauge);
+    registry.remove(&m_bufferPoolGauge);
+
     // std::stringstream ss;
     // ss << "eventloop destructs threadid = " << threadId_;
     // std::cout << ss.str() << std::endl;
@@ -97,12 +123,27 @@ void EventLoop::loop()
     m_quit = false; // FIXME: what if someone calls quit() before loop() ?
     LOGD("EventLoop 0x%x  start looping", this);
 
+    int64_t busySince = 0;
     while (!m_quit)
     {
         m_timerQueue->doTimer();
 
+        // Sleep until the next timer is due, or not at all if tasks queued by timers are waiting
+        int timeoutMs = 0;
+        if (m_pendingTasks.empty())
+        {
+            timeoutMs = m_timerQueue->nextTimeout(m_frameFunctor ? kPollTimeMs : kMaxPollTimeMs);
+        }
+
+        // An iteration is timed from one poll return to the next poll, timers included
+        if (busySince != 0)
+        {
+            m_iterationTime.record(monotonicMicroseconds() - busySince);
+        }
+
         m_activeChannels.clear();
-        m_pollReturnTime = m_poller->poll(kPollTimeMs, &m_activeChannels);
+        m_pollReturnTime = m_poller->poll(timeoutMs, &m_activeChannels);
+        busySince = monotonicMicroseconds();
         // if (Logger::logLevel() <= Logger::TRACE)
         //{
         printActiveChannels();
@@ -146,31 +187,6 @@ void EventLoop::quit()
     }
 }
 
-void EventLoop::runInLoop(const Functor &cb)
-{
-    if (isInLoopThread())
-    {
-        cb();
-    }
-    else
-    {
-        queueInLoop(cb);
-    }
-}
-
-void EventLoop::queueInLoop(const Functor &cb)
-{
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_pendingFunctors.push_back(cb);
-    }
-
-    if (!isInLoopThread() || m_doingOtherTasks)
-    {
-        wakeup();
-    }
-}
-
 void EventLoop::setFrameFunctor(const Functor &cb)
 {
     m_frameFunctor = cb;
@@ -387,22 +403,47 @@ bool EventLoop::handleRead()
 
 void EventLoop::doOtherTasks()
 {
-    std::vector<Functor> functors;
     m_doingOtherTasks = true;
 
+    // Posts from here on must wake the loop again
+    m_wakeupPending.store(false);
+
+    // Take what is queued now, tasks queued by these tasks run next iteration
+    while (TaskNode *task = m_pendingTasks.pop())
     {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        functors.swap(m_pendingFunctors);
+        m_runningTasks.push_back(task);
     }
 
-    for (size_t i = 0; i < functors.size(); ++i)
+    // A producer is halfway through its push, poll again instead of waiting for it
+    if (!m_pendingTasks.empty())
     {
-        functors[i]();
+        wakeup();
     }
 
+    for (size_t i = 0; i < m_runningTasks.size(); ++i)
+    {
+        m_taskDelay.record(monotonicMicroseconds() - m_runningTasks[i]->queuedTime());
+        m_runningTasks[i]->run();
+        delete m_runningTasks[i];
+    }
+    m_runningTasks.clear();
+
     m_doingOtherTasks = false;
 }
 
+void EventLoop::registerMetrics()
+{
+    std::string labels = "loop=\"" + std::to_string(m_index) + "\"";
+    MetricsRegistry &registry = Singleton<MetricsRegistry>::Instance();
+    registry.add("eventloop_iteration_seconds", "Time an event loop iteration takes, without waiting in poll.", labels, &m_iterationTime);
+    registry.add("eventloop_task_delay_seconds", "Time from queueing a task on an event loop to it running.", labels, &m_taskDelay);
+    registry.add("eventloop_received_bytes_total", "Bytes read by the connections of an event loop.", labels, &m_bytesReceived);
+    registry.add("eventloop_sent_bytes_total", "Bytes written by the connections of an event loop.", labels, &m_bytesSent);
+    registry.add("eventloop_connections", "Connections served by an event loop.", labels, &m_connectionGauge);
+    registry.add("eventloop_pending_output_bytes", "Output bytes queued on the connections of an event loop.", labels, &m_pendingOutputGauge);
+    registry.add("eventloop_buffer_pool_bytes", "Free input buffer storage kept by an event loop.", labels, &m_bufferPoolGauge);
+}
+
 void EventLoop::printActiveChannels() const
 {
     // TODO: 改成for-each 语法
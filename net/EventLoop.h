@@ -10,14 +10,19 @@ xiebaoma
 #include <functional>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <utility>
 #include <condition_variable>
 
 #include "../base/Timestamp.h"
 #include "../base/Platform.h"
+#include "../base/Metrics.h"
 #include "Callbacks.h"
 #include "Sockets.h"
 #include "TimerId.h"
 #include "TimerQueue.h"
+#include "TaskQueue.h"
+#include "BufferPool.h"
 
 namespace net
 {
@@ -64,16 +69,60 @@ namespace net
         /// Returns the current iteration count of the event loop
         int64_t iteration() const { return m_iteration; }
 
+        /// Connections served by this loop.
+        /// Safe to read from other threads, for placement and monitoring.
+        int32_t connectionCount() const { return m_connectionCount.load(std::memory_order_relaxed); }
+
+        /// Output bytes queued on this loop's connections and not written yet.
+        /// Safe to read from other threads, for placement and monitoring.
+        int64_t pendingOutputBytes() const { return m_pendingOutputBytes.load(std::memory_order_relaxed); }
+
+        /// Adjusts the load counters. A connection is counted by the server when it is placed
+        /// on the loop, the output bytes and the uncounting are done by the connection.
+        void addConnectionCount(int32_t delta) { m_connectionCount.fetch_add(delta, std::memory_order_relaxed); }
+        void addPendingOutputBytes(int64_t delta) { m_pendingOutputBytes.fetch_add(delta, std::memory_order_relaxed); }
+
+        /// Storage for the input buffers of this loop's connections, loop thread only.
+        BufferPool *bufferPool() { return &m_bufferPool; }
+
+        /// Counts socket traffic, called by the loop's connections.
+        void addBytesReceived(int64_t n) { m_bytesReceived.add(static_cast<uint64_t>(n)); }
+        void addBytesSent(int64_t n) { m_bytesSent.add(static_cast<uint64_t>(n)); }
+
         /// Runs callback immediately in the loop thread.
         /// It wakes up the loop, and run the cb.
         /// If in the same loop thread, cb is run within the function.
         /// Safe to call from other threads.
-        void runInLoop(const Functor &cb);
-        
+        template <typename F>
+        void runInLoop(F &&cb)
+        {
+            if (isInLoopThread())
+            {
+                cb();
+            }
+            else
+            {
+                queueInLoop(std::forward<F>(cb));
+            }
+        }
+
         /// Queues callback in the loop thread.
         /// Runs after finish pooling.
-        /// Safe to call from other threads.
-        void queueInLoop(const Functor &cb);
+        /// Safe to call from other threads, lock-free. The callback is stored
+        /// in its task node as is, without wrapping it in a Functor.
+        template <typename F>
+        void queueInLoop(F &&cb)
+        {
+            TaskNode *task = makeTask(std::forward<F>(cb));
+            task->setQueuedTime(monotonicMicroseconds());
+            m_pendingTasks.push(task);
+
+            // One wakeup per drain, later posts find it already pending
+            if ((!isInLoopThread() || m_doingOtherTasks) && !m_wakeupPending.exchange(true))
+            {
+                wakeup();
+            }
+        }
 
         // timers，时间单位均是微秒
         ///
@@ -165,6 +214,9 @@ namespace net
         /// Prints active channels for debugging
         void printActiveChannels() const;
 
+        /// Adds the loop's metrics to the MetricsRegistry
+        void registerMetrics();
+
     private:
         typedef std::vector<Channel *> ChannelList;
 
@@ -190,8 +242,23 @@ namespace net
         ChannelList m_activeChannels;            // Currently active channels
         Channel *currentActiveChannel_;          // Current channel being processed
 
-        std::mutex m_mutex;                      // Mutex for thread safety
-        std::vector<Functor> m_pendingFunctors;  // Functors to be run in the loop thread
+        TaskQueue m_pendingTasks;                // Tasks to be run in the loop thread
+        std::atomic<bool> m_wakeupPending;       // Set while a wakeup for m_pendingTasks is unconsumed
+        std::vector<TaskNode *> m_runningTasks;  // Tasks taken by the current doOtherTasks()
+
+        std::atomic<int32_t> m_connectionCount;    // Connections served by this loop
+        std::atomic<int64_t> m_pendingOutputBytes; // Unwritten output bytes of those connections
+        BufferPool m_bufferPool;                   // Input buffer storage of those connections
+
+        // Exported with a loop="<index>" label, single writer: the loop thread
+        int m_index;                             // Creation order of the loop, 0 for the first
+        MetricHistogram m_iterationTime;         // Time of an iteration without the poll wait
+        MetricHistogram m_taskDelay;             // Time from queueInLoop() to the task running
+        MetricCounter m_bytesReceived;           // Bytes read by the loop's connections
+        MetricCounter m_bytesSent;               // Bytes written by the loop's connections
+        MetricGauge m_connectionGauge;           // Samples m_connectionCount
+        MetricGauge m_pendingOutputGauge;        // Samples m_pendingOutputBytes
+        MetricGauge m_bufferPoolGauge;           // Samples m_bufferPool.pooledBytes()
 
         Functor m_frameFunctor;                  // Function called on each loop iteration
     };
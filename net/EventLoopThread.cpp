@@ -1,5 +1,11 @@
 #include "EventLoopThread.h"
 #include <functional>
+#ifndef WIN32
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#endif
+#include "../base/AsyncLog.h"
 #include "EventLoop.h"
 
 using namespace net;
@@ -52,6 +58,24 @@ void EventLoopThread::stopLoop()
 
 void EventLoopThread::threadFunc()
 {
+#ifndef WIN32
+    if (!m_cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : m_cpus)
+        {
+            CPU_SET(cpu, &cpuset);
+        }
+
+        // Pinned before the loop exists, its memory is first touched on the local node
+        if (::sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0)
+        {
+            LOGW("sched_setaffinity failed, cpu: %d, errno: %d, errorInfo: %s", m_cpus.front(), errno, strerror(errno));
+        }
+    }
+#endif
+
     EventLoop loop;
 
     if (m_callback)
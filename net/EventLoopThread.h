@@ -9,6 +9,7 @@ xiebaoma
 #include <condition_variable>
 #include <thread>
 #include <string>
+#include <vector>
 #include <functional>
 
 namespace net
@@ -39,6 +40,15 @@ namespace net
          */
         ~EventLoopThread();
 
+        /**
+         * @brief Restricts the thread to the given CPUs, call before startLoop().
+         *
+         * The affinity is set before the EventLoop is created, so the memory the loop
+         * touches first lands on the NUMA node of those CPUs. No-op on Windows.
+         * @param cpus CPU numbers, empty to leave the thread unpinned.
+         */
+        void setCpus(const std::vector<int> &cpus) { m_cpus = cpus; }
+
         /**
          * @brief Starts the thread and the associated EventLoop.
          * Blocks until the EventLoop is initialized and ready.
@@ -61,6 +71,7 @@ namespace net
         std::mutex m_mutex;                    // Mutex for synchronizing loop startup.
         std::condition_variable m_cond;        // Condition variable to wait for loop initialization.
         ThreadInitCallback m_callback;         // Optional callback run during thread initialization.
+        std::vector<int> m_cpus;               // CPUs the thread is pinned to, empty if not pinned.
     };
 
 }
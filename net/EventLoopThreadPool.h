@@ -15,6 +15,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <stdint.h>
 
 namespace net
 {
@@ -27,6 +28,23 @@ namespace net
         // Callback type invoked when a thread is initialized.
         typedef std::function<void(EventLoop *)> ThreadInitCallback;
 
+        // How loop threads are placed on CPUs.
+        enum AffinityMode
+        {
+            kAffinityNone, // Left to the scheduler.
+            kAffinityCpu,  // Each thread pinned to one allowed CPU, in order.
+            kAffinityNuma  // Each thread pinned to the allowed CPUs of one NUMA node, nodes taken in turn.
+        };
+
+        // How getNextLoop() picks a loop, the load-aware ones read the loops' counters.
+        enum PlacementPolicy
+        {
+            kPlaceRoundRobin,        // Loops in turn.
+            kPlaceLeastConnections,  // Loop serving the fewest connections.
+            kPlaceLeastPendingBytes, // Loop with the fewest unwritten output bytes.
+            kPlacePowerOfTwoChoices  // Less loaded of two random loops, by connections then bytes.
+        };
+
         // Constructor: creates an uninitialized thread pool.
         EventLoopThreadPool();
 
@@ -36,6 +54,16 @@ namespace net
         // Initializes the thread pool with the given base loop and number of threads.
         void init(EventLoop *baseLoop, int numThreads);
 
+        // Sets how threads are placed on CPUs, call before start().
+        void setAffinityMode(AffinityMode mode) { m_affinityMode = mode; }
+
+        // Sets how getNextLoop() picks a loop.
+        void setPlacementPolicy(PlacementPolicy policy) { m_placementPolicy = policy; }
+
+        // Returns the number of CPUs this process may use: the affinity mask,
+        // further limited by a cgroup CPU quota. At least 1.
+        static int availableCpus();
+
         // Starts all threads and their associated event loops.
         // Optional initialization callback can be provided.
         void start(const ThreadInitCallback &cb = ThreadInitCallback());
@@ -43,7 +71,7 @@ namespace net
         // Stops all event loops and threads.
         void stop();
 
-        // Returns the next EventLoop using round-robin scheduling.
+        // Returns the EventLoop for a new connection, chosen by the placement policy.
         EventLoop *getNextLoop();
 
         // Returns an EventLoop based on a hash code.
@@ -65,15 +93,23 @@ namespace net
             return m_name;
         }
 
-        // Returns a string containing runtime information about the thread pool.
+        // Returns a string containing runtime information about the thread pool,
+        // including the load counters of each loop.
         const std::string info() const;
 
+    private:
+        // Returns the next pseudo-random number for the random placement choices.
+        uint32_t nextRandom();
+
     private:
         EventLoop *m_baseLoop;                                   // The main thread's EventLoop (not owned).
         std::string m_name;                                      // Name identifier for the thread pool.
         bool m_started;                                          // Flag indicating whether the pool has been started.
         int m_numThreads;                                        // Number of worker threads.
         int m_next;                                              // Index for round-robin scheduling.
+        AffinityMode m_affinityMode;                             // How threads are placed on CPUs.
+        PlacementPolicy m_placementPolicy;                       // How getNextLoop() picks a loop.
+        uint32_t m_randomState;                                  // State of the random choices, base loop only.
         std::vector<std::unique_ptr<EventLoopThread>> m_threads; // Owns the EventLoopThread objects.
         std::vector<EventLoop *> m_loops;                        // Raw pointers to each thread's EventLoop.
     };
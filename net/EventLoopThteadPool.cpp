@@ -1,20 +1,179 @@
 #include "EventLoopThreadPool.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <algorithm>
+#include <string.h>
+#ifndef WIN32
+#include <sched.h>
+#include <dirent.h>
+#endif
+#include "../base/AsyncLog.h"
 #include "EventLoop.h"
 #include "EventLoopThread.h"
 #include "Callbacks.h"
 
 using namespace net;
 
+namespace
+{
+#ifndef WIN32
+    // CPUs in the affinity mask of the process, ascending.
+    std::vector<int> allowedCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        if (::sched_getaffinity(0, sizeof(cpuset), &cpuset) != 0)
+            return cpus;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &cpuset))
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    // Whole CPUs granted by the cgroup quota (v2, then v1), 0 if unlimited.
+    int cgroupCpuQuota()
+    {
+        long long quota = -1;
+        long long period = 0;
+        FILE *fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+        if (fp != NULL)
+        {
+            // "max 100000" or "<quota> <period>"
+            if (fscanf(fp, "%lld %lld", &quota, &period) != 2)
+                quota = -1;
+            fclose(fp);
+        }
+        else
+        {
+            fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+            if (fp != NULL)
+            {
+                if (fscanf(fp, "%lld", &quota) != 1)
+                    quota = -1;
+                fclose(fp);
+            }
+            fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+            if (fp != NULL)
+            {
+                if (fscanf(fp, "%lld", &period) != 1)
+                    period = 0;
+                fclose(fp);
+            }
+        }
+
+        if (quota <= 0 || period <= 0)
+            return 0;
+
+        return static_cast<int>((quota + period - 1) / period);
+    }
+
+    // Parses a cpulist such as "0-3,8-11".
+    std::vector<int> parseCpuList(const char *list)
+    {
+        std::vector<int> cpus;
+        const char *p = list;
+        while (*p != '\0' && *p != '\n')
+        {
+            char *end = NULL;
+            long first = strtol(p, &end, 10);
+            if (end == p)
+                break;
+
+            long last = first;
+            p = end;
+            if (*p == '-')
+            {
+                last = strtol(p + 1, &end, 10);
+                p = end;
+            }
+
+            for (long cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(static_cast<int>(cpu));
+
+            if (*p == ',')
+                ++p;
+        }
+        return cpus;
+    }
+
+    // Allowed CPUs grouped by NUMA node, a single group if the topology is unknown.
+    std::vector<std::vector<int>> allowedCpusByNode(const std::vector<int> &allowed)
+    {
+        std::vector<std::vector<int>> nodes;
+        DIR *dir = opendir("/sys/devices/system/node");
+        if (dir != NULL)
+        {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL)
+            {
+                if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+                    continue;
+
+                std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+                FILE *fp = fopen(path.c_str(), "r");
+                if (fp == NULL)
+                    continue;
+
+                char buf[1024] = {0};
+                bool readOk = fgets(buf, sizeof(buf), fp) != NULL;
+                fclose(fp);
+                if (!readOk)
+                    continue;
+
+                std::vector<int> cpus;
+                for (int cpu : parseCpuList(buf))
+                {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                        cpus.push_back(cpu);
+                }
+                if (!cpus.empty())
+                    nodes.push_back(cpus);
+            }
+            closedir(dir);
+        }
+
+        if (nodes.empty())
+            nodes.push_back(allowed);
+
+        return nodes;
+    }
+#endif
+}
+
 EventLoopThreadPool::EventLoopThreadPool()
     : m_baseLoop(NULL),
       m_started(false),
       m_numThreads(0),
-      m_next(0)
+      m_next(0),
+      m_affinityMode(kAffinityNone),
+      m_placementPolicy(kPlaceRoundRobin),
+      m_randomState(2463534242u)
+{
+}
+
+int EventLoopThreadPool::availableCpus()
 {
+#ifdef WIN32
+    int count = static_cast<int>(std::thread::hardware_concurrency());
+#else
+    int count = static_cast<int>(allowedCpus().size());
+    if (count == 0)
+        count = static_cast<int>(std::thread::hardware_concurrency());
+
+    int quota = cgroupCpuQuota();
+    if (quota > 0 && quota < count)
+        count = quota;
+#endif
+
+    return count > 0 ? count : 1;
 }
 
 EventLoopThreadPool::~EventLoopThreadPool()
@@ -42,12 +201,30 @@ void EventLoopThreadPool::start(const ThreadInitCallback &cb)
 
     m_started = true;
 
+#ifndef WIN32
+    std::vector<int> cpus;
+    std::vector<std::vector<int>> nodes;
+    if (m_affinityMode == kAffinityCpu)
+        cpus = allowedCpus();
+    else if (m_affinityMode == kAffinityNuma)
+        nodes = allowedCpusByNode(allowedCpus());
+#endif
+
+    LOGI("EventLoopThreadPool starts %d threads, affinity mode: %d", m_numThreads, static_cast<int>(m_affinityMode));
+
     for (int i = 0; i < m_numThreads; ++i)
     {
         char buf[128];
         snprintf(buf, sizeof buf, "%s%d", m_name.c_str(), i);
 
         std::unique_ptr<EventLoopThread> t(new EventLoopThread(cb, buf));
+#ifndef WIN32
+        // More threads than CPUs or nodes wrap around
+        if (!cpus.empty())
+            t->setCpus(std::vector<int>(1, cpus[i % cpus.size()]));
+        else if (!nodes.empty())
+            t->setCpus(nodes[i % nodes.size()]);
+#endif
         // EventLoopThread* t = new EventLoopThread(cb, buf);
         m_loops.push_back(t->startLoop());
         m_threads.push_back(std::move(t));
@@ -74,9 +251,44 @@ EventLoop *EventLoopThreadPool::getNextLoop()
         return NULL;
 
     EventLoop *loop = m_baseLoop;
+    if (m_loops.empty())
+        return loop;
 
-    if (!m_loops.empty())
+    switch (m_placementPolicy)
+    {
+    case kPlaceLeastConnections:
+        loop = m_loops[0];
+        for (size_t i = 1; i < m_loops.size(); ++i)
+        {
+            if (m_loops[i]->connectionCount() < loop->connectionCount())
+                loop = m_loops[i];
+        }
+        break;
+
+    case kPlaceLeastPendingBytes:
+        loop = m_loops[0];
+        for (size_t i = 1; i < m_loops.size(); ++i)
+        {
+            if (m_loops[i]->pendingOutputBytes() < loop->pendingOutputBytes())
+                loop = m_loops[i];
+        }
+        break;
+
+    case kPlacePowerOfTwoChoices:
     {
+        // Two random loops, the less loaded one wins
+        size_t first = nextRandom() % m_loops.size();
+        size_t second = nextRandom() % m_loops.size();
+        EventLoop *a = m_loops[first];
+        EventLoop *b = m_loops[second];
+        if (a->connectionCount() != b->connectionCount())
+            loop = a->connectionCount() < b->connectionCount() ? a : b;
+        else
+            loop = a->pendingOutputBytes() <= b->pendingOutputBytes() ? a : b;
+        break;
+    }
+
+    default:
         // round-robin
         loop = m_loops[m_next];
         ++m_next;
@@ -84,10 +296,20 @@ EventLoop *EventLoopThreadPool::getNextLoop()
         {
             m_next = 0;
         }
+        break;
     }
+
     return loop;
 }
 
+uint32_t EventLoopThreadPool::nextRandom()
+{
+    m_randomState ^= m_randomState << 13;
+    m_randomState ^= m_randomState >> 17;
+    m_randomState ^= m_randomState << 5;
+    return m_randomState;
+}
+
 EventLoop *EventLoopThreadPool::getLoopForHash(size_t hashCode)
 {
     m_baseLoop->assertInLoopThread();
@@ -119,7 +341,9 @@ const std::string EventLoopThreadPool::info() const
     ss << "print threads id info " << endl;
     for (size_t i = 0; i < m_loops.size(); i++)
     {
-        ss << i << ": id = " << m_loops[i]->getThreadID() << endl;
+        ss << i << ": id = " << m_loops[i]->getThreadID()
+           << ", connections = " << m_loops[i]->connectionCount()
+           << ", pending output bytes = " << m_loops[i]->pendingOutputBytes() << endl;
     }
     return ss.str();
 }
@@ -0,0 +1,325 @@
+#include "IoUringPoller.h"
+
+#ifndef WIN32
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../base/Platform.h"
+#include "../base/AsyncLog.h"
+#include "EventLoop.h"
+#include "Channel.h"
+
+using namespace net;
+
+namespace
+{
+    const int kNew = -1;
+    const int kAdded = 1;
+
+    // user_data of poll removals, poll requests never use generation 0
+    const uint64_t kRemoveUserData = 0;
+
+    uint64_t pollUserData(int fd, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(fd)) << 32) | generation;
+    }
+}
+
+IoUringPoller::IoUringPoller(EventLoop *loop)
+    : m_ringfd(-1),
+      m_ring(NULL),
+      m_ringSize(0),
+      m_sqesMap(NULL),
+      m_sqesSize(0),
+      m_sqHead(NULL),
+      m_sqTail(NULL),
+      m_sqMask(0),
+      m_sqEntries(0),
+      m_sqArray(NULL),
+      m_sqes(NULL),
+      m_cqHead(NULL),
+      m_cqTail(NULL),
+      m_cqMask(0),
+      m_cqes(NULL),
+      m_nextGeneration(1),
+      m_ownerLoop(loop)
+{
+}
+
+IoUringPoller::~IoUringPoller()
+{
+    if (m_sqesMap != NULL)
+        ::munmap(m_sqesMap, m_sqesSize);
+
+    if (m_ring != NULL)
+        ::munmap(m_ring, m_ringSize);
+
+    if (m_ringfd >= 0)
+        ::close(m_ringfd);
+}
+
+bool IoUringPoller::init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = kCompleteEntries;
+    m_ringfd = static_cast<int>(::syscall(__NR_io_uring_setup, kSubmitEntries, &params));
+    if (m_ringfd < 0)
+    {
+        LOGW("io_uring_setup failed, errno=%d, errorInfo: %s", errno, strerror(errno));
+        return false;
+    }
+
+    // NODROP keeps completions of a burst larger than the completion ring, EXT_ARG lets the wait time out
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required)
+    {
+        LOGW("io_uring lacks required features, features=0x%x", params.features);
+        return false;
+    }
+
+    size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    m_ringSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    void *ring = ::mmap(NULL, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED)
+    {
+        LOGE("mmap io_uring rings failed, errno=%d, errorInfo: %s", errno, strerror(errno));
+        return false;
+    }
+    m_ring = ring;
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        LOGE("mmap io_uring sqes failed, errno=%d, errorInfo: %s", errno, strerror(errno));
+        return false;
+    }
+    m_sqesMap = sqes;
+
+    char *base = static_cast<char *>(m_ring);
+    m_sqHead = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    m_sqEntries = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_entries);
+    m_sqArray = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    m_sqes = static_cast<struct io_uring_sqe *>(m_sqesMap);
+    m_cqHead = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+
+    return true;
+}
+
+bool IoUringPoller::hasChannel(Channel *channel) const
+{
+    assertInLoopThread();
+    ChannelMap::const_iterator it = m_channels.find(channel->fd());
+    return it != m_channels.end() && it->second.channel == channel;
+}
+
+void IoUringPoller::assertInLoopThread() const
+{
+    m_ownerLoop->assertInLoopThread();
+}
+
+Timestamp IoUringPoller::poll(int timeoutMs, ChannelList *activeChannels)
+{
+    // Requests that fired last time are armed again, so a channel still ready is reported again
+    for (int fd : m_rearm)
+    {
+        ChannelMap::iterator it = m_channels.find(fd);
+        if (it != m_channels.end() && it->second.generation == 0 && !it->second.channel->isNoneEvent())
+            arm(fd, it->second);
+    }
+    m_rearm.clear();
+
+    int ret = enter(timeoutMs);
+    int savedErrno = errno;
+    Timestamp now(Timestamp::now());
+    // ETIME: nothing completed in time, EBUSY: completions are pending, both are reaped below
+    if (ret < 0 && savedErrno != ETIME && savedErrno != EINTR && savedErrno != EBUSY)
+    {
+        errno = savedErrno;
+        LOGSYSE("IoUringPoller::poll()");
+    }
+
+    fillActiveChannels(activeChannels);
+    return now;
+}
+
+void IoUringPoller::fillActiveChannels(ChannelList *activeChannels)
+{
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe *cqe = &m_cqes[head & m_cqMask];
+        if (cqe->user_data == kRemoveUserData)
+            continue;
+
+        int fd = static_cast<int>(cqe->user_data >> 32);
+        uint32_t generation = static_cast<uint32_t>(cqe->user_data);
+        ChannelMap::iterator it = m_channels.find(fd);
+        // Replaced or removed since it was armed
+        if (it == m_channels.end() || it->second.generation != generation)
+            continue;
+
+        it->second.generation = 0;
+        m_rearm.push_back(fd);
+        if (cqe->res == -ECANCELED)
+            continue;
+
+        it->second.channel->set_revents(cqe->res < 0 ? XPOLLERR : cqe->res);
+        activeChannels->push_back(it->second.channel);
+    }
+
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+}
+
+bool IoUringPoller::updateChannel(Channel *channel)
+{
+    assertInLoopThread();
+    LOGD("fd = %d  events = %d", channel->fd(), channel->events());
+    int fd = channel->fd();
+    ChannelMap::iterator it = m_channels.find(fd);
+    if (it == m_channels.end())
+    {
+        if (channel->index() != kNew)
+        {
+            LOGE("fd = %d  must exist in channels_", fd);
+            return false;
+        }
+
+        Entry entry;
+        entry.channel = channel;
+        entry.generation = 0;
+        entry.events = 0;
+        it = m_channels.insert(std::make_pair(fd, entry)).first;
+        channel->set_index(kAdded);
+    }
+    else if (it->second.channel != channel)
+    {
+        LOGE("current channel is not matched current fd, fd = %d, channel = 0x%x", fd, channel);
+        return false;
+    }
+
+    // The armed request already watches these events
+    Entry &entry = it->second;
+    if (entry.generation != 0 && entry.events == channel->events())
+        return true;
+
+    if (!disarm(fd, entry))
+        return false;
+
+    if (channel->isNoneEvent())
+        return true;
+
+    return arm(fd, entry);
+}
+
+void IoUringPoller::removeChannel(Channel *channel)
+{
+    assertInLoopThread();
+    int fd = channel->fd();
+
+    ChannelMap::iterator it = m_channels.find(fd);
+    if (it == m_channels.end() || it->second.channel != channel || !channel->isNoneEvent())
+        return;
+
+    disarm(fd, it->second);
+    m_channels.erase(it);
+    channel->set_index(kNew);
+}
+
+bool IoUringPoller::arm(int fd, Entry &entry)
+{
+    struct io_uring_sqe *sqe = getSqe();
+    if (sqe == NULL)
+        return false;
+
+    uint32_t generation = m_nextGeneration++;
+    if (m_nextGeneration == 0)
+        m_nextGeneration = 1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    // Channel events are poll(2) bits, the kernel expects them in little-endian word order
+    sqe->poll32_events = static_cast<uint32_t>(entry.channel->events());
+    sqe->user_data = pollUserData(fd, generation);
+    entry.generation = generation;
+    entry.events = entry.channel->events();
+    return true;
+}
+
+bool IoUringPoller::disarm(int fd, Entry &entry)
+{
+    if (entry.generation == 0)
+        return true;
+
+    struct io_uring_sqe *sqe = getSqe();
+    if (sqe == NULL)
+        return false;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = pollUserData(fd, entry.generation);
+    sqe->user_data = kRemoveUserData;
+    entry.generation = 0;
+    return true;
+}
+
+struct io_uring_sqe *IoUringPoller::getSqe()
+{
+    unsigned tail = *m_sqTail;
+    if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+    {
+        // Ring full, submit what is queued without waiting
+        if (enter(-1) < 0 && errno != EBUSY)
+            LOGSYSE("IoUringPoller::getSqe()");
+
+        if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+        {
+            LOGE("io_uring submission ring full, ringfd=%d", m_ringfd);
+            return NULL;
+        }
+    }
+
+    // Without SQPOLL the kernel only reads entries in io_uring_enter(), so the
+    // entry can be filled in after the tail is published
+    unsigned index = tail & m_sqMask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+int IoUringPoller::enter(int waitMs)
+{
+    unsigned toSubmit = *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (waitMs < 0)
+    {
+        if (toSubmit == 0)
+            return 0;
+
+        return static_cast<int>(::syscall(__NR_io_uring_enter, m_ringfd, toSubmit, 0, 0, NULL, 0));
+    }
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = waitMs / 1000;
+    ts.tv_nsec = (waitMs % 1000) * 1000000LL;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof arg);
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    return static_cast<int>(::syscall(__NR_io_uring_enter, m_ringfd, toSubmit, 1,
+                                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg));
+}
+
+#endif
@@ -0,0 +1,172 @@
+/**
+ * @file IoUringPoller.h
+ * @brief A concrete implementation of Poller using io_uring(7) poll requests on Linux.
+ *
+ * Readiness is watched with IORING_OP_POLL_ADD requests instead of an epoll interest
+ * list. Interest changes are queued in the submission ring and submitted together
+ * with the wait of the next poll(), so one io_uring_enter() replaces the epoll_ctl()
+ * calls and the epoll_wait() of a loop iteration.
+ *
+ * @author xiebaoma
+ * @date 2025-06-06
+ */
+
+#pragma once
+
+#ifndef WIN32 // Only compile this file on non-Windows systems (i.e., Linux)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <map>
+
+#include "../base/Timestamp.h"
+#include "Poller.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace net
+{
+    class EventLoop;
+
+    /**
+     * @class IoUringPoller
+     * @brief io_uring-based implementation of the Poller interface.
+     *
+     * Poll requests are one-shot: a channel that fired is armed again on the next
+     * poll() while it still has events enabled, which keeps the level-triggered
+     * behaviour of EPollPoller. Each poll request carries the fd and a generation,
+     * so completions of requests that were replaced or removed are ignored.
+     */
+    class IoUringPoller : public Poller
+    {
+    public:
+        /**
+         * @brief Constructor, the ring is set up by init().
+         * @param loop Pointer to the EventLoop that owns this Poller.
+         */
+        IoUringPoller(EventLoop *loop);
+
+        /**
+         * @brief Destructor. Unmaps and closes the ring.
+         */
+        virtual ~IoUringPoller();
+
+        /**
+         * @brief Sets up the ring.
+         * @return False if the kernel lacks io_uring or a feature this poller needs.
+         */
+        bool init();
+
+        /**
+         * @brief Submits queued requests and waits for completions with a timeout.
+         * @param timeoutMs Maximum time to wait in milliseconds.
+         * @param activeChannels Output list of channels that have active events.
+         * @return Timestamp indicating when the poll returned.
+         */
+        virtual Timestamp poll(int timeoutMs, ChannelList *activeChannels);
+
+        /**
+         * @brief Adds the given channel or changes its poll request.
+         * @param channel The channel to add or update.
+         * @return True if successful, false otherwise.
+         */
+        virtual bool updateChannel(Channel *channel);
+
+        /**
+         * @brief Removes the given channel and cancels its poll request.
+         * @param channel The channel to remove.
+         */
+        virtual void removeChannel(Channel *channel);
+
+        /**
+         * @brief Checks if the given channel exists in the internal map.
+         * @param channel The channel to check.
+         * @return True if found, false otherwise.
+         */
+        virtual bool hasChannel(Channel *channel) const;
+
+        /**
+         * @brief Ensures this method is called from the associated EventLoop thread.
+         */
+        void assertInLoopThread() const;
+
+    private:
+        static const unsigned kSubmitEntries = 1024;     ///< Submission ring size
+        static const unsigned kCompleteEntries = 16384; ///< Completion ring size
+
+        /**
+         * @struct Entry
+         * @brief A registered channel and its poll request
+         */
+        struct Entry
+        {
+            Channel *channel;     ///< The channel
+            uint32_t generation;  ///< Generation of the armed request, 0 when none is armed
+            int events;           ///< Events of the armed request
+        };
+
+        /**
+         * @brief Queues a poll request for the channel's current events.
+         * @param fd The channel's fd.
+         * @param entry The channel's entry.
+         * @return True if the request was queued, false otherwise.
+         */
+        bool arm(int fd, Entry &entry);
+
+        /**
+         * @brief Queues the cancellation of the channel's poll request, if one is armed.
+         * @param fd The channel's fd.
+         * @param entry The channel's entry.
+         * @return True if nothing was armed or the cancellation was queued.
+         */
+        bool disarm(int fd, Entry &entry);
+
+        /**
+         * @brief Takes a free submission queue entry, submitting queued ones when the ring is full.
+         * @return The cleared entry, or NULL on error.
+         */
+        struct io_uring_sqe *getSqe();
+
+        /**
+         * @brief Submits the queued entries and optionally waits for completions.
+         * @param waitMs Milliseconds to wait for a completion, negative to only submit.
+         * @return Result of io_uring_enter(), errno is set on failure.
+         */
+        int enter(int waitMs);
+
+        /**
+         * @brief Consumes the completions and fills the activeChannels list.
+         * @param activeChannels Output list to fill.
+         */
+        void fillActiveChannels(ChannelList *activeChannels);
+
+    private:
+        int m_ringfd;       ///< File descriptor of the ring
+        void *m_ring;       ///< Mapped submission and completion rings
+        size_t m_ringSize;  ///< Size of m_ring
+        void *m_sqesMap;    ///< Mapped submission queue entries
+        size_t m_sqesSize;  ///< Size of m_sqesMap
+
+        unsigned *m_sqHead;            ///< Submission ring head, advanced by the kernel
+        unsigned *m_sqTail;            ///< Submission ring tail, advanced here
+        unsigned m_sqMask;             ///< Submission ring index mask
+        unsigned m_sqEntries;          ///< Submission ring size
+        unsigned *m_sqArray;           ///< Submission ring slots, indices into m_sqes
+        struct io_uring_sqe *m_sqes;   ///< Submission queue entries
+        unsigned *m_cqHead;            ///< Completion ring head, advanced here
+        unsigned *m_cqTail;            ///< Completion ring tail, advanced by the kernel
+        unsigned m_cqMask;             ///< Completion ring index mask
+        struct io_uring_cqe *m_cqes;   ///< Completion queue entries
+
+        typedef std::map<int, Entry> ChannelMap;
+
+        ChannelMap m_channels;      ///< Map from fd to the registered channel
+        std::vector<int> m_rearm;   ///< Fds whose request fired, armed again by the next poll()
+        uint32_t m_nextGeneration;  ///< Generation of the next poll request
+        EventLoop *m_ownerLoop;     ///< The EventLoop that owns this Poller
+    };
+}
+
+#endif // WIN32
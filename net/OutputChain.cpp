@@ -0,0 +1,246 @@
+/*
+xiebaoma
+2025-06-06
+*/
+
+#include "OutputChain.h"
+
+#include <errno.h>
+#include <string.h>
+#include <vector>
+
+#include "../base/AsyncLog.h"
+#include "Sockets.h"
+
+using namespace net;
+
+namespace
+{
+    // Memory segments gathered into one writev()
+    const int kMaxIovecs = 64;
+
+    // Free blocks kept per thread, 4MB with 16KB blocks
+    const size_t kMaxPooledBlocks = 256;
+
+    // Set once the pool of this thread is destroyed, blocks freed later go straight to the heap
+    thread_local bool t_poolDestroyed = false;
+
+    // Blocks are taken and returned by the loop thread of the connection. A connection
+    // destroyed on another thread returns its blocks to that thread's pool.
+    struct BlockPool
+    {
+        ~BlockPool()
+        {
+            for (char *block : blocks)
+                delete[] block;
+            t_poolDestroyed = true;
+        }
+
+        std::vector<char *> blocks;
+    };
+
+    thread_local BlockPool t_blockPool;
+
+    char *allocBlock()
+    {
+        if (!t_poolDestroyed && !t_blockPool.blocks.empty())
+        {
+            char *block = t_blockPool.blocks.back();
+            t_blockPool.blocks.pop_back();
+            return block;
+        }
+
+        return new char[OutputChain::kBlockSize];
+    }
+
+    void freeBlock(char *block)
+    {
+        if (!t_poolDestroyed && t_blockPool.blocks.size() < kMaxPooledBlocks)
+            t_blockPool.blocks.push_back(block);
+        else
+            delete[] block;
+    }
+}
+
+SharedFile::~SharedFile()
+{
+#ifndef WIN32
+    ::close(m_fd);
+#else
+    _close(m_fd);
+#endif
+}
+
+OutputChain::OutputChain()
+    : m_bytes(0),
+      m_fileRegions(0)
+{
+}
+
+OutputChain::~OutputChain()
+{
+    while (!m_segments.empty())
+        popFront();
+}
+
+void OutputChain::append(const char *data, size_t len)
+{
+    m_bytes += len;
+
+    // Fill what is left of the tail block first
+    if (!m_segments.empty() && m_segments.back().block != NULL)
+    {
+        Segment &tail = m_segments.back();
+        char *end = const_cast<char *>(tail.data) + tail.length;
+        size_t writable = static_cast<size_t>(tail.block + kBlockSize - end);
+        size_t n = len < writable ? len : writable;
+        memcpy(end, data, n);
+        tail.length += n;
+        data += n;
+        len -= n;
+    }
+
+    while (len > 0)
+    {
+        size_t n = len < kBlockSize ? len : kBlockSize;
+        Segment segment = {NULL, n, allocBlock(), nullptr, nullptr, 0, 0};
+        segment.data = segment.block;
+        memcpy(segment.block, data, n);
+        m_segments.push_back(segment);
+        data += n;
+        len -= n;
+    }
+}
+
+void OutputChain::append(const std::shared_ptr<const std::string> &message, size_t offset)
+{
+    if (offset >= message->size())
+        return;
+
+    // Small tails are cheaper to copy than to keep the whole string alive for
+    size_t len = message->size() - offset;
+    if (len < kBlockSize)
+    {
+        append(message->data() + offset, len);
+        return;
+    }
+
+    Segment segment = {message->data() + offset, len, NULL, message, nullptr, 0, 0};
+    m_segments.push_back(segment);
+    m_bytes += len;
+}
+
+#ifndef WIN32
+void OutputChain::appendFile(const SharedFilePtr &file, int64_t offset, int64_t length)
+{
+    Segment segment = {NULL, 0, NULL, nullptr, file, offset, length};
+    m_segments.push_back(segment);
+    m_bytes += static_cast<size_t>(length);
+    ++m_fileRegions;
+}
+#endif
+
+size_t OutputChain::writeTo(SOCKET sockfd, int *savedErrno)
+{
+    size_t written = 0;
+    *savedErrno = 0;
+
+    while (!m_segments.empty())
+    {
+#ifndef WIN32
+        Segment &front = m_segments.front();
+        if (front.file)
+        {
+            ssize_t n = sockets::sendfile(sockfd, front.file->fd(), &front.offset, static_cast<size_t>(front.remaining));
+            if (n <= 0)
+            {
+                if (n == 0)
+                {
+                    // The file is shorter than announced, the stream can not be resynchronized
+                    LOGE("OutputChain::writeTo unexpected EOF, fd: %d, offset: %lld", front.file->fd(), front.offset);
+                    *savedErrno = EIO;
+                }
+                else
+                {
+                    *savedErrno = errno;
+                }
+                break;
+            }
+
+            written += static_cast<size_t>(n);
+            m_bytes -= static_cast<size_t>(n);
+            front.remaining -= n;
+            if (front.remaining > 0)
+            {
+                *savedErrno = EWOULDBLOCK;
+                break;
+            }
+
+            popFront();
+            continue;
+        }
+
+        // Gather the memory segments up to the next file region
+        struct iovec iov[kMaxIovecs];
+        int iovcnt = 0;
+        size_t total = 0;
+        for (auto it = m_segments.begin(); it != m_segments.end() && !it->file && iovcnt < kMaxIovecs; ++it)
+        {
+            iov[iovcnt].iov_base = const_cast<char *>(it->data);
+            iov[iovcnt].iov_len = it->length;
+            total += it->length;
+            ++iovcnt;
+        }
+
+        ssize_t n = sockets::writev(sockfd, iov, iovcnt);
+#else
+        size_t total = m_segments.front().length;
+        int32_t n = sockets::write(sockfd, m_segments.front().data, static_cast<int32_t>(total));
+#endif
+        if (n <= 0)
+        {
+            *savedErrno = n < 0 ? errno : EWOULDBLOCK;
+            break;
+        }
+
+        written += static_cast<size_t>(n);
+        consume(static_cast<size_t>(n));
+
+        // Socket buffer is full, wait for the next XPOLLOUT
+        if (static_cast<size_t>(n) < total)
+        {
+            *savedErrno = EWOULDBLOCK;
+            break;
+        }
+    }
+
+    return written;
+}
+
+void OutputChain::consume(size_t n)
+{
+    m_bytes -= n;
+    while (n > 0)
+    {
+        Segment &front = m_segments.front();
+        if (n < front.length)
+        {
+            front.data += n;
+            front.length -= n;
+            return;
+        }
+
+        n -= front.length;
+        popFront();
+    }
+}
+
+void OutputChain::popFront()
+{
+    Segment &front = m_segments.front();
+    if (front.block != NULL)
+        freeBlock(front.block);
+    if (front.file)
+        --m_fileRegions;
+    m_segments.pop_front();
+}
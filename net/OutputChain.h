@@ -0,0 +1,114 @@
+/*
+xiebaoma
+2025-06-06
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <memory>
+
+#include "../base/Platform.h"
+
+namespace net
+{
+    /**
+     * @brief An open file descriptor shared by the file regions queued from it.
+     *
+     * The descriptor is closed when the last owner lets go, so any number of regions
+     * of one file cost a single descriptor however long they take to drain.
+     */
+    class SharedFile
+    {
+    public:
+        explicit SharedFile(int fd) : m_fd(fd) {}
+        ~SharedFile();
+
+        SharedFile(const SharedFile &rhs) = delete;
+        SharedFile &operator=(const SharedFile &rhs) = delete;
+
+        int fd() const { return m_fd; }
+
+    private:
+        int m_fd;
+    };
+
+    typedef std::shared_ptr<SharedFile> SharedFilePtr;
+
+    /**
+     * @brief Output queue of a TcpConnection, a chain of segments written in order.
+     *
+     * Copied bytes go into fixed-size blocks taken from a per-thread pool, so
+     * appending never moves or reallocates what is already queued. A string the
+     * connection owns is queued as a reference-counted slice instead of being
+     * copied, and file regions are queued as descriptors sent with sendfile().
+     * writeTo() gathers consecutive memory segments into one writev().
+     *
+     * Not thread-safe, it is only used in the loop thread of its connection.
+     */
+    class OutputChain
+    {
+    public:
+        static const size_t kBlockSize = 16 * 1024;
+
+        OutputChain();
+        ~OutputChain();
+
+        OutputChain(const OutputChain &rhs) = delete;
+        OutputChain &operator=(const OutputChain &rhs) = delete;
+
+        // Bytes queued, file regions included.
+        size_t readableBytes() const { return m_bytes; }
+        bool empty() const { return m_segments.empty(); }
+
+        // File regions queued, each keeps its file open until it is sent.
+        size_t fileRegions() const { return m_fileRegions; }
+
+        // Copies the bytes into the tail block and as many new blocks as needed.
+        void append(const char *data, size_t len);
+
+        // Queues message[offset, size()), as a slice when it is large enough to be worth not copying.
+        void append(const std::shared_ptr<const std::string> &message, size_t offset);
+
+#ifndef WIN32
+        // Queues [offset, offset + length) of a file, the region holds a reference to it.
+        void appendFile(const SharedFilePtr &file, int64_t offset, int64_t length);
+#endif
+
+        /**
+         * @brief Writes queued segments until the chain is empty or the socket stops accepting.
+         *
+         * @param sockfd     The socket to write to.
+         * @param savedErrno Set to the errno that stopped the writing (EWOULDBLOCK when the
+         *                   socket is full), 0 if everything was written.
+         * @return Bytes written, they are removed from the chain.
+         */
+        size_t writeTo(SOCKET sockfd, int *savedErrno);
+
+    private:
+        struct Segment
+        {
+            const char *data;                         // Next byte to write, memory segments only.
+            size_t length;                            // Bytes left in a memory segment.
+            char *block;                              // Pooled block the data lives in, or NULL.
+            std::shared_ptr<const std::string> slice; // String the data lives in, or empty.
+            SharedFilePtr file;                       // File of a file region, or empty.
+            int64_t offset;                           // Next file offset to send.
+            int64_t remaining;                        // File bytes left to send.
+        };
+
+        // Removes n written bytes from the front of the chain.
+        void consume(size_t n);
+
+        // Releases the block or file of the front segment and pops it.
+        void popFront();
+
+    private:
+        std::deque<Segment> m_segments; ///< Segments in write order.
+        size_t m_bytes;                 ///< Total bytes queued.
+        size_t m_fileRegions;           ///< File regions queued.
+    };
+
+} // namespace net
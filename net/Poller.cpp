@@ -5,9 +5,19 @@ xiebaoma
 
 #include "Poller.h"
 #include "Channel.h"
+#include "../base/AsyncLog.h"
+
+#ifdef WIN32
+#include "SelectPoller.h"
+#else
+#include "EpollPoller.h"
+#include "IoUringPoller.h"
+#endif
 
 using namespace net;
 
+static Poller::PollerType s_defaultPollerType = Poller::kPollerEpoll;
+
 Poller::Poller()
 {
 }
@@ -15,3 +25,29 @@ Poller::Poller()
 Poller::~Poller()
 {
 }
+
+void Poller::setDefaultType(PollerType type)
+{
+    s_defaultPollerType = type;
+}
+
+Poller *Poller::newDefaultPoller(EventLoop *loop)
+{
+#ifdef WIN32
+    return new SelectPoller(loop);
+#else
+    if (s_defaultPollerType == kPollerIoUring)
+    {
+        IoUringPoller *poller = new IoUringPoller(loop);
+        if (poller->init())
+            return poller;
+
+        delete poller;
+        LOGW("io_uring not supported, falling back to epoll");
+        // Later loops go straight to epoll
+        s_defaultPollerType = kPollerEpoll;
+    }
+
+    return new EPollPoller(loop);
+#endif
+}
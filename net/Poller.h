@@ -11,12 +11,27 @@ xiebaoma
 namespace net
 {
     class Channel;
+    class EventLoop;
 
     class Poller
     {
     public:
         Poller();
-        ~Poller();
+        virtual ~Poller();
+
+        /// I/O multiplexing backends, selected once at startup for every new EventLoop.
+        enum PollerType
+        {
+            kPollerEpoll,
+            kPollerIoUring
+        };
+
+        /// Sets the backend of EventLoops created from now on, not thread safe.
+        static void setDefaultType(PollerType type);
+
+        /// Creates the poller of a new EventLoop. io_uring falls back to epoll when
+        /// the kernel lacks support; Windows always uses select.
+        static Poller *newDefaultPoller(EventLoop *loop);
 
     public:
         typedef std::vector<Channel *> ChannelList;
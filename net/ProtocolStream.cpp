@@ -338,6 +338,13 @@ namespace net
     {
         return WriteCString(str.c_str(), str.length());
     }
+    bool BinaryStreamWriter::WriteLength(size_t len)
+    {
+        std::string buf;
+        write7BitEncoded(len, buf);
+        m_data->append(buf);
+        return true;
+    }
     const char *BinaryStreamWriter::GetData() const
     {
         return m_data->data();
@@ -398,10 +405,10 @@ namespace net
             WriteCString(doublestr, 0);
         return true;
     }
-    void BinaryStreamWriter::Flush()
+    void BinaryStreamWriter::Flush(size_t trailingLength)
     {
         char *ptr = &(*m_data)[0];
-        unsigned int ulen = htonl(m_data->length());
+        unsigned int ulen = htonl(m_data->length() + trailingLength);
         memcpy(ptr, &ulen, sizeof(ulen));
     }
     void BinaryStreamWriter::Clear()
@@ -257,6 +257,17 @@ namespace net
          */
         bool WriteString(const std::string &str);
 
+        /**
+         * @brief Write only the length prefix of a string field
+         *
+         * Used when the field content is sent out of band right after the stream
+         * (e.g. file data copied by sendfile).
+         *
+         * @param len Length of the string content
+         * @return True if successful, false otherwise
+         */
+        bool WriteLength(size_t len);
+
         /**
          * @brief Write a double value to the stream
          * @param value Double value to write
@@ -304,9 +315,10 @@ namespace net
         size_t GetCurrentPos() const { return m_data->length(); }
 
         /**
-         * @brief Flush the stream (currently a no-op)
+         * @brief Write the total package length into the stream header
+         * @param trailingLength Bytes sent out of band after the stream that count towards the package
          */
-        void Flush();
+        void Flush(size_t trailingLength = 0);
 
         /**
          * @brief Clear the stream
@@ -2,6 +2,9 @@
 
 #include <stdio.h> // snprintf
 #include <string.h>
+#ifndef WIN32
+#include <linux/filter.h>
+#endif
 
 #include "../base/AsyncLog.h"
 #include "../base/Platform.h"
@@ -259,6 +262,30 @@ void sockets::setReusePort(SOCKET sockfd, bool on)
 #endif
 }
 
+bool sockets::setReusePortCpuSteering(SOCKET sockfd, int groupSize)
+{
+#if !defined(WIN32) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        // A = id of the CPU handling the incoming SYN
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+        // A = A % groupSize
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(groupSize)},
+        // Index of the listener to use
+        {BPF_RET | BPF_A, 0, 0, 0}};
+    struct sock_fprog prog;
+    prog.len = static_cast<unsigned short>(sizeof(code) / sizeof(code[0]));
+    prog.filter = code;
+    if (::setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, static_cast<socklen_t>(sizeof prog)) < 0)
+    {
+        LOGSYSE("SO_ATTACH_REUSEPORT_CBPF failed.");
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 SOCKET sockets::connect(SOCKET sockfd, const struct sockaddr_in &addr)
 {
     return ::connect(sockfd, sockaddr_cast(&addr), static_cast<socklen_t>(sizeof addr));
@@ -289,6 +316,25 @@ int32_t sockets::write(SOCKET sockfd, const void *buf, int32_t count)
 #endif
 }
 
+#ifndef WIN32
+ssize_t sockets::writev(SOCKET sockfd, const struct iovec *iov, int iovcnt)
+{
+    return ::writev(sockfd, iov, iovcnt);
+}
+#endif
+
+#ifndef WIN32
+ssize_t sockets::sendfile(SOCKET sockfd, int filefd, int64_t *offset, size_t count)
+{
+    off_t off = static_cast<off_t>(*offset);
+    ssize_t n = ::sendfile(sockfd, filefd, &off, count);
+    if (n > 0)
+        *offset = static_cast<int64_t>(off);
+
+    return n;
+}
+#endif
+
 void sockets::close(SOCKET sockfd)
 {
 #ifdef WIN32
@@ -366,6 +412,15 @@ int sockets::getSocketError(SOCKET sockfd)
     return optval;
 }
 
+#ifndef WIN32
+bool sockets::getTcpInfo(SOCKET sockfd, struct tcp_info *tcpi)
+{
+    socklen_t len = static_cast<socklen_t>(sizeof(*tcpi));
+    memset(tcpi, 0, sizeof(*tcpi));
+    return ::getsockopt(sockfd, SOL_TCP, TCP_INFO, tcpi, &len) == 0;
+}
+#endif
+
 struct sockaddr_in sockets::getLocalAddr(SOCKET sockfd)
 {
     struct sockaddr_in localaddr = {0};
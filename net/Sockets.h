@@ -103,6 +103,16 @@ namespace net
         void setReuseAddr(SOCKET sockfd, bool on);
         void setReusePort(SOCKET sockfd, bool on);
 
+        /**
+         * @brief Steers connections of a SO_REUSEPORT group by the receiving CPU.
+         *
+         * Attaches a classic BPF program (SO_ATTACH_REUSEPORT_CBPF) to the group of
+         * sockfd that hands a connection to the listener at index cpu % groupSize,
+         * listeners being indexed in the order they started listening.
+         * @return false where unsupported, the kernel then keeps hashing.
+         */
+        bool setReusePortCpuSteering(SOCKET sockfd, int groupSize);
+
         /**
          * @brief Connects the given socket to the specified address.
          */
@@ -140,6 +150,21 @@ namespace net
          */
         int32_t write(SOCKET sockfd, const void *buf, int32_t count);
 
+#ifndef WIN32
+        /**
+         * @brief Performs a vectorized write (writev) on the socket.
+         */
+        ssize_t writev(SOCKET sockfd, const struct iovec *iov, int iovcnt);
+#endif
+
+#ifndef WIN32
+        /**
+         * @brief Copies file data straight to the socket in kernel space (sendfile).
+         * @param offset In/out file offset; advanced by the number of bytes sent.
+         */
+        ssize_t sendfile(SOCKET sockfd, int filefd, int64_t *offset, size_t count);
+#endif
+
         /**
          * @brief Closes the socket.
          */
@@ -170,6 +195,14 @@ namespace net
          */
         int getSocketError(SOCKET sockfd);
 
+#ifndef WIN32
+        /**
+         * @brief Reads the kernel's TCP state of the socket (TCP_INFO): RTT, congestion window...
+         * @return false if the option can not be read.
+         */
+        bool getTcpInfo(SOCKET sockfd, struct tcp_info *tcpi);
+#endif
+
         // Utility functions for safe casting between sockaddr types.
         const struct sockaddr *sockaddr_cast(const struct sockaddr_in *addr);
         struct sockaddr *sockaddr_cast(struct sockaddr_in *addr);
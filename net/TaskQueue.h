@@ -0,0 +1,173 @@
+/**
+ * @file TaskQueue.h
+ * @brief Lock-free multi-producer single-consumer queue of tasks for EventLoop.
+ *
+ * Intrusive queue after Dmitry Vyukov's MPSC node queue: a push is one atomic
+ * exchange and never waits for other producers or the consumer. A task node
+ * stores the callable inline, so posting a task costs one allocation whatever
+ * the size of its captures and never goes through std::function.
+ *
+ * @author xiebaoma
+ * @date 2025-06-06
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <utility>
+#include <type_traits>
+
+namespace net
+{
+    /**
+     * @class TaskNode
+     * @brief A queued task, linked through the node itself
+     */
+    class TaskNode
+    {
+    public:
+        TaskNode() : m_next(nullptr), m_queuedTime(0) {}
+        virtual ~TaskNode() {}
+
+        /**
+         * @brief Runs the task
+         */
+        virtual void run() {}
+
+        /**
+         * @brief Monotonic time in microseconds the task was queued at, for latency metrics
+         */
+        int64_t queuedTime() const { return m_queuedTime; }
+        void setQueuedTime(int64_t us) { m_queuedTime = us; }
+
+    private:
+        friend class TaskQueue;
+
+        std::atomic<TaskNode *> m_next; ///< Next node towards the newest one
+        int64_t m_queuedTime;           ///< Set by the producer before the push
+    };
+
+    /**
+     * @class FunctorTask
+     * @brief Task node holding any callable by value
+     */
+    template <typename F>
+    class FunctorTask final : public TaskNode
+    {
+    public:
+        template <typename U>
+        explicit FunctorTask(U &&f) : m_functor(std::forward<U>(f)) {}
+
+        virtual void run() { m_functor(); }
+
+    private:
+        F m_functor; ///< The callable
+    };
+
+    /**
+     * @brief Allocates a task node for a callable
+     * @param f The callable, copied or moved into the node
+     * @return The node, owned by the caller until pushed
+     */
+    template <typename F>
+    TaskNode *makeTask(F &&f)
+    {
+        return new FunctorTask<typename std::decay<F>::type>(std::forward<F>(f));
+    }
+
+    /**
+     * @class TaskQueue
+     * @brief Lock-free MPSC queue of task nodes
+     *
+     * push() may be called from any thread, pop() and empty() only from the
+     * consumer thread. The queue owns pushed nodes until they are popped.
+     */
+    class TaskQueue final
+    {
+    public:
+        TaskQueue() : m_head(&m_stub), m_tail(&m_stub) {}
+
+        /**
+         * @brief Deletes the nodes still queued without running them
+         */
+        ~TaskQueue()
+        {
+            while (TaskNode *node = pop())
+                delete node;
+        }
+
+        TaskQueue(const TaskQueue &) = delete;
+        TaskQueue &operator=(const TaskQueue &) = delete;
+
+        /**
+         * @brief Appends a node, thread safe
+         * @param node The node to append
+         */
+        void push(TaskNode *node)
+        {
+            node->m_next.store(nullptr, std::memory_order_relaxed);
+            TaskNode *prev = m_head.exchange(node, std::memory_order_acq_rel);
+            // Between the exchange and this store the consumer sees the queue end at prev
+            prev->m_next.store(node, std::memory_order_release);
+        }
+
+        /**
+         * @brief Takes the oldest node, consumer thread only
+         *
+         * Returns nullptr when the queue is empty, and also while the newest push is
+         * half done; empty() tells the two apart.
+         *
+         * @return The node, now owned by the caller, or nullptr
+         */
+        TaskNode *pop()
+        {
+            TaskNode *tail = m_tail;
+            TaskNode *next = tail->m_next.load(std::memory_order_acquire);
+            if (tail == &m_stub)
+            {
+                if (next == nullptr)
+                    return nullptr;
+
+                m_tail = next;
+                tail = next;
+                next = next->m_next.load(std::memory_order_acquire);
+            }
+
+            if (next != nullptr)
+            {
+                m_tail = next;
+                return tail;
+            }
+
+            // tail is the last node, it can only be taken once the stub is queued behind it
+            if (tail != m_head.load(std::memory_order_acquire))
+                return nullptr;
+
+            push(&m_stub);
+            next = tail->m_next.load(std::memory_order_acquire);
+            if (next != nullptr)
+            {
+                m_tail = next;
+                return tail;
+            }
+
+            return nullptr;
+        }
+
+        /**
+         * @brief Whether no node is queued, including half done pushes, consumer thread only
+         * @return true if the queue is empty
+         */
+        bool empty() const
+        {
+            return m_tail == &m_stub && m_stub.m_next.load(std::memory_order_acquire) == nullptr &&
+                   m_head.load(std::memory_order_acquire) == &m_stub;
+        }
+
+    private:
+        std::atomic<TaskNode *> m_head; ///< Newest node, producers exchange it
+        TaskNode *m_tail;               ///< Oldest node, consumer only
+        TaskNode m_stub;                ///< Placeholder node keeping the list non-empty
+    };
+}
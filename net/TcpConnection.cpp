@@ -12,6 +12,12 @@
 
 using namespace net;
 
+namespace
+{
+    // Storage a drained input buffer keeps instead of returning it to the loop's pool
+    const size_t kRetainedInputBytes = 16 * 1024;
+}
+
 void net::defaultConnectionCallback(const TcpConnectionPtr &conn)
 {
     LOGD("%s -> is %s",
@@ -34,8 +40,17 @@ TcpConnection::TcpConnection(EventLoop *loop, const string &nameArg, int sockfd,
       m_channel(new Channel(loop, sockfd)),
       m_localAddr(localAddr),
       m_peerAddr(peerAddr),
-      m_highWaterMark(64 * 1024 * 1024)
+      m_highWaterMark(64 * 1024 * 1024),
+      m_inputBuffer(0),
+      m_idleTimeout(0),
+      m_readTimeout(0),
+      m_writeTimeout(0),
+      m_timeoutTimerArmed(false),
+      m_readPauseReasons(0)
 {
+    // The input buffer borrows storage from the loop once data arrives
+    m_inputBuffer.setPool(loop->bufferPool());
+
     m_channel->setReadCallback(std::bind(&TcpConnection::handleRead, this, std::placeholders::_1));
     m_channel->setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
     m_channel->setCloseCallback(std::bind(&TcpConnection::handleClose, this));
@@ -61,11 +76,11 @@ void TcpConnection::send(const void *data, int len)
         }
         else
         {
-            string message(static_cast<const char *>(data), len);
+            // The copy is queued as it is if the socket does not take all of it
             m_loop->runInLoop(
-                std::bind(static_cast<void (TcpConnection::*)(const string &)>(&TcpConnection::sendInLoop),
+                std::bind(&TcpConnection::sendSharedInLoop,
                           this, // FIXME
-                          message));
+                          std::make_shared<const string>(static_cast<const char *>(data), len)));
         }
     }
 }
@@ -81,9 +96,9 @@ void TcpConnection::send(const string &message)
         else
         {
             m_loop->runInLoop(
-                std::bind(static_cast<void (TcpConnection::*)(const string &)>(&TcpConnection::sendInLoop),
+                std::bind(&TcpConnection::sendSharedInLoop,
                           this, // FIXME
-                          message));
+                          std::make_shared<const string>(message)));
             // std::forward<string>(message)));
         }
     }
@@ -102,14 +117,51 @@ void TcpConnection::send(ByteBuffer *buf)
         else
         {
             m_loop->runInLoop(
-                std::bind(static_cast<void (TcpConnection::*)(const string &)>(&TcpConnection::sendInLoop),
+                std::bind(&TcpConnection::sendSharedInLoop,
                           this, // FIXME
-                          buf->retrieveAllAsString()));
+                          std::make_shared<const string>(buf->retrieveAllAsString())));
             // std::forward<string>(message)));
         }
     }
 }
 
+void TcpConnection::sendFile(int fd, int64_t offset, int64_t length)
+{
+    if (m_state != kConnected || length <= 0)
+        return;
+
+    // The caller usually closes its descriptor long before the region drains
+#ifndef WIN32
+    int regionFd = ::dup(fd);
+#else
+    int regionFd = _dup(fd);
+#endif
+    if (regionFd < 0)
+    {
+        // The header announcing the region is already queued, the stream can not be resynchronized
+        LOGSYSE("TcpConnection::sendFile dup fd=%d", fd);
+        forceClose();
+        return;
+    }
+
+    sendFile(std::make_shared<SharedFile>(regionFd), offset, length);
+}
+
+void TcpConnection::sendFile(const SharedFilePtr &file, int64_t offset, int64_t length)
+{
+    if (m_state != kConnected || length <= 0)
+        return;
+
+    if (m_loop->isInLoopThread())
+    {
+        sendFileInLoop(file, offset, length);
+    }
+    else
+    {
+        m_loop->runInLoop(std::bind(&TcpConnection::sendFileInLoop, shared_from_this(), file, offset, length));
+    }
+}
+
 void TcpConnection::sendInLoop(const string &message)
 {
     sendInLoop(message.c_str(), message.size());
@@ -118,14 +170,9 @@ void TcpConnection::sendInLoop(const string &message)
 /**
  * @brief Send data in the event loop thread. Called internally by TcpConnection::send.
  *
- * This function attempts to write the data directly to the socket if:
- *   1. The connection is still active.
- *   2. There is no pending data in the output buffer.
- *   3. The channel is not currently monitoring for write events.
- *
- * If not all data can be written immediately (e.g., socket buffer is full),
- * the remaining data will be appended to the output buffer, and the channel
- * will start monitoring for EPOLLOUT events to complete the write asynchronously.
+ * Whatever the socket does not accept right away is copied into the output chain,
+ * and the channel starts monitoring for EPOLLOUT events to complete the write
+ * asynchronously.
  *
  * This function must be called in the IO thread that owns the connection.
  *
@@ -136,76 +183,206 @@ void TcpConnection::sendInLoop(const void *data, size_t len)
 {
     m_loop->assertInLoopThread(); // Ensure this runs in the loop thread
 
-    int32_t nwrote = 0;      // Number of bytes actually written to the socket
-    size_t remaining = len;  // Bytes left to write
-    bool faultError = false; // Indicates whether a fatal socket error occurred
+    size_t nwrote = 0;
+    if (!writeDirect(data, len, nwrote) || nwrote == len)
+        return;
+
+    size_t oldLen = pendingOutputBytes();
+    m_outputChain.append(static_cast<const char *>(data) + nwrote, len - nwrote);
+    outputQueued(oldLen, len - nwrote);
+}
+
+/**
+ * @brief Like sendInLoop, for a message the connection shares ownership of.
+ *
+ * A large remainder is queued as a slice of the message instead of being copied.
+ *
+ * @param message The message to send.
+ */
+void TcpConnection::sendSharedInLoop(const std::shared_ptr<const string> &message)
+{
+    m_loop->assertInLoopThread();
+
+    size_t nwrote = 0;
+    if (!writeDirect(message->data(), message->size(), nwrote) || nwrote == message->size())
+        return;
+
+    size_t oldLen = pendingOutputBytes();
+    m_outputChain.append(message, nwrote);
+    outputQueued(oldLen, message->size() - nwrote);
+}
+
+/**
+ * @brief Attempts to write the data directly to the socket.
+ *
+ * The write is only attempted if:
+ *   1. The connection is still active.
+ *   2. There is no pending data in the output chain.
+ *   3. The channel is not currently monitoring for write events.
+ *
+ * @param data   Pointer to the data to send.
+ * @param len    Length of the data in bytes.
+ * @param nwrote Number of bytes actually written to the socket.
+ * @return false if the data must be dropped: the connection is closed or the socket failed.
+ */
+bool TcpConnection::writeDirect(const void *data, size_t len, size_t &nwrote)
+{
+    nwrote = 0;
 
     // If the connection has been closed, discard the write request
     if (m_state == kDisconnected)
     {
         LOGW("disconnected, give up writing");
-        return;
+        return false;
     }
 
-    // Attempt direct write if output buffer is empty and not already writing
-    if (!m_channel->isWriting() && m_outputBuffer.readableBytes() == 0)
-    {
-        nwrote = sockets::write(m_channel->fd(), data, len);
+    // Queued output goes first
+    if (m_channel->isWriting() || hasPendingOutput())
+        return true;
 
-        if (nwrote >= 0)
+    int32_t n = sockets::write(m_channel->fd(), data, static_cast<int32_t>(len));
+    if (n >= 0)
+    {
+        nwrote = static_cast<size_t>(n);
+        if (n > 0)
         {
-            remaining = len - nwrote;
-
-            // If all data was sent immediately and a write complete callback is set,
-            // queue the callback to be executed in the loop
-            if (remaining == 0 && m_writeCompleteCallback)
-            {
-                m_loop->queueInLoop(std::bind(m_writeCompleteCallback, shared_from_this()));
-            }
+            m_lastWriteTime = Timestamp::now();
+            m_loop->addBytesSent(n);
         }
-        else // Write failed
-        {
-            nwrote = 0;
-            if (errno != EWOULDBLOCK) // Not just a temporary full buffer
-            {
-                LOGSYSE("TcpConnection::sendInLoop");
 
-                // Check for common connection-related errors
-                if (errno == EPIPE || errno == ECONNRESET)
-                {
-                    faultError = true;
-                }
-            }
+        // If all data was sent immediately and a write complete callback is set,
+        // queue the callback to be executed in the loop
+        if (nwrote == len && m_writeCompleteCallback)
+        {
+            m_loop->queueInLoop(std::bind(m_writeCompleteCallback, shared_from_this()));
         }
+        return true;
+    }
+
+    if (errno != EWOULDBLOCK) // Not just a temporary full buffer
+    {
+        LOGSYSE("TcpConnection::sendInLoop");
+
+        // Check for common connection-related errors
+        if (errno == EPIPE || errno == ECONNRESET)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Accounts for output just queued in the output chain.
+ *
+ * @param oldLen Bytes that were pending before.
+ * @param added  Bytes just queued.
+ */
+void TcpConnection::outputQueued(size_t oldLen, size_t added)
+{
+    // Trigger high water mark callback if threshold is crossed
+    if (oldLen + added >= m_highWaterMark &&
+        oldLen < m_highWaterMark &&
+        m_highWaterMarkCallback)
+    {
+        m_loop->queueInLoop(
+            std::bind(m_highWaterMarkCallback, shared_from_this(), oldLen + added));
     }
 
-    // Safety check: remaining should not be greater than len
-    if (remaining > len)
+    // The write-progress deadline runs from when output starts waiting
+    if (oldLen == 0)
+        m_lastWriteTime = Timestamp::now();
+
+    m_loop->addPendingOutputBytes(static_cast<int64_t>(added));
+
+    // Ensure EPOLLOUT is enabled so we can continue sending when socket becomes writable
+    if (!m_channel->isWriting())
+    {
+        m_channel->enableWriting();
+    }
+}
+
+/**
+ * @brief Queue a file region in the event loop thread. Called internally by TcpConnection::sendFile.
+ *
+ * Like sendInLoop, the region is written immediately when nothing else is pending;
+ * whatever the socket does not accept is queued in the output chain behind the
+ * bytes already pending, and handleWrite drains them in order.
+ *
+ * @param file   File to send from, the queued region keeps it open until it is sent.
+ * @param offset File offset of the first byte to send.
+ * @param length Number of bytes to send.
+ */
+void TcpConnection::sendFileInLoop(const SharedFilePtr &file, int64_t offset, int64_t length)
+{
+    m_loop->assertInLoopThread();
+    int fd = file->fd();
+
+#ifdef WIN32
+    // No sendfile() here, fall back to reading the region into memory
+    std::string data(static_cast<size_t>(length), '\0');
+    bool readOk = _lseeki64(fd, offset, SEEK_SET) == offset && _read(fd, &data[0], static_cast<unsigned int>(length)) == length;
+    if (!readOk)
+    {
+        LOGE("TcpConnection::sendFileInLoop read error, offset: %lld, length: %lld", offset, length);
+        forceClose();
         return;
+    }
+    sendInLoop(data);
+#else
+    bool faultError = false;
 
-    // If there's still data left and the socket is okay, buffer it
-    if (!faultError && remaining > 0)
+    if (m_state == kDisconnected)
     {
-        size_t oldLen = m_outputBuffer.readableBytes();
+        LOGW("disconnected, give up sending file");
+        return;
+    }
 
-        // Trigger high water mark callback if threshold is crossed
-        if (oldLen + remaining >= m_highWaterMark &&
-            oldLen < m_highWaterMark &&
-            m_highWaterMarkCallback)
+    if (!m_channel->isWriting() && !hasPendingOutput())
+    {
+        while (length > 0)
         {
-            m_loop->queueInLoop(
-                std::bind(m_highWaterMarkCallback, shared_from_this(), oldLen + remaining));
-        }
+            ssize_t n = sockets::sendfile(m_channel->fd(), fd, &offset, static_cast<size_t>(length));
+            if (n > 0)
+            {
+                length -= n;
+                m_lastWriteTime = Timestamp::now();
+                m_loop->addBytesSent(n);
+                continue;
+            }
 
-        // Append remaining data to output buffer
-        m_outputBuffer.append(static_cast<const char *>(data) + nwrote, remaining);
+            if (n == 0)
+            {
+                // The file is shorter than announced, the stream can not be resynchronized
+                LOGE("TcpConnection::sendFileInLoop unexpected EOF, fd: %d, offset: %lld", fd, offset);
+                faultError = true;
+            }
+            else if (errno != EWOULDBLOCK)
+            {
+                LOGSYSE("TcpConnection::sendFileInLoop");
+                faultError = true;
+            }
+            break;
+        }
 
-        // Ensure EPOLLOUT is enabled so we can continue sending when socket becomes writable
-        if (!m_channel->isWriting())
+        if (length == 0)
         {
-            m_channel->enableWriting();
+            if (m_writeCompleteCallback)
+            {
+                m_loop->queueInLoop(std::bind(m_writeCompleteCallback, shared_from_this()));
+            }
+            return;
         }
     }
+
+    if (faultError)
+    {
+        forceClose();
+        return;
+    }
+
+    size_t oldLen = pendingOutputBytes();
+    m_outputChain.appendFile(file, offset, length);
+    outputQueued(oldLen, static_cast<size_t>(length));
+#endif
 }
 
 void TcpConnection::shutdown()
@@ -273,6 +450,32 @@ void TcpConnection::forceCloseInLoop()
     }
 }
 
+void TcpConnection::pauseRead(int reason)
+{
+    m_loop->runInLoop(std::bind(&TcpConnection::pauseReadInLoop, shared_from_this(), reason));
+}
+
+void TcpConnection::pauseReadInLoop(int reason)
+{
+    m_loop->assertInLoopThread();
+    m_readPauseReasons |= reason;
+    if (m_state == kConnected && m_channel->isReading())
+        m_channel->disableReading();
+}
+
+void TcpConnection::resumeRead(int reason)
+{
+    m_loop->runInLoop(std::bind(&TcpConnection::resumeReadInLoop, shared_from_this(), reason));
+}
+
+void TcpConnection::resumeReadInLoop(int reason)
+{
+    m_loop->assertInLoopThread();
+    m_readPauseReasons &= ~reason;
+    if (m_readPauseReasons == 0 && m_state == kConnected && !m_channel->isReading())
+        m_channel->enableReading();
+}
+
 const char *TcpConnection::stateToString() const
 {
     switch (m_state)
@@ -295,6 +498,93 @@ void TcpConnection::setTcpNoDelay(bool on)
     m_socket->setTcpNoDelay(on);
 }
 
+bool TcpConnection::getTcpInfo(struct tcp_info *tcpi) const
+{
+#ifndef WIN32
+    return sockets::getTcpInfo(m_channel->fd(), tcpi);
+#else
+    return false;
+#endif
+}
+
+void TcpConnection::setTimeouts(int64_t idleUs, int64_t readUs, int64_t writeUs)
+{
+    m_loop->assertInLoopThread();
+    m_idleTimeout = idleUs;
+    m_readTimeout = readUs;
+    m_writeTimeout = writeUs;
+
+    if (m_timeoutTimerArmed)
+    {
+        m_loop->remove(m_timeoutTimer);
+        m_timeoutTimerArmed = false;
+    }
+
+    checkTimeouts();
+}
+
+void TcpConnection::armTimeoutTimer(Timestamp when)
+{
+    // The timer may outlive the connection, it only holds a weak reference
+    std::weak_ptr<TcpConnection> weakThis(shared_from_this());
+    m_timeoutTimer = m_loop->runAt(when, [weakThis]()
+                                   {
+                                       TcpConnectionPtr conn = weakThis.lock();
+                                       if (conn)
+                                           conn->checkTimeouts();
+                                   });
+    m_timeoutTimerArmed = true;
+}
+
+/**
+ * @brief Closes the connection if a deadline passed, otherwise re-arms the timer.
+ *
+ * A deadline that does not apply right now (no partial input, no pending output)
+ * can start applying at any moment, but it can not pass within its timeout from
+ * now, so the timer is armed no later than that.
+ */
+void TcpConnection::checkTimeouts()
+{
+    m_loop->assertInLoopThread();
+    m_timeoutTimerArmed = false;
+    if (m_state != kConnected)
+        return;
+
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    int64_t lastRead = m_lastReadTime.microSecondsSinceEpoch();
+    int64_t lastWrite = m_lastWriteTime.microSecondsSinceEpoch();
+    int64_t nextCheck = 0;
+    const char *expired = NULL;
+
+    auto check = [&](int64_t timeout, bool applies, int64_t since, const char *name)
+    {
+        if (timeout <= 0)
+            return;
+
+        int64_t deadline = applies ? since + timeout : now + timeout;
+        if (deadline <= now)
+            expired = name;
+        else if (nextCheck == 0 || deadline < nextCheck)
+            nextCheck = deadline;
+    };
+
+    check(m_idleTimeout, true, lastRead > lastWrite ? lastRead : lastWrite, "idle");
+    // Paused reads are the application's doing, not the peer's
+    check(m_readTimeout, m_inputBuffer.readableBytes() > 0 && m_channel->isReading(), lastRead, "read");
+    check(m_writeTimeout, hasPendingOutput(), lastWrite, "write");
+
+    if (expired != NULL)
+    {
+        LOGI("TcpConnection::checkTimeouts [%s] %s timeout, close connection, client: %s",
+             m_name.c_str(), expired, m_peerAddr.toIpPort().c_str());
+        forceClose();
+        return;
+    }
+
+    if (nextCheck != 0)
+        armTimeoutTimer(Timestamp(nextCheck));
+}
+
 void TcpConnection::connectEstablished()
 {
     m_loop->assertInLoopThread();
@@ -305,6 +595,8 @@ void TcpConnection::connectEstablished()
     }
 
     setState(kConnected);
+    m_lastReadTime = Timestamp::now();
+    m_lastWriteTime = m_lastReadTime;
 
     // 假如正在执行这行代码时，对端关闭了连接
     if (!m_channel->enableReading())
@@ -322,13 +614,26 @@ void TcpConnection::connectEstablished()
 void TcpConnection::connectDestroyed()
 {
     m_loop->assertInLoopThread();
+    if (m_timeoutTimerArmed)
+    {
+        m_loop->remove(m_timeoutTimer);
+        m_timeoutTimerArmed = false;
+    }
+
     if (m_state == kConnected)
     {
         setState(kDisconnected);
         m_channel->disableAll();
+        releaseLoad();
 
         m_connectionCallback(shared_from_this());
     }
+    else if (m_state == kConnecting)
+    {
+        // Placed on the loop but never established, it was counted all the same
+        setState(kDisconnected);
+        releaseLoad();
+    }
     m_channel->remove();
 }
 
@@ -339,8 +644,16 @@ void TcpConnection::handleRead(Timestamp receiveTime)
     int32_t n = m_inputBuffer.readFd(m_channel->fd(), &savedErrno);
     if (n > 0)
     {
+        m_lastReadTime = receiveTime;
+        m_loop->addBytesReceived(n);
         // messageCallback_指向CTcpSession::OnRead(const std::shared_ptr<TcpConnection>& conn, Buffer* pBuffer, Timestamp receiveTime)
-        m_messageCallback(shared_from_this(), &m_inputBuffer, receiveTime);
+        TcpConnectionPtr guardThis(shared_from_this());
+        m_messageCallback(guardThis, &m_inputBuffer, receiveTime);
+
+        // A drained buffer keeps a little storage and returns the rest to the loop. Not while
+        // reading is paused: the application may still use bytes it retrieved from the buffer
+        if (m_readPauseReasons == 0)
+            m_inputBuffer.releaseToPool(kRetainedInputBytes);
     }
     else if (n == 0)
     {
@@ -357,39 +670,43 @@ void TcpConnection::handleRead(Timestamp receiveTime)
 void TcpConnection::handleWrite()
 {
     m_loop->assertInLoopThread();
-    if (m_channel->isWriting())
+    if (!m_channel->isWriting())
     {
-        int32_t n = sockets::write(m_channel->fd(), m_outputBuffer.peek(), m_outputBuffer.readableBytes());
-        if (n > 0)
-        {
-            m_outputBuffer.retrieve(n);
-            if (m_outputBuffer.readableBytes() == 0)
-            {
-                m_channel->disableWriting();
-                if (m_writeCompleteCallback)
-                {
-                    m_loop->queueInLoop(std::bind(m_writeCompleteCallback, shared_from_this()));
-                }
-                if (m_state == kDisconnecting)
-                {
-                    shutdownInLoop();
-                }
-            }
-        }
-        else
-        {
-            LOGSYSE("TcpConnection::handleWrite");
-            // if (state_ == kDisconnecting)
-            // {
-            //   shutdownInLoop();
-            // }
-            // added by zhangyl 2019.05.06
-            handleClose();
-        }
+        LOGD("Connection fd = %d  is down, no more writing", m_channel->fd());
+        return;
     }
-    else
+
+    // Queued bytes and file regions go out in order, consecutive bytes in one writev()
+    int savedErrno = 0;
+    size_t n = m_outputChain.writeTo(m_channel->fd(), &savedErrno);
+    if (n > 0)
     {
-        LOGD("Connection fd = %d  is down, no more writing", m_channel->fd());
+        m_loop->addPendingOutputBytes(-static_cast<int64_t>(n));
+        m_loop->addBytesSent(n);
+        m_lastWriteTime = m_loop->pollReturnTime();
+    }
+
+    if (savedErrno != 0 && savedErrno != EWOULDBLOCK)
+    {
+        errno = savedErrno;
+        LOGSYSE("TcpConnection::handleWrite");
+        // added by zhangyl 2019.05.06
+        handleClose();
+        return;
+    }
+
+    // Socket buffer is full, wait for the next XPOLLOUT
+    if (hasPendingOutput())
+        return;
+
+    m_channel->disableWriting();
+    if (m_writeCompleteCallback)
+    {
+        m_loop->queueInLoop(std::bind(m_writeCompleteCallback, shared_from_this()));
+    }
+    if (m_state == kDisconnecting)
+    {
+        shutdownInLoop();
     }
 }
 
@@ -407,6 +724,7 @@ void TcpConnection::handleClose()
     //  we don't close fd, leave it to dtor, so we can find leaks easily.
     setState(kDisconnected);
     m_channel->disableAll();
+    releaseLoad();
 
     TcpConnectionPtr guardThis(shared_from_this());
     m_connectionCallback(guardThis);
@@ -420,6 +738,13 @@ void TcpConnection::handleClose()
     // }
 }
 
+void TcpConnection::releaseLoad()
+{
+    // Output left behind is never written, it no longer loads the loop
+    m_loop->addConnectionCount(-1);
+    m_loop->addPendingOutputBytes(-static_cast<int64_t>(pendingOutputBytes()));
+}
+
 void TcpConnection::handleError()
 {
     int err = sockets::getSocketError(m_channel->fd());
@@ -10,9 +10,12 @@
 
 #include <memory>
 
+#include "../base/Timestamp.h"
 #include "Callbacks.h"
 #include "ByteBuffer.h"
+#include "OutputChain.h"
 #include "InetAddress.h"
+#include "TimerId.h"
 
 // Forward declaration for TCP connection information struct from <netinet/tcp.h>
 struct tcp_info;
@@ -61,15 +64,69 @@ namespace net
         void send(const std::string &message);
         void send(ByteBuffer *message); // Efficient send via buffer swap.
 
+        /**
+         * @brief Sends [offset, offset + length) of an open file (thread-safe).
+         *
+         * The region is queued behind any bytes already pending and copied to the
+         * socket with sendfile(), so file data never passes through user space.
+         * The descriptor is duplicated; the caller may close its own copy at once.
+         */
+        void sendFile(int fd, int64_t offset, int64_t length);
+
+        // Same as above for a shared file, regions queued from it take no descriptor of their own.
+        void sendFile(const SharedFilePtr &file, int64_t offset, int64_t length);
+
         // Initiates a graceful shutdown (write then close).
         void shutdown();
 
         // Forces the connection to close immediately.
         void forceClose();
 
+        /**
+         * @brief Why reading from the socket is paused, reasons are independent bits.
+         *
+         * Reading resumes only once every reason that paused it is resumed, so a
+         * full output path and a busy disk can throttle the same connection.
+         */
+        enum ReadPauseReason
+        {
+            kReadPausedByApp = 1 << 0,    ///< stopRead()/startRead().
+            kReadPausedByOutput = 1 << 1, ///< Pending output is above the high water mark or holds too many files.
+            kReadPausedByDisk = 1 << 2    ///< The application waits for disk I/O of this connection.
+        };
+
+        // Stops/resumes reading from the socket for a reason (thread-safe). While stopped
+        // the input buffer is left untouched and unread bytes stay in the kernel, so the
+        // peer is throttled by TCP flow control.
+        void pauseRead(int reason);
+        void resumeRead(int reason);
+        void startRead() { resumeRead(kReadPausedByApp); }
+        void stopRead() { pauseRead(kReadPausedByApp); }
+
+        /**
+         * @brief Sets the deadlines after which the connection is force closed (loop thread).
+         *
+         * Each is in microseconds, 0 disables it. One timer per connection enforces
+         * all three; it is armed for the earliest deadline and re-armed when traffic
+         * has moved the deadlines on, so busy connections cost no timer updates.
+         *
+         * @param idleUs  No byte was read or written for this long.
+         * @param readUs  Received bytes wait in the input buffer and no new byte arrived for this long.
+         * @param writeUs Output is pending and no byte of it was written for this long.
+         */
+        void setTimeouts(int64_t idleUs, int64_t readUs, int64_t writeUs);
+
+        // Attaches application state to the connection (loop thread). It lives as
+        // long as the connection unless it is replaced or reset earlier.
+        void setContext(const std::shared_ptr<void> &context) { m_context = context; }
+        const std::shared_ptr<void> &getContext() const { return m_context; }
+
         // Enables/disables the TCP_NODELAY option.
         void setTcpNoDelay(bool on);
 
+        // Reads the kernel's TCP state of the connection, false if it is not available.
+        bool getTcpInfo(struct tcp_info *tcpi) const;
+
         // Set user-defined callbacks for various connection events.
         void setConnectionCallback(const ConnectionCallback &cb)
         {
@@ -100,9 +157,14 @@ namespace net
             m_highWaterMark = highWaterMark;
         }
 
-        // Accessors to internal input/output buffers.
+        // Bytes queued for the socket (buffered bytes plus file regions), loop thread only.
+        size_t pendingOutputBytes() const { return m_outputChain.readableBytes(); }
+
+        // File regions queued for the socket, each holds a file open, loop thread only.
+        size_t pendingFileRegions() const { return m_outputChain.fileRegions(); }
+
+        // Accessor to the internal input buffer.
         ByteBuffer *inputBuffer() { return &m_inputBuffer; }
-        ByteBuffer *outputBuffer() { return &m_outputBuffer; }
 
         // Internal use only: set when connection is to be closed.
         void setCloseCallback(const CloseCallback &cb)
@@ -135,10 +197,31 @@ namespace net
         // Internal send helpers (executed in loop thread).
         void sendInLoop(const std::string &message);
         void sendInLoop(const void *message, size_t len);
+        void sendSharedInLoop(const std::shared_ptr<const std::string> &message);
+        void sendFileInLoop(const SharedFilePtr &file, int64_t offset, int64_t length);
+
+        // Writes straight to the socket when nothing is queued. Returns false if the
+        // data must be dropped (disconnected or socket error), nwrote is the bytes written.
+        bool writeDirect(const void *data, size_t len, size_t &nwrote);
+
+        // Bookkeeping after queueing output: high water mark, deadline, EPOLLOUT.
+        void outputQueued(size_t oldLen, size_t added);
+
+        // Returns true if bytes or file regions are still waiting to be written.
+        bool hasPendingOutput() const { return !m_outputChain.empty(); }
 
         // Internal shutdown/close helpers
         void shutdownInLoop();
         void forceCloseInLoop();
+        void pauseReadInLoop(int reason);
+        void resumeReadInLoop(int reason);
+
+        // Removes the connection from its loop's load counters once it is disconnected.
+        void releaseLoad();
+
+        // Timeout helpers (executed in loop thread).
+        void armTimeoutTimer(Timestamp when);
+        void checkTimeouts();
 
         // Set the internal state
         void setState(StateE s) { m_state = s; }
@@ -161,7 +244,16 @@ namespace net
         CloseCallback m_closeCallback;                 ///< Internal close callback.
         size_t m_highWaterMark;                        ///< Threshold for high water mark callback.
         ByteBuffer m_inputBuffer;                      ///< Input buffer (read data).
-        ByteBuffer m_outputBuffer;                     ///< Output buffer (pending writes).
+        OutputChain m_outputChain;                     ///< Pending writes, bytes and file regions in order.
+        int64_t m_idleTimeout;                         ///< Idle deadline in microseconds, 0 if disabled.
+        int64_t m_readTimeout;                         ///< Read-progress deadline in microseconds, 0 if disabled.
+        int64_t m_writeTimeout;                        ///< Write-progress deadline in microseconds, 0 if disabled.
+        Timestamp m_lastReadTime;                      ///< When bytes were last read.
+        Timestamp m_lastWriteTime;                     ///< When bytes were last written or output started pending.
+        TimerId m_timeoutTimer;                        ///< Timer checking the deadlines.
+        bool m_timeoutTimerArmed;                      ///< Whether m_timeoutTimer is scheduled.
+        std::shared_ptr<void> m_context;               ///< Application state owned by the connection.
+        int m_readPauseReasons;                        ///< ReadPauseReason bits reading is paused for.
     };
 
     // Alias for shared pointer to TcpConnection
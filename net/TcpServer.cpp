@@ -12,6 +12,7 @@
 #include "../base/Platform.h"
 #include "../base/AsyncLog.h"
 #include "../base/Singleton.h"
+#include "../base/CountDownLatch.h"
 #include "Acceptor.h"
 #include "EventLoop.h"
 #include "EventLoopThreadPool.h"
@@ -26,10 +27,15 @@ TcpServer::TcpServer(EventLoop *loop,
     : m_loop(loop),
       m_hostport(listenAddr.toIpPort()),
       m_name(nameArg),
+      m_listenAddr(listenAddr),
+      m_reusePort(option == kReusePort),
       m_acceptor(new Acceptor(loop, listenAddr, option == kReusePort)),
       // threadPool_(new EventLoopThreadPool(loop, name_)),
       m_connectionCallback(defaultConnectionCallback),
       m_messageCallback(defaultMessageCallback),
+      m_threadAffinity(EventLoopThreadPool::kAffinityNone),
+      m_acceptMode(kAcceptInMainLoop),
+      m_placementPolicy(EventLoopThreadPool::kPlaceRoundRobin),
       m_started(0),
       m_nextConnId(1)
 {
@@ -56,18 +62,96 @@ void TcpServer::start(int workerThreadCount /* = 4*/)
     {
         m_eventLoopThreadPool.reset(new EventLoopThreadPool());
         m_eventLoopThreadPool->init(m_loop, workerThreadCount);
-        m_eventLoopThreadPool->start();
+        m_eventLoopThreadPool->setAffinityMode(m_threadAffinity);
+        m_eventLoopThreadPool->setPlacementPolicy(m_placementPolicy);
+        m_eventLoopThreadPool->start(m_threadInitCallback);
 
-        m_loop->runInLoop(std::bind(&Acceptor::listen, m_acceptor.get()));
+        // The main loop's socket stays bound but never listens in the per-loop modes
+        if (m_acceptMode == kAcceptInMainLoop || !startLoopAcceptors())
+            m_loop->runInLoop(std::bind(&Acceptor::listen, m_acceptor.get()));
         m_started = 1;
     }
 }
 
+std::string TcpServer::loadInfo() const
+{
+    m_loop->assertInLoopThread();
+    // The worker loops are gone once stopped
+    if (m_started == 0 || !m_eventLoopThreadPool)
+        return std::string();
+
+    return m_eventLoopThreadPool->info();
+}
+
+bool TcpServer::startLoopAcceptors()
+{
+    m_loop->assertInLoopThread();
+    if (!m_reusePort)
+    {
+        LOGW("TcpServer [%s] needs SO_REUSEPORT to accept in each loop, accepting in the main loop", m_name.c_str());
+        return false;
+    }
+
+    // Loops are sorted by address in the map, the listening order is the pool's
+    std::vector<EventLoop *> loops = m_eventLoopThreadPool->getAllLoops();
+    if (loops.size() == 1 && loops.front() == m_loop)
+    {
+        LOGW("TcpServer [%s] has no worker loops, accepting in the main loop", m_name.c_str());
+        return false;
+    }
+
+    for (EventLoop *ioLoop : loops)
+    {
+        std::unique_ptr<LoopAcceptor> loopAcceptor(new LoopAcceptor());
+        loopAcceptor->acceptor.reset(new Acceptor(ioLoop, m_listenAddr, true));
+        loopAcceptor->acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnectionInLoop, this, ioLoop, std::placeholders::_1, std::placeholders::_2));
+        m_loopAcceptors[ioLoop] = std::move(loopAcceptor);
+    }
+
+    // One at a time, a listener's index in the SO_REUSEPORT group is the order it started listening in
+    for (EventLoop *ioLoop : loops)
+    {
+        Acceptor *acceptor = m_loopAcceptors[ioLoop]->acceptor.get();
+        CountDownLatch latch(1);
+        ioLoop->runInLoop([acceptor, &latch]()
+                          {
+                              acceptor->listen();
+                              latch.countDown();
+                          });
+        latch.wait();
+    }
+
+    if (m_acceptMode == kAcceptInEachLoopByCpu)
+        sockets::setReusePortCpuSteering(m_loopAcceptors[loops.front()]->acceptor->fd(), static_cast<int>(loops.size()));
+
+    LOGI("TcpServer [%s] accepts in %d loops", m_name.c_str(), static_cast<int>(loops.size()));
+    return true;
+}
+
 void TcpServer::stop()
 {
     if (m_started == 0)
         return;
 
+    // Each loop closes its listener and connections itself
+    for (auto &iter : m_loopAcceptors)
+    {
+        LoopAcceptor *loopAcceptor = iter.second.get();
+        CountDownLatch latch(1);
+        iter.first->runInLoop([loopAcceptor, &latch]()
+                              {
+                                  loopAcceptor->acceptor.reset();
+                                  ConnectionMap connections;
+                                  connections.swap(loopAcceptor->connections);
+                                  for (auto &conn : connections)
+                                  {
+                                      conn.second->connectDestroyed();
+                                  }
+                                  latch.countDown();
+                              });
+        latch.wait();
+    }
+
     for (ConnectionMap::iterator it = m_connections.begin(); it != m_connections.end(); ++it)
     {
         TcpConnectionPtr conn = it->second;
@@ -77,6 +161,7 @@ void TcpServer::stop()
     }
 
     m_eventLoopThreadPool->stop();
+    m_loopAcceptors.clear();
 
     m_started = 0;
 }
@@ -85,9 +170,24 @@ void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
 {
     m_loop->assertInLoopThread();
     EventLoop *ioLoop = m_eventLoopThreadPool->getNextLoop();
+    TcpConnectionPtr conn = createConnection(ioLoop, sockfd, peerAddr);
+    m_connections[conn->name()] = conn;
+    // 该线程分离完io事件后，立即调用TcpConnection::connectEstablished
+    ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+}
+
+void TcpServer::newConnectionInLoop(EventLoop *ioLoop, int sockfd, const InetAddress &peerAddr)
+{
+    ioLoop->assertInLoopThread();
+    TcpConnectionPtr conn = createConnection(ioLoop, sockfd, peerAddr);
+    m_loopAcceptors.find(ioLoop)->second->connections[conn->name()] = conn;
+    conn->connectEstablished();
+}
+
+TcpConnectionPtr TcpServer::createConnection(EventLoop *ioLoop, int sockfd, const InetAddress &peerAddr)
+{
     char buf[32];
-    snprintf(buf, sizeof buf, ":%s#%d", m_hostport.c_str(), m_nextConnId);
-    ++m_nextConnId;
+    snprintf(buf, sizeof buf, ":%s#%d", m_hostport.c_str(), m_nextConnId++);
     string connName = m_name + buf;
 
     LOGD("TcpServer::newConnection [%s] - new connection [%s] from %s", m_name.c_str(), connName.c_str(), peerAddr.toIpPort().c_str());
@@ -96,26 +196,35 @@ void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
     // FIXME poll with zero timeout to double confirm the new connection
     // FIXME use make_shared if necessary
     TcpConnectionPtr conn(new TcpConnection(ioLoop, connName, sockfd, localAddr, peerAddr));
-    m_connections[connName] = conn;
+    // Counted on placement, the loop establishes the connection later and the next
+    // placement must already see it; TcpConnection::releaseLoad() takes it back
+    ioLoop->addConnectionCount(1);
     conn->setConnectionCallback(m_connectionCallback);
     conn->setMessageCallback(m_messageCallback);
     conn->setWriteCompleteCallback(m_writeCompleteCallback);
     conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this, std::placeholders::_1)); // FIXME: unsafe
-    // 该线程分离完io事件后，立即调用TcpConnection::connectEstablished
-    ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+    return conn;
 }
 
 void TcpServer::removeConnection(const TcpConnectionPtr &conn)
 {
     // FIXME: unsafe
-    m_loop->runInLoop(std::bind(&TcpServer::removeConnectionInLoop, this, conn));
+    // Connections accepted by a worker loop are registered in that loop
+    EventLoop *ownerLoop = m_loopAcceptors.empty() ? m_loop : conn->getLoop();
+    ownerLoop->runInLoop(std::bind(&TcpServer::removeConnectionInLoop, this, conn));
 }
 
 void TcpServer::removeConnectionInLoop(const TcpConnectionPtr &conn)
 {
-    m_loop->assertInLoopThread();
+    LoopAcceptorMap::iterator iter = m_loopAcceptors.find(conn->getLoop());
+    ConnectionMap &connections = iter != m_loopAcceptors.end() ? iter->second->connections : m_connections;
+    if (iter == m_loopAcceptors.end())
+        m_loop->assertInLoopThread();
+    else
+        conn->getLoop()->assertInLoopThread();
+
     LOGD("TcpServer::removeConnectionInLoop [%s] - connection %s", m_name.c_str(), conn->name().c_str());
-    size_t n = m_connections.erase(conn->name());
+    size_t n = connections.erase(conn->name());
     //(void)n;
     // assert(n == 1);
     if (n != 1)
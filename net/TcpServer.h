@@ -13,6 +13,7 @@
 #include <memory>
 
 #include "TcpConnection.h"
+#include "EventLoopThreadPool.h"
 
 namespace net
 {
@@ -40,6 +41,16 @@ namespace net
             kReusePort    ///< Reuse port (default).
         };
 
+        /**
+         * @brief Where connections are accepted.
+         */
+        enum AcceptMode
+        {
+            kAcceptInMainLoop,       ///< One listener on the main loop hands connections to workers (default).
+            kAcceptInEachLoop,       ///< Each worker loop accepts on its own SO_REUSEPORT listener.
+            kAcceptInEachLoopByCpu   ///< As kAcceptInEachLoop, the kernel picks the listener by receiving CPU.
+        };
+
         /**
          * @brief Constructs a TcpServer object.
          *
@@ -80,6 +91,48 @@ namespace net
             m_threadInitCallback = cb;
         }
 
+        /**
+         * @brief Sets how worker threads are placed on CPUs.
+         *
+         * Not thread-safe: should be called before `start()`.
+         */
+        void setThreadAffinity(EventLoopThreadPool::AffinityMode mode)
+        {
+            m_threadAffinity = mode;
+        }
+
+        /**
+         * @brief Sets how the main loop picks the worker loop of a new connection.
+         *
+         * Unused in the per-loop accept modes, where the kernel picks the loop.
+         * Not thread-safe: should be called before `start()`.
+         */
+        void setPlacementPolicy(EventLoopThreadPool::PlacementPolicy policy)
+        {
+            m_placementPolicy = policy;
+        }
+
+        /**
+         * @brief Returns the load counters of the worker loops, for monitoring.
+         *
+         * Must be called in the main loop thread.
+         */
+        std::string loadInfo() const;
+
+        /**
+         * @brief Sets where connections are accepted.
+         *
+         * The per-loop modes need kReusePort and at least one worker thread, the
+         * main loop accepts otherwise. kAcceptInEachLoopByCpu sends a connection to
+         * loop (cpu % loops), which is the loop running on that CPU when the loops
+         * are pinned one per CPU to CPUs 0..n-1.
+         * Not thread-safe: should be called before `start()`.
+         */
+        void setAcceptMode(AcceptMode mode)
+        {
+            m_acceptMode = mode;
+        }
+
         /**
          * @brief Starts the server and worker thread pool.
          *
@@ -143,6 +196,29 @@ namespace net
          */
         void newConnection(int sockfd, const InetAddress &peerAddr);
 
+        /**
+         * @brief Called in a worker loop when its own listener accepts a connection.
+         *
+         * The connection stays in the loop that accepted it, nothing goes through the main loop.
+         *
+         * @param ioLoop    The worker loop that accepted the connection.
+         * @param sockfd    The socket file descriptor for the new connection.
+         * @param peerAddr  The remote peer address.
+         */
+        void newConnectionInLoop(EventLoop *ioLoop, int sockfd, const InetAddress &peerAddr);
+
+        /**
+         * @brief Creates a connection served by ioLoop and sets its callbacks.
+         */
+        TcpConnectionPtr createConnection(EventLoop *ioLoop, int sockfd, const InetAddress &peerAddr);
+
+        /**
+         * @brief Starts a listener in each worker loop.
+         *
+         * @return false if the per-loop listeners can not be used.
+         */
+        bool startLoopAcceptors();
+
         /**
          * @brief Removes a connection from the internal map.
          *
@@ -152,19 +228,39 @@ namespace net
 
         using ConnectionMap = std::map<std::string, TcpConnectionPtr>;
 
+        /**
+         * @brief A worker loop's own listener and the connections it accepted.
+         *
+         * Only touched in that loop's thread.
+         */
+        struct LoopAcceptor
+        {
+            std::unique_ptr<Acceptor> acceptor; ///< Listener of the loop.
+            ConnectionMap connections;          ///< Connections accepted by the listener.
+        };
+
+        // Filled by start() before any listener runs, read-only until stop()
+        using LoopAcceptorMap = std::map<EventLoop *, std::unique_ptr<LoopAcceptor>>;
+
     private:
         EventLoop *m_loop;                                          ///< The main event loop (acceptor runs here).
         const std::string m_hostport;                               ///< The listening address (host:port).
         const std::string m_name;                                   ///< Server instance name.
+        const InetAddress m_listenAddr;                             ///< The listening address.
+        const bool m_reusePort;                                     ///< Whether listeners use SO_REUSEPORT.
         std::unique_ptr<Acceptor> m_acceptor;                       ///< Responsible for accepting new connections.
         std::unique_ptr<EventLoopThreadPool> m_eventLoopThreadPool; ///< Worker thread pool.
         ConnectionCallback m_connectionCallback;                    ///< Callback on connection established/closed.
         MessageCallback m_messageCallback;                          ///< Callback on message received.
         WriteCompleteCallback m_writeCompleteCallback;              ///< Callback on write completion.
         ThreadInitCallback m_threadInitCallback;                    ///< Callback before thread loop starts.
+        EventLoopThreadPool::AffinityMode m_threadAffinity;         ///< CPU placement of worker threads.
+        AcceptMode m_acceptMode;                                    ///< Where connections are accepted.
+        EventLoopThreadPool::PlacementPolicy m_placementPolicy;     ///< How worker loops are picked.
         std::atomic<int> m_started;                                 ///< Atomic flag indicating server start state.
-        int m_nextConnId;                                           ///< Next connection ID used to generate unique names.
-        ConnectionMap m_connections;                                ///< Active TCP connections.
+        std::atomic<int> m_nextConnId;                              ///< Next connection ID used to generate unique names.
+        ConnectionMap m_connections;                                ///< Connections accepted by the main loop.
+        LoopAcceptorMap m_loopAcceptors;                            ///< Per-loop listeners, empty when the main loop accepts.
     };
 
 } // namespace net
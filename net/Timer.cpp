@@ -21,11 +21,11 @@ Timer::Timer(const TimerCallback &cb, Timestamp when, int64_t interval, int64_t
 {
 }
 
-Timer::Timer(TimerCallback &&cb, Timestamp when, int64_t interval)
+Timer::Timer(TimerCallback &&cb, Timestamp when, int64_t interval, int64_t repeatCount /* = -1*/)
     : m_callback(std::move(cb)),
       m_expiration(when),
       m_interval(interval),
-      m_repeatCount(-1),
+      m_repeatCount(repeatCount),
       m_sequence(++s_numCreated),
       m_canceled(false)
 {
@@ -33,10 +33,9 @@ Timer::Timer(TimerCallback &&cb, Timestamp when, int64_t interval)
 
 void Timer::run()
 {
-    if (m_canceled)
-        return;
-
-    m_callback();
+    // A canceled timer keeps its schedule, it only skips the callback
+    if (!m_canceled)
+        m_callback();
 
     if (m_repeatCount != -1)
     {
@@ -18,6 +18,20 @@
 
 namespace net
 {
+    /**
+     * @brief Links of an intrusive circular list of timers.
+     *
+     * A default-constructed link is an empty list head, TimerQueue keeps one per
+     * wheel slot and links timers in and out of them in O(1).
+     */
+    struct TimerLink
+    {
+        TimerLink() : prev(this), next(this) {}
+
+        TimerLink *prev; // Previous link, the head for the first timer.
+        TimerLink *next; // Next link, the head for the last timer.
+    };
+
     /**
      * @brief Represents a timer with optional repeat behavior.
      *
@@ -25,7 +39,7 @@ namespace net
      * a repeat interval (in microseconds), and a repeat count.
      * It can be canceled and tracked using a unique sequence number.
      */
-    class Timer
+    class Timer : public TimerLink
     {
     public:
         /**
@@ -40,7 +54,7 @@ namespace net
         /**
          * @brief Move-constructor version of Timer.
          */
-        Timer(TimerCallback &&cb, Timestamp when, int64_t interval);
+        Timer(TimerCallback &&cb, Timestamp when, int64_t interval, int64_t repeatCount = -1);
 
         /**
          * @brief Executes the stored callback function.
@@ -63,6 +77,11 @@ namespace net
          */
         Timestamp expiration() const { return m_expiration; }
 
+        /**
+         * @brief Returns whether run() left the timer scheduled again.
+         */
+        bool repeats() const { return m_interval > 0 && m_repeatCount != 0; }
+
         /**
          * @brief Returns the remaining repeat count.
          */
@@ -11,18 +11,56 @@
 using namespace net;
 // using namespace net::detail;
 
+namespace
+{
+    // Appends node to the list headed by head.
+    void linkBefore(TimerLink *head, TimerLink *node)
+    {
+        node->prev = head->prev;
+        node->next = head;
+        head->prev->next = node;
+        head->prev = node;
+    }
+
+    // Removes node from its list, a lone node is left as is.
+    void unlink(TimerLink *node)
+    {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node;
+        node->next = node;
+    }
+
+    // Moves every node of from to the empty list to.
+    void moveAll(TimerLink *from, TimerLink *to)
+    {
+        if (from->next == from)
+            return;
+
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        from->prev = from;
+        from->next = from;
+    }
+}
+
 TimerQueue::TimerQueue(EventLoop *loop)
     : m_loop(loop),
       /*timerfd_(createTimerfd()),
       timerfdChannel_(loop, timerfd_),*/
-      m_timers()
+      m_timers(),
+      m_currentTick(Timestamp::now().microSecondsSinceEpoch() / kTickUs),
+      m_runningTimer(NULL),
+      m_runningTimerRemoved(false)
 // callingExpiredTimers_(false)
 {
 }
 
 TimerQueue::~TimerQueue()
 {
-    for (TimerList::iterator it = m_timers.begin(); it != m_timers.end(); ++it)
+    for (TimerMap::iterator it = m_timers.begin(); it != m_timers.end(); ++it)
     {
         delete it->second;
     }
@@ -30,16 +68,20 @@ TimerQueue::~TimerQueue()
 
 TimerId TimerQueue::addTimer(const TimerCallback &cb, Timestamp when, int64_t interval, int64_t repeatCount)
 {
-    Timer *timer = new Timer(cb, when, interval);
+    Timer *timer = new Timer(cb, when, interval, repeatCount);
+    // A one-shot timer may fire and be deleted by the loop before runInLoop() returns
+    TimerId timerId(timer, timer->sequence());
     m_loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
-    return TimerId(timer, timer->sequence());
+    return timerId;
 }
 
 TimerId TimerQueue::addTimer(TimerCallback &&cb, Timestamp when, int64_t interval, int64_t repeatCount)
 {
     Timer *timer = new Timer(std::move(cb), when, interval, repeatCount);
+    // A one-shot timer may fire and be deleted by the loop before runInLoop() returns
+    TimerId timerId(timer, timer->sequence());
     m_loop->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
-    return TimerId(timer, timer->sequence());
+    return timerId;
 }
 
 void TimerQueue::removeTimer(TimerId timerId)
@@ -56,46 +98,102 @@ void TimerQueue::doTimer()
 {
     m_loop->assertInLoopThread();
 
-    Timestamp now(Timestamp::now());
+    int64_t nowTick = Timestamp::now().microSecondsSinceEpoch() / kTickUs;
+    if (m_timers.empty())
+    {
+        // Nothing to walk over, jump to now
+        if (m_currentTick <= nowTick)
+            m_currentTick = nowTick + 1;
+        return;
+    }
 
-    for (auto iter = m_timers.begin(); iter != m_timers.end();)
+    while (m_currentTick <= nowTick)
     {
-        if (iter->second->expiration() <= now)
+        int index = static_cast<int>(m_currentTick & (kLevel0Slots - 1));
+        if (index == 0)
         {
-            iter->second->run();
-            if (iter->second->getRepeatCount() == 0)
+            // Level 0 wrapped, refill it from level 1, and level 1 from level 2 if it wrapped too...
+            for (int level = 1; level < kLevels; ++level)
             {
-                iter = m_timers.erase(iter);
+                int levelIndex = static_cast<int>((m_currentTick >> (kLevel0Bits + (level - 1) * kLevelBits)) & (kLevelSlots - 1));
+                cascade(level, levelIndex);
+                if (levelIndex != 0)
+                    break;
+            }
+        }
+
+        // Detached first, callbacks may add and remove timers
+        TimerLink expired;
+        moveAll(&m_level0[index], &expired);
+        ++m_currentTick;
+
+        while (expired.next != &expired)
+        {
+            Timer *timer = static_cast<Timer *>(expired.next);
+            unlink(timer);
+
+            m_runningTimer = timer;
+            m_runningTimerRemoved = false;
+            timer->run();
+            m_runningTimer = NULL;
+
+            if (m_runningTimerRemoved)
+            {
+                delete timer;
+            }
+            else if (timer->repeats())
+            {
+                insert(timer);
             }
             else
             {
-                ++iter;
+                m_timers.erase(timer->sequence());
+                delete timer;
             }
         }
-        else
+    }
+}
+
+int TimerQueue::nextTimeout(int maxTimeoutMs) const
+{
+    if (m_timers.empty())
+        return maxTimeoutMs;
+
+    // Past the end of level 0 a cascade is due, which may bring timers down
+    int64_t cascadeTick = (m_currentTick | (kLevel0Slots - 1)) + 1;
+    int64_t dueTick = cascadeTick;
+    for (int64_t tick = m_currentTick; tick < cascadeTick; ++tick)
+    {
+        const TimerLink &slot = m_level0[tick & (kLevel0Slots - 1)];
+        if (slot.next != &slot)
         {
+            dueTick = tick;
             break;
         }
     }
+
+    int64_t waitUs = dueTick * kTickUs - Timestamp::now().microSecondsSinceEpoch();
+    if (waitUs <= 0)
+        return 0;
+
+    int64_t waitMs = (waitUs + 999) / 1000;
+    return waitMs < maxTimeoutMs ? static_cast<int>(waitMs) : maxTimeoutMs;
 }
 
 void TimerQueue::addTimerInLoop(Timer *timer)
 {
     m_loop->assertInLoopThread();
+    m_timers[timer->sequence()] = timer;
     insert(timer);
 }
 
 void TimerQueue::removeTimerInLoop(TimerId timerId)
 {
     m_loop->assertInLoopThread();
-    Timer *timer = timerId.m_timer;
-    for (auto iter = m_timers.begin(); iter != m_timers.end(); ++iter)
+    TimerMap::iterator iter = m_timers.find(timerId.m_sequence);
+    if (iter != m_timers.end())
     {
-        if (iter->second == timer)
-        {
-            m_timers.erase(iter);
-            break;
-        }
+        destroy(iter->second);
     }
 }
 
@@ -103,21 +201,66 @@ void TimerQueue::cancelTimerInLoop(TimerId timerId, bool off)
 {
     m_loop->assertInLoopThread();
 
-    Timer *timer = timerId.m_timer;
-    for (auto iter = m_timers.begin(); iter != m_timers.end(); ++iter)
+    TimerMap::iterator iter = m_timers.find(timerId.m_sequence);
+    if (iter != m_timers.end())
     {
-        if (iter->second == timer)
-        {
-            iter->second->cancel(off);
-            break;
-        }
+        iter->second->cancel(off);
     }
 }
 
 void TimerQueue::insert(Timer *timer)
 {
     m_loop->assertInLoopThread();
-    bool earliestChanged = false;
-    Timestamp when = timer->expiration();
-    m_timers.insert(Entry(when, timer));
+
+    // Round up, a timer never fires before its expiration
+    int64_t tick = (timer->expiration().microSecondsSinceEpoch() + kTickUs - 1) / kTickUs;
+    if (tick < m_currentTick)
+        tick = m_currentTick;
+
+    int64_t delta = tick - m_currentTick;
+    if (delta >= kMaxTicks)
+    {
+        // Parked at the far end of the wheel, placed again when it cascades
+        tick = m_currentTick + kMaxTicks - 1;
+        delta = kMaxTicks - 1;
+    }
+
+    if (delta < kLevel0Slots)
+    {
+        linkBefore(&m_level0[tick & (kLevel0Slots - 1)], timer);
+        return;
+    }
+
+    int level = 1;
+    while (delta >= (1LL << (kLevel0Bits + level * kLevelBits)))
+        ++level;
+
+    int index = static_cast<int>((tick >> (kLevel0Bits + (level - 1) * kLevelBits)) & (kLevelSlots - 1));
+    linkBefore(&m_levels[level - 1][index], timer);
+}
+
+void TimerQueue::cascade(int level, int index)
+{
+    TimerLink timers;
+    moveAll(&m_levels[level - 1][index], &timers);
+    while (timers.next != &timers)
+    {
+        Timer *timer = static_cast<Timer *>(timers.next);
+        unlink(timer);
+        insert(timer);
+    }
+}
+
+void TimerQueue::destroy(Timer *timer)
+{
+    m_timers.erase(timer->sequence());
+    if (timer == m_runningTimer)
+    {
+        // Deleted by doTimer() once the callback returns
+        m_runningTimerRemoved = true;
+        return;
+    }
+
+    unlink(timer);
+    delete timer;
 }
@@ -7,28 +7,36 @@
  * TimerQueue manages multiple timers in a thread-safe way, allowing
  * users to schedule timed callbacks (single-shot or repeated).
  * It is typically used in asynchronous network programming.
+ * Timers are kept in a hierarchical timing wheel, so adding and removing
+ * a timer is O(1) whatever the number of timers.
  */
 
 #pragma once
 
-#include <set>
-#include <vector>
+#include <stdint.h>
+#include <unordered_map>
 
 #include "../base/Timestamp.h"
 #include "../net/Callbacks.h"
 #include "../net/Channel.h"
+#include "../net/Timer.h"
 
 namespace net
 {
     class EventLoop;
-    class Timer;
     class TimerId;
 
     /**
      * @brief A queue to manage and dispatch timers based on expiration timestamps.
      *
      * Timers can be one-shot or periodic. This class integrates with EventLoop,
-     * and the doTimer() function should be triggered when the timerfd fires.
+     * which calls doTimer() every iteration and sleeps in poll() no longer than
+     * nextTimeout().
+     *
+     * The wheel advances in ticks of kTickUs. Level 0 has a slot per tick for the
+     * next kLevel0Slots ticks, each higher level has kLevelSlots slots spanning a
+     * whole turn of the level below; timers due later are parked in the last slot
+     * of the top level. A timer moves down a level when the level below wraps.
      */
     class TimerQueue
     {
@@ -78,16 +86,28 @@ namespace net
          */
         void doTimer();
 
+        /**
+         * @brief Returns how long the loop may wait before doTimer() has work.
+         * @param maxTimeoutMs Upper bound of the result.
+         * @return Milliseconds until the next due slot or wheel cascade, capped to maxTimeoutMs.
+         */
+        int nextTimeout(int maxTimeoutMs) const;
+
     private:
         // Disable copy and assignment
         TimerQueue(const TimerQueue &rhs) = delete;
         TimerQueue &operator=(const TimerQueue &rhs) = delete;
 
-        // Internal types for managing timers
-        typedef std::pair<Timestamp, Timer *> Entry;
-        typedef std::set<Entry> TimerList;
-        typedef std::pair<Timer *, int64_t> ActiveTimer;
-        typedef std::set<ActiveTimer> ActiveTimerSet;
+        static const int64_t kTickUs = 1000;    // Wheel resolution in microseconds.
+        static const int kLevel0Bits = 8;       // log2 of the level 0 slot count.
+        static const int kLevelBits = 6;        // log2 of the slot count of higher levels.
+        static const int kLevels = 4;           // Number of levels including level 0.
+        static const int kLevel0Slots = 1 << kLevel0Bits;
+        static const int kLevelSlots = 1 << kLevelBits;
+        static const int64_t kMaxTicks = 1LL << (kLevel0Bits + (kLevels - 1) * kLevelBits); // Span of the wheel.
+
+        // Maps timer sequence numbers to live timers.
+        typedef std::unordered_map<int64_t, Timer *> TimerMap;
 
         // Adds a timer inside the event loop thread context.
         void addTimerInLoop(Timer *timer);
@@ -98,12 +118,25 @@ namespace net
         // Cancels a timer inside the event loop thread context.
         void cancelTimerInLoop(TimerId timerId, bool off);
 
-        // Inserts a timer into the sorted timer list.
+        // Links a timer into the wheel slot of its expiration.
         void insert(Timer *timer);
 
+        // Moves the timers of a higher level slot down to the levels below.
+        void cascade(int level, int index);
+
+        // Unlinks a timer and deletes it, unless it is running.
+        void destroy(Timer *timer);
+
     private:
         EventLoop *m_loop;  // The event loop that owns this timer queue.
-        TimerList m_timers; // Ordered set of all active timers.
+        TimerMap m_timers;  // All live timers, by sequence number.
+
+        TimerLink m_level0[kLevel0Slots];             // Slots of the next kLevel0Slots ticks.
+        TimerLink m_levels[kLevels - 1][kLevelSlots]; // Slots of the higher levels.
+        int64_t m_currentTick;                        // First tick not processed yet.
+
+        Timer *m_runningTimer;      // Timer whose callback is running.
+        bool m_runningTimerRemoved; // Whether the running timer was removed by its callback.
     };
 
 }
@@ -0,0 +1,96 @@
+/**
+ *  @brief Disk I/O Executor Class Implementation
+ *  @author: xiebaoma
+ *  @date: 2025-05-25
+ **/
+#include "DiskExecutor.h"
+
+#include "../base/AsyncLog.h"
+
+DiskExecutor::~DiskExecutor()
+{
+    uninit();
+}
+
+/**
+ * @brief Start the disk threads
+ *
+ * Only called once at startup, before any task is submitted.
+ *
+ * @param threadCount Number of disk threads, 0 runs tasks inline
+ */
+void DiskExecutor::init(int threadCount)
+{
+    for (int i = 0; i < threadCount; ++i)
+    {
+        m_workers.emplace_back(new Worker());
+        m_workers.back()->thread = std::thread(&DiskExecutor::run, this, m_workers.back().get());
+    }
+
+    LOGI("disk executor started, threads: %d", threadCount);
+}
+
+/**
+ * @brief Run the queued tasks and stop the disk threads
+ *
+ * Called while the event loops still run, so the tasks can post their completions.
+ * The workers are kept: the loops may still submit, and such late tasks run inline.
+ */
+void DiskExecutor::uninit()
+{
+    for (auto &worker : m_workers)
+    {
+        std::lock_guard<std::mutex> guard(worker->mtx);
+        worker->stop = true;
+        worker->cv.notify_one();
+    }
+
+    for (auto &worker : m_workers)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+void DiskExecutor::submit(size_t key, const Task &task)
+{
+    if (m_workers.empty())
+    {
+        task();
+        return;
+    }
+
+    Worker *worker = m_workers[key % m_workers.size()].get();
+    {
+        std::lock_guard<std::mutex> guard(worker->mtx);
+        if (!worker->stop)
+        {
+            worker->tasks.push_back(task);
+            worker->cv.notify_one();
+            return;
+        }
+    }
+
+    // The thread has run its queue and exited, nothing is left to keep the order with
+    task();
+}
+
+void DiskExecutor::run(Worker *worker)
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(worker->mtx);
+            worker->cv.wait(lock, [worker]
+                            { return worker->stop || !worker->tasks.empty(); });
+            if (worker->tasks.empty())
+                return;
+
+            task = std::move(worker->tasks.front());
+            worker->tasks.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ *  Disk I/O Executor Class, DiskExecutor.h
+ *  Author: xiebaoma
+ *  Date: 2025-05-25
+ **/
+#pragma once
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+/**
+ * @class DiskExecutor
+ * @brief Runs blocking file I/O on dedicated threads, off the event loops
+ *
+ * Each thread has its own queue. Tasks submitted with the same key always run
+ * on the same thread, in submission order, so a session gets its file
+ * operations serialized without any locking of its own. Completions are
+ * posted back to the event loop by the tasks themselves.
+ *
+ * With no threads, or once stopped, tasks run inline on the submitting thread.
+ * It is designed as a final class that cannot be inherited from.
+ */
+class DiskExecutor final
+{
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * @brief Default constructor
+     */
+    DiskExecutor() = default;
+
+    /**
+     * @brief Destructor, stops the threads
+     */
+    ~DiskExecutor();
+
+    /**
+     * @brief Copy constructor (deleted)
+     * @param rhs The source object
+     */
+    DiskExecutor(const DiskExecutor &rhs) = delete;
+
+    /**
+     * @brief Assignment operator (deleted)
+     * @param rhs The source object
+     * @return Reference to this object
+     */
+    DiskExecutor &operator=(const DiskExecutor &rhs) = delete;
+
+    /**
+     * @brief Start the disk threads
+     * @param threadCount Number of disk threads, 0 runs tasks inline
+     */
+    void init(int threadCount);
+
+    /**
+     * @brief Run the queued tasks and stop the disk threads, tasks submitted later run inline
+     *
+     * Must be called before the event loops the tasks post their completions to are stopped.
+     */
+    void uninit();
+
+    /**
+     * @brief Queue a task
+     * @param key Tasks with the same key run in order on the same thread
+     * @param task The task to run
+     */
+    void submit(size_t key, const Task &task);
+
+private:
+    /**
+     * @struct Worker
+     * @brief One disk thread and its queue
+     */
+    struct Worker
+    {
+        std::mutex mtx;              /**< Protects tasks and stop */
+        std::condition_variable cv;  /**< Signaled when a task is queued or on stop */
+        std::deque<Task> tasks;      /**< Tasks not run yet */
+        bool stop = false;           /**< Whether the thread exits once the queue is empty */
+        std::thread thread;          /**< The disk thread */
+    };
+
+    /**
+     * @brief Run the tasks of a worker until it is stopped
+     * @param worker The worker the thread belongs to
+     */
+    void run(Worker *worker);
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers; /**< Disk threads, empty when tasks run inline */
+};
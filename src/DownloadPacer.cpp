@@ -0,0 +1,127 @@
+/**
+ * @file DownloadPacer.cpp
+ * @brief Sizes download chunks from the measured speed of the connection.
+ * @author xiebaoma
+ * @date 2025-06-06
+ */
+
+#include "DownloadPacer.h"
+#include "../base/Platform.h"
+#include "../base/Metrics.h"
+#include "FileMsg.h"
+
+/**
+ * @brief Bounds of the sizes, chunks are multiples of the smallest chunk
+ */
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define MAX_CHUNK_SIZE (2 * 1024 * 1024)
+#define MAX_STREAM_CHUNK_SIZE (1024 * 1024)
+#define MIN_STREAM_WINDOW (256 * 1024)
+#define MAX_STREAM_WINDOW (8 * 1024 * 1024)
+
+/**
+ * @brief Minimum time between two TCP_INFO reads, in microseconds
+ */
+#define UPDATE_INTERVAL_US (100 * 1000)
+
+/**
+ * @brief Drains shorter than this mostly measure the socket send buffer, not the path
+ */
+#define MIN_DRAIN_TIME_US (10 * 1000)
+
+/**
+ * @brief RTT assumed when only the drain rate is known
+ */
+#define DEFAULT_RTT_US (50 * 1000)
+
+namespace
+{
+    int64_t clampSize(int64_t size, int64_t lower, int64_t upper)
+    {
+        // Round up to whole minimum chunks
+        size = (size + MIN_CHUNK_SIZE - 1) / MIN_CHUNK_SIZE * MIN_CHUNK_SIZE;
+        if (size < lower)
+            return lower;
+        if (size > upper)
+            return upper;
+        return size;
+    }
+}
+
+DownloadPacer::DownloadPacer()
+{
+    reset(client_net_type_broadband);
+}
+
+void DownloadPacer::reset(int32_t clientNetType)
+{
+    m_rttUs = 0;
+    m_tcpRate = 0;
+    m_drainRate = 0;
+    m_lastUpdate = 0;
+    m_drainStart = 0;
+    m_drainBytes = 0;
+
+    // Until measured, cellular clients get 64KB chunks and the others 512KB, four in flight
+    m_chunkSize = (clientNetType == client_net_type_cellular) ? 64 * 1024 : 512 * 1024;
+    m_streamChunkSize = m_chunkSize;
+    m_streamWindow = 4 * m_chunkSize;
+}
+
+void DownloadPacer::update(const std::shared_ptr<TcpConnection> &conn)
+{
+#ifndef WIN32
+    int64_t now = monotonicMicroseconds();
+    if (m_lastUpdate != 0 && now - m_lastUpdate < UPDATE_INTERVAL_US)
+        return;
+    m_lastUpdate = now;
+
+    struct tcp_info tcpi;
+    if (!conn->getTcpInfo(&tcpi) || tcpi.tcpi_rtt == 0)
+        return;
+
+    m_rttUs = tcpi.tcpi_rtt;
+    m_tcpRate = static_cast<double>(tcpi.tcpi_snd_cwnd) * tcpi.tcpi_snd_mss * 1000000 / tcpi.tcpi_rtt;
+    resize();
+#endif
+}
+
+void DownloadPacer::onQueued(int64_t bytes, bool outputWasEmpty)
+{
+    if (outputWasEmpty || m_drainStart == 0)
+    {
+        m_drainStart = monotonicMicroseconds();
+        m_drainBytes = 0;
+    }
+    m_drainBytes += bytes;
+}
+
+void DownloadPacer::onDrained()
+{
+    if (m_drainStart == 0)
+        return;
+
+    int64_t elapsed = monotonicMicroseconds() - m_drainStart;
+    m_drainStart = 0;
+    if (elapsed < MIN_DRAIN_TIME_US)
+        return;
+
+    // Moving average over the last few drains
+    double sample = static_cast<double>(m_drainBytes) * 1000000 / elapsed;
+    m_drainRate = m_drainRate > 0 ? m_drainRate * 0.75 + sample * 0.25 : sample;
+    resize();
+}
+
+void DownloadPacer::resize()
+{
+    double bytesPerSecond = rate();
+    if (bytesPerSecond <= 0)
+        return;
+
+    int64_t rttUs = m_rttUs > 0 ? m_rttUs : DEFAULT_RTT_US;
+    int64_t bdp = static_cast<int64_t>(bytesPerSecond * rttUs / 1000000);
+
+    m_chunkSize = clampSize(2 * bdp, MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    m_streamWindow = clampSize(2 * bdp, MIN_STREAM_WINDOW, MAX_STREAM_WINDOW);
+    m_streamChunkSize = clampSize(m_streamWindow / 4, MIN_CHUNK_SIZE, MAX_STREAM_CHUNK_SIZE);
+}
@@ -0,0 +1,89 @@
+/**
+ *  @file DownloadPacer.h
+ *  @brief Sizes download chunks from the measured speed of the connection
+ *  @author xiebaoma
+ *  @date 2025-06-06
+ **/
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include "../net/TcpConnection.h"
+
+using namespace net;
+
+/**
+ * @class DownloadPacer
+ * @brief Picks the download chunk size and streaming window of one connection
+ *
+ * The bandwidth-delay product (BDP) of the connection is estimated from the kernel's
+ * TCP state (smoothed RTT, congestion window times MSS per RTT) and, where TCP_INFO
+ * is not available, from how long queued output takes to drain to the socket.
+ * Request-driven downloads get chunks of about twice the BDP, so the client's round
+ * trip per chunk does not idle the link; streaming downloads keep about twice the
+ * BDP queued, split into four chunks. Fast clients are fed more per chunk, slow ones
+ * do not pile up output on the server. Until a first measurement, the client's
+ * reported network type decides.
+ *
+ * Used in the loop thread of the connection only.
+ */
+class DownloadPacer final
+{
+public:
+    DownloadPacer();
+
+    /**
+     * @brief Start over for a new transfer
+     * @param clientNetType Network type reported by the client, the first guess
+     */
+    void reset(int32_t clientNetType);
+
+    /**
+     * @brief Re-estimate the connection speed from TCP_INFO, at most every 100 ms
+     * @param conn The connection the download runs on
+     */
+    void update(const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Note output queued on the connection, times the drain when output was empty
+     * @param bytes Bytes queued
+     * @param outputWasEmpty Whether no output was pending before
+     */
+    void onQueued(int64_t bytes, bool outputWasEmpty);
+
+    /**
+     * @brief Note that the connection's output drained, from the write-complete callback
+     */
+    void onDrained();
+
+    /** @brief Chunk size for a request-driven download */
+    int64_t chunkSize() const { return m_chunkSize; }
+
+    /** @brief Chunk size for a streaming download */
+    int64_t streamChunkSize() const { return m_streamChunkSize; }
+
+    /** @brief Pending output a streaming download keeps queued */
+    int64_t streamWindow() const { return m_streamWindow; }
+
+    /** @brief Smoothed RTT in microseconds, 0 if not measured */
+    int64_t rttUs() const { return m_rttUs; }
+
+    /** @brief Estimated rate in bytes per second, 0 if not measured */
+    double rate() const { return m_tcpRate > 0 ? m_tcpRate : m_drainRate; }
+
+private:
+    /**
+     * @brief Derive the sizes from the current estimates
+     */
+    void resize();
+
+private:
+    int64_t m_rttUs;           /**< Smoothed RTT from TCP_INFO in microseconds */
+    double m_tcpRate;          /**< Congestion window per RTT in bytes per second */
+    double m_drainRate;        /**< Average drain rate of queued output in bytes per second */
+    int64_t m_lastUpdate;      /**< Monotonic time in microseconds of the last TCP_INFO read */
+    int64_t m_drainStart;      /**< Monotonic time in microseconds output started pending, 0 if empty */
+    int64_t m_drainBytes;      /**< Bytes queued since m_drainStart */
+    int64_t m_chunkSize;       /**< Request-driven chunk size */
+    int64_t m_streamChunkSize; /**< Streaming chunk size */
+    int64_t m_streamWindow;    /**< Streaming window */
+};
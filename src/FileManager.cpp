@@ -6,14 +6,95 @@
 #include "FileManager.h"
 
 #include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "../base/AsyncLog.h"
 #include "../base/Platform.h"
 
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+/**
+ * @brief How long a failed lookup is trusted before the disk is asked again (ms)
+ */
+#define NEGATIVE_CACHE_TTL_MS 1000
+
+/**
+ * @brief Maximum negative cache entries per shard
+ */
+#define NEGATIVE_CACHE_MAX_PER_SHARD 1024
+
+/**
+ * @brief Directory holding the index snapshot, inside the base directory
+ *
+ * Names starting with '.' are never indexed. Writing the snapshot inside its own
+ * directory leaves the base directory mtime untouched, which the scan relies on.
+ */
+#define FILE_INDEX_DIR ".fileindex/"
+
+/**
+ * @brief Directory uploads are written to until they are verified, inside the base directory
+ *
+ * Like FILE_INDEX_DIR it is never indexed, so an upload is not visible before it is complete.
+ */
+#define FILE_UPLOAD_DIR ".upload/"
+
+/**
+ * @brief Index snapshot file name inside FILE_INDEX_DIR
+ */
+#define FILE_INDEX_SNAPSHOT "snapshot"
+
+/**
+ * @brief Snapshot format version, bump when the layout below changes
+ */
+#define FILE_INDEX_VERSION 2
+
+/**
+ * @brief Maximum fan-out levels, each level is 2 hex chars of the md5
+ */
+#define MAX_FILE_CACHE_FANOUT 2
+
+/**
+ * @brief Maximum length of a file name, leaves room for longer digests than md5
+ */
+#define MAX_FILE_NAME_LENGTH 64
+
+/*
+ * Snapshot layout, native byte order:
+ *   header:  char magic[4] "FIDX", uint32 version, uint32 fanout, uint32 dir count, uint64 entry count
+ *   dirs:    uint16 path length, int64 mtime, path bytes (relative to the base path)
+ *   entries: uint16 name length, int64 size, int64 mtime, name bytes
+ */
+static const char kSnapshotMagic[4] = {'F', 'I', 'D', 'X'};
+static const size_t kSnapshotCountOffset = 4 + 3 * sizeof(uint32_t);
+static const size_t kSnapshotHeaderSize = kSnapshotCountOffset + sizeof(uint64_t);
+static const size_t kSnapshotEntryFixedSize = sizeof(uint16_t) + sizeof(int64_t) + sizeof(int64_t);
+
+/**
+ * @brief Modification time of a stat result in nanoseconds
+ */
+static int64_t mtimeOf(const struct stat &filestat)
+{
+#ifdef WIN32
+    return static_cast<int64_t>(filestat.st_mtime) * 1000000000LL;
+#else
+    return static_cast<int64_t>(filestat.st_mtim.tv_sec) * 1000000000LL + filestat.st_mtim.tv_nsec;
+#endif
+}
+
 /**
  * @brief Default constructor
  */
-FileManager::FileManager()
+FileManager::FileManager() : m_scanThreads(4),
+                             m_generation(1),
+                             m_stop(false),
+                             m_scanCompleted(false),
+                             m_dirty(false),
+                             m_hasSnapshot(false),
+                             m_fanout(0)
 {
 }
 
@@ -22,20 +103,29 @@ FileManager::FileManager()
  */
 FileManager::~FileManager()
 {
+    m_stop = true;
+    if (m_scanThread.joinable())
+        m_scanThread.join();
 }
 
 /**
  * @brief Initialize the file manager with a base path
  *
- * Creates the base directory if it doesn't exist and loads existing files
- * into the file list on non-Windows platforms.
+ * Creates the base directory if it doesn't exist. On non-Windows platforms the
+ * index snapshot of the previous run is loaded and a background thread reconciles
+ * it with the directory, so the server can accept connections right away; lookups
+ * of files not yet indexed fall back to the file system meanwhile.
  *
  * @param basepath The base directory path for file operations
+ * @param scanThreads Number of threads used to stat new files during the scan
+ * @param fanout Subdirectory levels of the cache layout, clamped to [0, MAX_FILE_CACHE_FANOUT]
  * @return true if initialization succeeds, false otherwise
  */
-bool FileManager::init(const char *basepath)
+bool FileManager::init(const char *basepath, int scanThreads, int fanout)
 {
     m_basepath = basepath;
+    m_scanThreads = scanThreads > 0 ? scanThreads : 1;
+    m_fanout = fanout < 0 ? 0 : (fanout > MAX_FILE_CACHE_FANOUT ? MAX_FILE_CACHE_FANOUT : fanout);
 
 #ifdef WIN32
     // Create directory on Windows if it doesn't exist
@@ -50,6 +140,7 @@ bool FileManager::init(const char *basepath)
         }
     }
 
+    CreateDirectoryA((m_basepath + FILE_UPLOAD_DIR).c_str(), NULL);
     return true;
 #else
     DIR *dp = opendir(basepath);
@@ -57,79 +148,660 @@ bool FileManager::init(const char *basepath)
     {
         LOGE("open base dir error, errno: %d, %s", errno, strerror(errno));
 
-        if (mkdir(basepath, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == 0)
-            return true;
+        // A fresh cache directory still needs its subdirectories, index and scan below
+        if (mkdir(basepath, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0)
+        {
+            LOGE("create base dir error, %s , errno: %d, %s", basepath, errno, strerror(errno));
+            return false;
+        }
+    }
+    else
+    {
+        closedir(dp);
+    }
 
-        LOGE("create base dir error, %s , errno: %d, %s", basepath, errno, strerror(errno));
+    std::string indexdir = m_basepath + FILE_INDEX_DIR;
+    if (mkdir(indexdir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+        LOGE("create file index dir error, %s, errno: %d, %s", indexdir.c_str(), errno, strerror(errno));
 
-        return false;
-    }
+    // Uploads cannot be resumed by a new connection, what a previous run left is dropped
+    std::string uploaddir = m_basepath + FILE_UPLOAD_DIR;
+    if (mkdir(uploaddir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+        LOGE("create file upload dir error, %s, errno: %d, %s", uploaddir.c_str(), errno, strerror(errno));
 
-    struct dirent *dirp;
-    // struct stat filestat;
-    while ((dirp = readdir(dp)) != NULL)
+    dp = opendir(uploaddir.c_str());
+    if (dp != NULL)
     {
-        if (strcmp(dirp->d_name, ".") == 0 || strcmp(dirp->d_name, "..") == 0)
-            continue;
-
-        // if (stat(dirp->d_name, &filestat) != 0)
-        //{
-        //     LOGW << "stat filename: [" << dirp->d_name << "] error, errno: " << errno << ", " << strerror(errno);
-        //     continue;
-        // }
+        struct dirent *dirp;
+        while ((dirp = readdir(dp)) != NULL)
+        {
+            if (dirp->d_name[0] != '.')
+                unlink((uploaddir + dirp->d_name).c_str());
+        }
 
-        m_listFiles.emplace_back(dirp->d_name);
-        LOGI("filename: %s", dirp->d_name);
+        closedir(dp);
     }
 
-    closedir(dp);
+    m_hasSnapshot = loadSnapshot();
+    m_scanThread = std::thread(&FileManager::scan, this);
 #endif
 
     return true;
 }
 
+/**
+ * @brief Stop the background scan and persist the index snapshot
+ *
+ * The snapshot is only written when the last scan completed, an interrupted
+ * scan leaves the previous snapshot in place.
+ */
+void FileManager::uninit()
+{
+    m_stop = true;
+    if (m_scanThread.joinable())
+        m_scanThread.join();
+
+    if (m_scanCompleted && m_dirty)
+        saveSnapshot();
+}
+
 /**
  * @brief Check if a file exists
  *
- * First checks the cached file list, then checks the file system if not found in cache.
- * If found in the file system but not in cache, adds the file to the cache.
+ * First checks the file index, then the negative cache, and only then the file system.
+ * If found in the file system but not in the index, adds the file to the index;
+ * if not found, remembers the miss for NEGATIVE_CACHE_TTL_MS.
  *
  * @param filename The name of the file to check
  * @return true if the file exists, false otherwise
  */
 bool FileManager::isFileExsit(const char *filename)
 {
-    std::lock_guard<std::mutex> guard(m_mtFile);
-    // First check the cache
-    for (const auto &iter : m_listFiles)
+    std::string name(filename);
+    Shard &shard = shardFor(name);
+
     {
-        if (iter == filename)
+        std::lock_guard<std::mutex> guard(shard.mtx);
+        // First check the index
+        if (shard.files.count(name) > 0)
             return true;
+
+        // Then check recent misses
+        auto iter = shard.missing.find(name);
+        if (iter != shard.missing.end())
+        {
+            if (Clock::now() < iter->second)
+                return false;
+
+            shard.missing.erase(iter);
+        }
     }
 
-    // Then check the file system
-    std::string filepath = m_basepath;
-    filepath += filename;
-    FILE *fp = fopen(filepath.c_str(), "r");
-    if (fp != NULL)
+    // Then check the file system, without holding the shard lock; the file may not be migrated yet
+    struct stat filestat;
+    if (stat(getFilePath(name).c_str(), &filestat) == 0 ||
+        (m_fanout > 0 && stat(getFilePath(name, true).c_str(), &filestat) == 0))
     {
-        fclose(fp);
-        m_listFiles.emplace_back(filename);
+        addIndexed(name, filestat);
         return true;
     }
 
+    std::lock_guard<std::mutex> guard(shard.mtx);
+    // Added by another thread while we were on the disk
+    if (shard.files.count(name) > 0)
+        return true;
+
+    addMissing(shard, name);
     return false;
 }
 
 /**
- * @brief Add a file to the managed file list
+ * @brief Add a file to the managed file index
  *
- * Thread-safe method to add a filename to the internal cache.
+ * Thread-safe method to add a filename to the internal index,
+ * dropping any cached miss for it.
  *
  * @param filename The name of the file to add
  */
 void FileManager::addFile(const char *filename)
 {
-    std::lock_guard<std::mutex> guard(m_mtFile);
-    m_listFiles.emplace_back(filename);
+    std::string name(filename);
+    std::string filepath = getFilePath(name);
+
+    struct stat filestat;
+    if (stat(filepath.c_str(), &filestat) != 0)
+    {
+        LOGE("stat file error, %s, errno: %d, %s", filepath.c_str(), errno, strerror(errno));
+        return;
+    }
+
+    addIndexed(name, filestat);
+}
+
+std::string FileManager::getFilePath(const std::string &filename, bool flat) const
+{
+    if (flat)
+        return m_basepath + filename;
+
+    return m_basepath + relativeDir(filename) + filename;
+}
+
+std::string FileManager::getUploadPath(const std::string &filename) const
+{
+    return m_basepath + FILE_UPLOAD_DIR + filename;
+}
+
+bool FileManager::commitUpload(const std::string &filename)
+{
+    if (!prepareFilePath(filename))
+        return false;
+
+    std::string uploadpath = getUploadPath(filename);
+    std::string filepath = getFilePath(filename);
+    if (rename(uploadpath.c_str(), filepath.c_str()) != 0)
+    {
+        LOGE("commit upload error, %s -> %s, errno: %d, %s", uploadpath.c_str(), filepath.c_str(), errno, strerror(errno));
+        return false;
+    }
+
+    addFile(filename.c_str());
+    return true;
+}
+
+bool FileManager::prepareFilePath(const std::string &filename) const
+{
+    // Each level is "xx/"
+    std::string dir = m_basepath;
+    std::string relDir = relativeDir(filename);
+    for (size_t i = 0; i < relDir.size(); i += 3)
+    {
+        dir.append(relDir, i, 3);
+#ifdef WIN32
+        if (!CreateDirectoryA(dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+        {
+            LOGE("create file cache dir error, %s", dir.c_str());
+            return false;
+        }
+#else
+        if (mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+        {
+            LOGE("create file cache dir error, %s, errno: %d, %s", dir.c_str(), errno, strerror(errno));
+            return false;
+        }
+#endif
+    }
+
+    return true;
+}
+
+bool FileManager::isValidFileName(const std::string &filename)
+{
+    if (filename.empty() || filename.size() > MAX_FILE_NAME_LENGTH)
+        return false;
+
+    for (size_t i = 0; i < filename.size(); ++i)
+    {
+        if (!isxdigit(static_cast<unsigned char>(filename[i])))
+            return false;
+    }
+
+    return true;
+}
+
+std::string FileManager::relativeDir(const std::string &filename) const
+{
+    std::string relDir;
+    if (m_fanout == 0 || filename.size() <= static_cast<size_t>(2 * m_fanout) || !isValidFileName(filename))
+        return relDir;
+
+    for (int i = 0; i < m_fanout; ++i)
+    {
+        relDir.append(filename, 2 * i, 2);
+        relDir += '/';
+    }
+
+    return relDir;
+}
+
+FileManager::Shard &FileManager::shardFor(const std::string &filename)
+{
+    return m_shards[std::hash<std::string>()(filename) & (kShardCount - 1)];
+}
+
+void FileManager::addMissing(Shard &shard, const std::string &filename)
+{
+    Clock::time_point now = Clock::now();
+    if (shard.missing.size() >= NEGATIVE_CACHE_MAX_PER_SHARD)
+    {
+        // Drop expired entries first; if the shard is still full, start over
+        for (auto iter = shard.missing.begin(); iter != shard.missing.end();)
+        {
+            if (iter->second <= now)
+                iter = shard.missing.erase(iter);
+            else
+                ++iter;
+        }
+
+        if (shard.missing.size() >= NEGATIVE_CACHE_MAX_PER_SHARD)
+            shard.missing.clear();
+    }
+
+    shard.missing[filename] = now + std::chrono::milliseconds(NEGATIVE_CACHE_TTL_MS);
+}
+
+void FileManager::addIndexed(const std::string &filename, const struct stat &filestat)
+{
+    FileInfo info;
+    info.size = filestat.st_size;
+    info.mtime = mtimeOf(filestat);
+    info.generation = m_generation;
+
+    Shard &shard = shardFor(filename);
+    {
+        std::lock_guard<std::mutex> guard(shard.mtx);
+        shard.files[filename] = info;
+        shard.missing.erase(filename);
+    }
+
+    m_dirty = true;
+}
+
+bool FileManager::loadSnapshot()
+{
+#ifdef WIN32
+    return false;
+#else
+    std::string filepath = m_basepath + FILE_INDEX_DIR FILE_INDEX_SNAPSHOT;
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOGI("no file index snapshot at %s, full scan needed", filepath.c_str());
+        return false;
+    }
+
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0 || static_cast<size_t>(filestat.st_size) < kSnapshotHeaderSize)
+    {
+        LOGE("invalid file index snapshot %s", filepath.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    size_t length = static_cast<size_t>(filestat.st_size);
+    void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        LOGE("mmap file index snapshot error, %s, errno: %d, %s", filepath.c_str(), errno, strerror(errno));
+        return false;
+    }
+
+    madvise(mapped, length, MADV_SEQUENTIAL);
+
+    const char *data = static_cast<const char *>(mapped);
+    const char *end = data + length;
+    uint32_t version;
+    uint32_t fanout;
+    uint32_t dircount;
+    uint64_t count;
+    memcpy(&version, data + 4, sizeof(version));
+    memcpy(&fanout, data + 4 + sizeof(version), sizeof(fanout));
+    memcpy(&dircount, data + 4 + 2 * sizeof(uint32_t), sizeof(dircount));
+    memcpy(&count, data + kSnapshotCountOffset, sizeof(count));
+    if (memcmp(data, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 || version != FILE_INDEX_VERSION)
+    {
+        LOGE("file index snapshot %s has unknown format, ignored", filepath.c_str());
+        munmap(mapped, length);
+        return false;
+    }
+
+    // Directory and entry records share the same fixed part
+    const char *p = data + kSnapshotHeaderSize;
+    std::map<std::string, int64_t> dirMtimes;
+    uint32_t dirsLoaded = 0;
+    while (dirsLoaded < dircount && p + kSnapshotEntryFixedSize <= end)
+    {
+        uint16_t pathlength;
+        int64_t mtime;
+        memcpy(&pathlength, p, sizeof(pathlength));
+        memcpy(&mtime, p + sizeof(pathlength) + sizeof(int64_t), sizeof(mtime));
+        p += kSnapshotEntryFixedSize;
+        if (p + pathlength > end)
+            break;
+
+        dirMtimes[std::string(p, pathlength)] = mtime;
+        p += pathlength;
+        ++dirsLoaded;
+    }
+
+    // Snapshot entries are generation 0, the scan marks the ones still on disk
+    uint64_t loaded = 0;
+    while (dirsLoaded == dircount && loaded < count && p + kSnapshotEntryFixedSize <= end)
+    {
+        uint16_t namelength;
+        FileInfo info;
+        memcpy(&namelength, p, sizeof(namelength));
+        memcpy(&info.size, p + sizeof(namelength), sizeof(info.size));
+        memcpy(&info.mtime, p + sizeof(namelength) + sizeof(info.size), sizeof(info.mtime));
+        p += kSnapshotEntryFixedSize;
+        if (p + namelength > end)
+            break;
+
+        info.generation = 0;
+        std::string filename(p, namelength);
+        p += namelength;
+
+        shardFor(filename).files[filename] = info;
+        ++loaded;
+    }
+
+    munmap(mapped, length);
+
+    if (dirsLoaded != dircount || loaded != count)
+    {
+        LOGE("file index snapshot %s truncated, %llu of %llu entries loaded", filepath.c_str(),
+             (unsigned long long)loaded, (unsigned long long)count);
+        return false;
+    }
+
+    // Directory mtimes of another layout say nothing about this one, every directory is read
+    if (fanout == static_cast<uint32_t>(m_fanout))
+        m_snapshotDirMtimes.swap(dirMtimes);
+    else
+        LOGI("file cache fanout changed from %u to %d, full scan needed", fanout, m_fanout);
+
+    LOGI("%llu files loaded from file index snapshot %s", (unsigned long long)loaded, filepath.c_str());
+    return true;
+#endif
+}
+
+bool FileManager::saveSnapshot()
+{
+#ifdef WIN32
+    return false;
+#else
+    std::string filepath = m_basepath + FILE_INDEX_DIR FILE_INDEX_SNAPSHOT;
+    std::string tmppath = filepath + ".tmp";
+    FILE *fp = fopen(tmppath.c_str(), "wb");
+    if (fp == NULL)
+    {
+        LOGE("create file index snapshot error, %s, errno: %d, %s", tmppath.c_str(), errno, strerror(errno));
+        return false;
+    }
+
+    m_dirty = false;
+
+    // Entry count is patched in once all shards are written
+    std::string buffer;
+    uint64_t count = 0;
+    uint32_t version = FILE_INDEX_VERSION;
+    uint32_t fanout = static_cast<uint32_t>(m_fanout);
+    uint32_t dircount = static_cast<uint32_t>(m_scanDirMtimes.size());
+    buffer.append(kSnapshotMagic, sizeof(kSnapshotMagic));
+    buffer.append(reinterpret_cast<const char *>(&version), sizeof(version));
+    buffer.append(reinterpret_cast<const char *>(&fanout), sizeof(fanout));
+    buffer.append(reinterpret_cast<const char *>(&dircount), sizeof(dircount));
+    buffer.append(reinterpret_cast<const char *>(&count), sizeof(count));
+
+    // A directory record has the entry layout with a zero size
+    for (const auto &iter : m_scanDirMtimes)
+    {
+        uint16_t pathlength = static_cast<uint16_t>(iter.first.size());
+        int64_t size = 0;
+        buffer.append(reinterpret_cast<const char *>(&pathlength), sizeof(pathlength));
+        buffer.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        buffer.append(reinterpret_cast<const char *>(&iter.second), sizeof(iter.second));
+        buffer.append(iter.first.data(), pathlength);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < kShardCount && ok; ++i)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_shards[i].mtx);
+            for (const auto &iter : m_shards[i].files)
+            {
+                uint16_t namelength = static_cast<uint16_t>(iter.first.size());
+                buffer.append(reinterpret_cast<const char *>(&namelength), sizeof(namelength));
+                buffer.append(reinterpret_cast<const char *>(&iter.second.size), sizeof(iter.second.size));
+                buffer.append(reinterpret_cast<const char *>(&iter.second.mtime), sizeof(iter.second.mtime));
+                buffer.append(iter.first.data(), namelength);
+                ++count;
+            }
+        }
+
+        ok = fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+        buffer.clear();
+    }
+
+    if (ok)
+        ok = fseek(fp, kSnapshotCountOffset, SEEK_SET) == 0 &&
+             fwrite(&count, sizeof(count), 1, fp) == 1;
+
+    if (fclose(fp) != 0)
+        ok = false;
+
+    if (!ok || rename(tmppath.c_str(), filepath.c_str()) != 0)
+    {
+        LOGE("write file index snapshot error, %s, errno: %d, %s", filepath.c_str(), errno, strerror(errno));
+        unlink(tmppath.c_str());
+        m_dirty = true;
+        return false;
+    }
+
+    LOGI("%llu files saved to file index snapshot %s", (unsigned long long)count, filepath.c_str());
+    return true;
+#endif
+}
+
+/**
+ * @brief Reconcile the index with the base directory
+ *
+ * Files are only ever created or removed in the leaf directories of the layout, so
+ * a leaf whose mtime matches the snapshot is skipped together with its entries.
+ * In the directories read, names already indexed are just marked as seen, files
+ * outside their fan-out directory are moved into it, new names are stat'ed in
+ * parallel, and snapshot entries the directories no longer hold are dropped.
+ */
+void FileManager::scan()
+{
+#ifndef WIN32
+    Clock::time_point start = Clock::now();
+
+    ScanState state;
+    state.generation = m_generation;
+    state.seen = 0;
+    state.migrated = 0;
+    scanDir("", 0, state);
+    if (m_stop)
+        return;
+
+    statFiles(state.newFiles);
+    if (m_stop)
+        return;
+
+    size_t removed = 0;
+    for (size_t i = 0; i < kShardCount; ++i)
+    {
+        std::lock_guard<std::mutex> guard(m_shards[i].mtx);
+        for (auto iter = m_shards[i].files.begin(); iter != m_shards[i].files.end();)
+        {
+            if (iter->second.generation == state.generation)
+            {
+                ++iter;
+            }
+            else if (state.unchangedDirs.count(relativeDir(iter->first)) > 0)
+            {
+                iter->second.generation = state.generation;
+                ++iter;
+            }
+            else
+            {
+                iter = m_shards[i].files.erase(iter);
+                ++removed;
+            }
+        }
+    }
+
+    bool changed = !state.newFiles.empty() || removed > 0 || state.migrated > 0 || state.dirMtimes != m_snapshotDirMtimes;
+    m_scanDirMtimes.swap(state.dirMtimes);
+    m_scanCompleted = true;
+
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    LOGI("file cache dir %s scanned in %lld ms, dirs: %zu, unchanged dirs: %zu, files read: %zu, new: %zu, removed: %zu, migrated: %zu",
+         m_basepath.c_str(), (long long)elapsed, m_scanDirMtimes.size(), state.unchangedDirs.size(),
+         state.seen, state.newFiles.size(), removed, state.migrated);
+
+    if (changed)
+        saveSnapshot();
+#endif
+}
+
+void FileManager::scanDir(const std::string &relDir, int depth, ScanState &state)
+{
+#ifndef WIN32
+    std::string dirpath = m_basepath + relDir;
+
+    // Taken before reading so changes made during the scan are caught next time
+    struct stat dirstat;
+    if (stat(dirpath.c_str(), &dirstat) != 0)
+    {
+        LOGE("stat file cache dir error, %s, errno: %d, %s", dirpath.c_str(), errno, strerror(errno));
+        return;
+    }
+
+    int64_t dirMtime = mtimeOf(dirstat);
+    state.dirMtimes[relDir] = dirMtime;
+
+    if (depth == m_fanout)
+    {
+        auto iter = m_snapshotDirMtimes.find(relDir);
+        if (iter != m_snapshotDirMtimes.end() && iter->second == dirMtime)
+        {
+            state.unchangedDirs.insert(relDir);
+            return;
+        }
+    }
+
+    DIR *dp = opendir(dirpath.c_str());
+    if (dp == NULL)
+    {
+        LOGE("open file cache dir error, %s, errno: %d, %s", dirpath.c_str(), errno, strerror(errno));
+        return;
+    }
+
+    std::vector<std::string> subdirs;
+    struct dirent *dirp;
+    while (!m_stop && (dirp = readdir(dp)) != NULL)
+    {
+        // Skips ".", ".." and the snapshot directory
+        if (dirp->d_name[0] == '.')
+            continue;
+
+        std::string filename(dirp->d_name);
+        bool isdir = dirp->d_type == DT_DIR;
+        if (dirp->d_type == DT_UNKNOWN)
+        {
+            struct stat filestat;
+            isdir = stat((dirpath + filename).c_str(), &filestat) == 0 && S_ISDIR(filestat.st_mode);
+        }
+
+        if (isdir)
+        {
+            // Only fan-out directories belong to the layout, the ones below the
+            // leaves are left from a larger fan-out and their files move up
+            if (depth < MAX_FILE_CACHE_FANOUT && filename.size() == 2 && isValidFileName(filename))
+                subdirs.push_back(filename);
+
+            continue;
+        }
+
+        if (relativeDir(filename) != relDir && migrateFile(relDir, filename))
+            ++state.migrated;
+
+        ++state.seen;
+        Shard &shard = shardFor(filename);
+        {
+            std::lock_guard<std::mutex> guard(shard.mtx);
+            auto iter = shard.files.find(filename);
+            if (iter != shard.files.end())
+            {
+                iter->second.generation = state.generation;
+                continue;
+            }
+        }
+
+        state.newFiles.push_back(filename);
+    }
+
+    closedir(dp);
+
+    // Recurse once the directory is closed, so only one is open at a time
+    for (const auto &subdir : subdirs)
+    {
+        if (m_stop)
+            break;
+
+        scanDir(relDir + subdir + "/", depth + 1, state);
+    }
+#endif
+}
+
+bool FileManager::migrateFile(const std::string &relDir, const std::string &filename)
+{
+    // Files a flat cache holds with other names stay where they are, lookups find them there
+    if (!isValidFileName(filename) || !prepareFilePath(filename))
+        return false;
+
+    std::string oldpath = m_basepath + relDir + filename;
+    std::string newpath = getFilePath(filename);
+    // Open descriptors keep working across the rename, a concurrent open retries the other path
+    if (rename(oldpath.c_str(), newpath.c_str()) != 0)
+    {
+        LOGE("migrate file error, %s -> %s, errno: %d, %s", oldpath.c_str(), newpath.c_str(), errno, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+void FileManager::statFiles(const std::vector<std::string> &filenames)
+{
+    if (filenames.empty())
+        return;
+
+    auto worker = [this, &filenames](size_t begin, size_t end)
+    {
+        struct stat filestat;
+        for (size_t i = begin; i < end && !m_stop; ++i)
+        {
+            // Removed since readdir, or not a regular file
+            const std::string &filename = filenames[i];
+            if ((stat(getFilePath(filename).c_str(), &filestat) != 0 &&
+                 stat(getFilePath(filename, true).c_str(), &filestat) != 0) ||
+                !S_ISREG(filestat.st_mode))
+                continue;
+
+            addIndexed(filename, filestat);
+        }
+    };
+
+    size_t threadCount = static_cast<size_t>(m_scanThreads);
+    if (threadCount > filenames.size())
+        threadCount = filenames.size();
+
+    size_t slice = (filenames.size() + threadCount - 1) / threadCount;
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i)
+    {
+        size_t begin = i * slice;
+        size_t end = begin + slice < filenames.size() ? begin + slice : filenames.size();
+        threads.emplace_back(worker, begin, end);
+    }
+
+    // The scan thread takes the first slice itself
+    worker(0, slice < filenames.size() ? slice : filenames.size());
+
+    for (auto &t : threads)
+        t.join();
 }
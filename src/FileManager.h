@@ -4,15 +4,37 @@
  *  Date: 2025-05-25
  **/
 #pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <string>
-#include <list>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
 #include <mutex>
+#include <chrono>
+#include <thread>
+#include <atomic>
 
 /**
  * @class FileManager
- * @brief Manages file operations and maintains a list of uploaded files
+ * @brief Manages file operations and maintains an index of uploaded files
  *
  * This class handles file existence checking and registration of new files.
+ * The index is split into shards by name hash, each with its own lock, so
+ * lookups from different IO threads rarely contend. Recent misses are cached
+ * per shard for a short time so repeated lookups of absent files stay off the disk.
+ *
+ * The index is persisted to a snapshot in the base directory, so a restart only
+ * reconciles what changed instead of reading every file name before serving.
+ *
+ * Uploads are written to a directory of their own and only moved into the
+ * cache, and the index, once complete.
+ *
+ * Files can be spread over fan-out subdirectories named by the leading hex chars
+ * of their md5, keeping directories small. The background scan moves files of a
+ * flat cache into that layout while the server keeps serving them.
  * It is designed as a final class that cannot be inherited from.
  */
 class FileManager final
@@ -43,10 +65,21 @@ public:
 
     /**
      * @brief Initialize the file manager with a base path
+     *
+     * Loads the index snapshot and starts the background scan that reconciles
+     * it with the directory; lookups are served while the scan runs.
+     *
      * @param basepath The base directory path for file operations
+     * @param scanThreads Number of threads used to stat new files during the scan
+     * @param fanout Subdirectory levels of the cache layout, each named by 2 hex chars of the md5
      * @return true if initialization succeeds, false otherwise
      */
-    bool init(const char *basepath);
+    bool init(const char *basepath, int scanThreads = 4, int fanout = 0);
+
+    /**
+     * @brief Stop the background scan and persist the index snapshot
+     */
+    void uninit();
 
     /**
      * @brief Check if a file exists
@@ -61,9 +94,177 @@ public:
      */
     void addFile(const char *filename);
 
+    /**
+     * @brief Get the path a file is stored at
+     *
+     * With fan-out, "0123abcd..." is stored as "01/23/0123abcd..." under the base path
+     * for a fan-out of 2. Files of a flat cache not migrated yet are at the flat path.
+     *
+     * @param filename The name of the file
+     * @param flat Whether to return the flat path instead of the fan-out one
+     * @return The full path of the file
+     */
+    std::string getFilePath(const std::string &filename, bool flat = false) const;
+
+    /**
+     * @brief Get the path a file is written to while it is uploaded
+     *
+     * Files there are not indexed and cannot be downloaded.
+     *
+     * @param filename The name of the file
+     * @return The full path of the upload file
+     */
+    std::string getUploadPath(const std::string &filename) const;
+
+    /**
+     * @brief Move a complete upload to its path and add it to the index
+     * @param filename The name of the file
+     * @return true if the file was moved, false otherwise
+     */
+    bool commitUpload(const std::string &filename);
+
+    /**
+     * @brief Create the fan-out directories a new file is stored in
+     * @param filename The name of the file
+     * @return true if the directories exist, false otherwise
+     */
+    bool prepareFilePath(const std::string &filename) const;
+
+    /**
+     * @brief Check that a client supplied file name is an md5 hex string
+     *
+     * Anything else could escape the cache directory or clash with the index files.
+     *
+     * @param filename The name of the file
+     * @return true if the name is valid, false otherwise
+     */
+    static bool isValidFileName(const std::string &filename);
+
+private:
+    /**
+     * @brief Number of index shards, a power of two
+     */
+    static const size_t kShardCount = 64;
+
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @struct FileInfo
+     * @brief Indexed attributes of a file
+     */
+    struct FileInfo
+    {
+        int64_t size;        /**< File size in bytes */
+        int64_t mtime;       /**< Modification time in nanoseconds */
+        uint32_t generation; /**< Scan generation that last saw the file */
+    };
+
+    /**
+     * @struct Shard
+     * @brief One slice of the file index with its own lock
+     */
+    struct Shard
+    {
+        std::mutex mtx;                                             /**< Guards this shard only */
+        std::unordered_map<std::string, FileInfo> files;            /**< Known file names */
+        std::unordered_map<std::string, Clock::time_point> missing; /**< Names known to be absent, with expiry */
+    };
+
+    /**
+     * @brief Select the shard a file name belongs to
+     * @param filename The name of the file
+     * @return Reference to the shard
+     */
+    Shard &shardFor(const std::string &filename);
+
+    /**
+     * @brief Remember that a file name is absent, the caller holds the shard lock
+     * @param shard The shard the name belongs to
+     * @param filename The name of the file
+     */
+    void addMissing(Shard &shard, const std::string &filename);
+
+    /**
+     * @brief Insert or refresh a file in the index from its stat result
+     * @param filename The name of the file
+     * @param filestat The stat result of the file
+     */
+    void addIndexed(const std::string &filename, const struct stat &filestat);
+
+    /**
+     * @brief Load the index snapshot written by a previous run
+     * @return true if a valid snapshot was loaded, false otherwise
+     */
+    bool loadSnapshot();
+
+    /**
+     * @brief Write the index to the snapshot file
+     * @return true if the snapshot was written, false otherwise
+     */
+    bool saveSnapshot();
+
+    /**
+     * @brief Fan-out directory of a file relative to the base path, "" for the base path itself
+     * @param filename The name of the file
+     * @return The relative directory, ending with '/' unless empty
+     */
+    std::string relativeDir(const std::string &filename) const;
+
+    /**
+     * @brief Reconcile the index with the base directory, runs on the scan thread
+     */
+    void scan();
+
+    /**
+     * @struct ScanState
+     * @brief Bookkeeping of one scan
+     */
+    struct ScanState
+    {
+        uint32_t generation;                      /**< Generation entries seen by the scan are marked with */
+        size_t seen;                              /**< Files found on disk */
+        size_t migrated;                          /**< Files moved into their fan-out directory */
+        std::vector<std::string> newFiles;        /**< Files found on disk but not indexed */
+        std::set<std::string> unchangedDirs;      /**< Leaf directories skipped as unchanged since the snapshot */
+        std::map<std::string, int64_t> dirMtimes; /**< Directory mtimes taken before reading them */
+    };
+
+    /**
+     * @brief Scan one directory of the layout and recurse into its fan-out subdirectories
+     * @param relDir Directory relative to the base path
+     * @param depth Fan-out level of the directory, 0 for the base path
+     * @param state Bookkeeping of the scan
+     */
+    void scanDir(const std::string &relDir, int depth, ScanState &state);
+
+    /**
+     * @brief Move a file into its fan-out directory
+     * @param relDir Directory relative to the base path the file is in now
+     * @param filename The name of the file
+     * @return true if the file was moved, false otherwise
+     */
+    bool migrateFile(const std::string &relDir, const std::string &filename);
+
+    /**
+     * @brief Stat files not yet in the index across the scan threads and index them
+     * @param filenames Names found by the scan but missing from the index
+     */
+    void statFiles(const std::vector<std::string> &filenames);
+
 private:
     // All uploaded files are named by their MD5 hash values
-    std::list<std::string> m_listFiles; /**< List of managed file names */
-    std::mutex m_mtFile;                /**< Mutex for thread-safe file list operations */
-    std::string m_basepath;             /**< Base directory path for file operations */
+    Shard m_shards[kShardCount];         /**< Index of managed file names, sharded by name hash */
+    std::string m_basepath;              /**< Base directory path for file operations */
+
+    // Snapshot and background scan
+    std::thread m_scanThread;            /**< Thread reconciling the index with the directory */
+    int m_scanThreads;                   /**< Threads used to stat new files */
+    std::atomic<uint32_t> m_generation;  /**< Current scan generation, snapshot entries are generation 0 */
+    std::atomic<bool> m_stop;            /**< Asks the scan to stop */
+    std::atomic<bool> m_scanCompleted;   /**< Whether the index matches the directory */
+    std::atomic<bool> m_dirty;           /**< Whether the index changed since the last snapshot */
+    bool m_hasSnapshot;                  /**< Whether a snapshot was loaded at startup */
+    int m_fanout;                        /**< Subdirectory levels of the cache layout */
+    std::map<std::string, int64_t> m_snapshotDirMtimes; /**< Directory mtimes recorded in the loaded snapshot */
+    std::map<std::string, int64_t> m_scanDirMtimes;     /**< Directory mtimes taken during the last completed scan */
 };
\ No newline at end of file
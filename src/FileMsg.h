@@ -13,11 +13,14 @@
  */
 enum file_msg_type
 {
-    file_msg_type_unknown,  // Unknown message type
-    msg_type_upload_req,    // Upload request message
-    msg_type_upload_resp,   // Upload response message
-    msg_type_download_req,  // Download request message
-    msg_type_download_resp, // Download response message
+    file_msg_type_unknown,        // Unknown message type
+    msg_type_upload_req,          // Upload request message
+    msg_type_upload_resp,         // Upload response message
+    msg_type_download_req,        // Download request message
+    msg_type_download_resp,       // Download response message
+    msg_type_download_stream_req, // Streaming download request, the server pushes every chunk
+    msg_type_download_cancel_req, // Cancels an in-progress streaming download
+    msg_type_download_range_req,  // Downloads explicit byte ranges of a file, no session state involved
 };
 
 /**
@@ -25,10 +28,13 @@ enum file_msg_type
  */
 enum file_msg_error_code
 {
-    file_msg_error_unknown,  // Unknown error
-    file_msg_error_progress, // File upload or download in progress
-    file_msg_error_complete, // File upload or download completed
-    file_msg_error_not_exist // File does not exist
+    file_msg_error_unknown,   // Unknown error
+    file_msg_error_progress,  // File upload or download in progress
+    file_msg_error_complete,  // File upload or download completed
+    file_msg_error_not_exist, // File does not exist
+    file_msg_error_cancelled, // Streaming download cancelled by the client
+    file_msg_error_corrupted, // Uploaded content does not match its md5, the upload was dropped
+    file_msg_error_range      // A requested range starts outside the file
 };
 
 /**
@@ -29,8 +29,18 @@ bool FileServer::init(const char *ip, short port, EventLoop *loop, const char *f
     m_server = std::make_unique<TcpServer>(loop, addr, "MYFileServer", TcpServer::kReusePort);
     m_server->setConnectionCallback(std::bind(&FileServer::onConnected, this, std::placeholders::_1));
 
-    // Start listening with 6 threads
-    m_server->start(6);
+    // Start listening with the configured IO threads
+    m_server->setThreadAffinity(m_ioThreadAffinity);
+    m_server->setAcceptMode(m_acceptMode);
+    m_server->setPlacementPolicy(m_placementPolicy);
+    m_server->start(m_ioThreads);
+    Singleton<MetricsRegistry>::Instance().add("fileserver_sessions", "Connected file sessions.", "", &m_sessionGauge);
+    if (m_statsInterval > 0)
+    {
+        loop->runEvery(static_cast<int64_t>(m_statsInterval) * Timestamp::kMicroSecondsPerSecond,
+                       std::bind(&FileServer::logStats, this));
+    }
+
     return true;
 }
 
@@ -45,6 +55,32 @@ void FileServer::uninit()
     }
 }
 
+/**
+ * @brief Sets the IO threads started by init().
+ *
+ * @param threadCount  Number of IO event loops.
+ * @param affinity     How the IO threads are placed on CPUs.
+ */
+void FileServer::setIoThreads(int threadCount, EventLoopThreadPool::AffinityMode affinity)
+{
+    m_ioThreads = threadCount;
+    m_ioThreadAffinity = affinity;
+}
+
+/**
+ * @brief Sets the deadlines applied to connections accepted from now on.
+ *
+ * @param idleSeconds   Idle deadline, 0 disables it.
+ * @param readSeconds   Read-progress deadline, 0 disables it.
+ * @param writeSeconds  Write-progress deadline, 0 disables it.
+ */
+void FileServer::setTimeouts(int idleSeconds, int readSeconds, int writeSeconds)
+{
+    m_idleTimeout = static_cast<int64_t>(idleSeconds) * Timestamp::kMicroSecondsPerSecond;
+    m_readTimeout = static_cast<int64_t>(readSeconds) * Timestamp::kMicroSecondsPerSecond;
+    m_writeTimeout = static_cast<int64_t>(writeSeconds) * Timestamp::kMicroSecondsPerSecond;
+}
+
 /**
  * @brief Called when a new client connection is established or closed.
  *
@@ -61,9 +97,32 @@ void FileServer::onConnected(std::shared_ptr<TcpConnection> conn)
         conn->setMessageCallback(std::bind(&FileSession::onRead, session.get(),
                                            std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 
-        // Store the session safely
-        std::lock_guard<std::mutex> guard(m_sessionMutex);
-        m_sessions.push_back(session);
+        // Write-complete callbacks are queued and may run after the session is gone
+        std::weak_ptr<FileSession> weakSession(session);
+        conn->setWriteCompleteCallback([weakSession](const std::shared_ptr<TcpConnection> &conn)
+                                       {
+                                           conn->resumeRead(TcpConnection::kReadPausedByOutput);
+                                           std::shared_ptr<FileSession> session = weakSession.lock();
+                                           if (session)
+                                               session->onWriteComplete(conn);
+                                       });
+
+        // A client sending requests faster than it reads the responses is not read from
+        // until its output has drained, so the responses do not pile up in memory.
+        // The high water mark callback is queued before the write-complete one that resumes
+        if (m_maxPendingOutput > 0)
+        {
+            conn->setHighWaterMarkCallback([](const std::shared_ptr<TcpConnection> &conn, size_t)
+                                           { conn->pauseRead(TcpConnection::kReadPausedByOutput); },
+                                           m_maxPendingOutput);
+        }
+
+        // Half-open and stalled clients are closed instead of holding the session forever
+        conn->setTimeouts(m_idleTimeout, m_readTimeout, m_writeTimeout);
+
+        // The connection owns its session, so no registry has to be locked or searched
+        conn->setContext(session);
+        ++m_sessionCount;
     }
     else
     {
@@ -73,23 +132,25 @@ void FileServer::onConnected(std::shared_ptr<TcpConnection> conn)
 
 /**
  * @brief Handles logic when a client disconnects.
- *        Removes the corresponding session from the session list.
+ *        Releases the session attached to the connection.
  *
  * @param conn The connection that was closed.
  */
 void FileServer::onDisconnected(const std::shared_ptr<TcpConnection> &conn)
 {
-    std::lock_guard<std::mutex> guard(m_sessionMutex);
-
-    auto it = std::find_if(m_sessions.begin(), m_sessions.end(),
-                           [&conn](const std::shared_ptr<FileSession> &session)
-                           {
-                               return session->getConnectionPtr() == conn;
-                           });
-
-    if (it != m_sessions.end())
+    if (conn->getContext())
     {
         LOGI("Client disconnected: %s", conn->peerAddress().toIpPort().c_str());
-        m_sessions.erase(it);
+        // Pending disk tasks keep the session alive until they are done
+        conn->setContext(std::shared_ptr<void>());
+        --m_sessionCount;
     }
 }
+
+/**
+ * @brief Logs the session count and the load counters of each IO loop.
+ */
+void FileServer::logStats()
+{
+    LOGI("FileServer stats, sessions: %d, IO loops:\n%s", sessionCount(), m_server->loadInfo().c_str());
+}
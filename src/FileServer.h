@@ -6,11 +6,10 @@
  **/
 #pragma once
 #include <memory>
-#include <list>
-#include <map>
-#include <mutex>
+#include <atomic>
 #include "../net/TcpServer.h"
 #include "../net/EventLoop.h"
+#include "../base/Metrics.h"
 #include "FileSession.h"
 
 using namespace net;
@@ -75,6 +74,55 @@ public:
      */
     void uninit();
 
+    /**
+     * @brief Set the deadlines applied to every new connection
+     *
+     * A connection past one of them is closed, which also releases its session
+     * and any file the session holds open. 0 disables a deadline.
+     *
+     * @param idleSeconds No traffic at all for this long
+     * @param readSeconds A partly received package makes no progress for this long
+     * @param writeSeconds Pending output makes no progress for this long
+     */
+    void setTimeouts(int idleSeconds, int readSeconds, int writeSeconds);
+
+    /**
+     * @brief Set how much output a connection may have pending before it is no longer read from
+     * @param bytes High water mark in bytes, reading resumes once the output has drained, 0 disables it
+     */
+    void setMaxPendingOutput(size_t bytes) { m_maxPendingOutput = bytes; }
+
+    /**
+     * @brief Set the IO threads started by init()
+     * @param threadCount Number of IO event loops
+     * @param affinity How the IO threads are placed on CPUs
+     */
+    void setIoThreads(int threadCount, EventLoopThreadPool::AffinityMode affinity);
+
+    /**
+     * @brief Set where init() makes the server accept connections
+     * @param mode Main loop, or a SO_REUSEPORT listener in each IO loop
+     */
+    void setAcceptMode(TcpServer::AcceptMode mode) { m_acceptMode = mode; }
+
+    /**
+     * @brief Set how the main loop spreads new connections over the IO loops
+     * @param policy Round-robin, or by the connection or pending byte counts of the loops
+     */
+    void setPlacementPolicy(EventLoopThreadPool::PlacementPolicy policy) { m_placementPolicy = policy; }
+
+    /**
+     * @brief Set how often the session count and IO loop load are logged
+     * @param seconds Interval in seconds, 0 disables the log
+     */
+    void setStatsInterval(int seconds) { m_statsInterval = seconds; }
+
+    /**
+     * @brief Get the number of live sessions, for statistics
+     * @return Number of connected sessions
+     */
+    int32_t sessionCount() const { return m_sessionCount.load(std::memory_order_relaxed); }
+
 private:
     /**
      * @brief Callback for new connections or disconnections
@@ -93,9 +141,24 @@ private:
      */
     void onDisconnected(const std::shared_ptr<TcpConnection> &conn);
 
+    /**
+     * @brief Log the session count and the load of each IO loop
+     */
+    void logStats();
+
 private:
     std::unique_ptr<TcpServer> m_server;                /**< TCP server instance */
-    std::list<std::shared_ptr<FileSession>> m_sessions; /**< List of active file sessions */
-    std::mutex m_sessionMutex;                          /**< Mutex to protect m_sessions in multi-threaded context */
+    std::atomic<int32_t> m_sessionCount{};              /**< Number of live sessions, each is owned by its connection */
     std::string m_strFileBaseDir;                       /**< Base directory for file storage */
+    int m_ioThreads{6};                                 /**< Number of IO event loops */
+    EventLoopThreadPool::AffinityMode m_ioThreadAffinity{EventLoopThreadPool::kAffinityNone}; /**< CPU placement of IO threads */
+    TcpServer::AcceptMode m_acceptMode{TcpServer::kAcceptInMainLoop}; /**< Where connections are accepted */
+    EventLoopThreadPool::PlacementPolicy m_placementPolicy{EventLoopThreadPool::kPlaceRoundRobin}; /**< How IO loops are picked */
+    int m_statsInterval{};                              /**< Seconds between stats logs, 0 if disabled */
+    int64_t m_idleTimeout{};                            /**< Idle deadline of connections in microseconds */
+    int64_t m_readTimeout{};                            /**< Read-progress deadline of connections in microseconds */
+    int64_t m_writeTimeout{};                           /**< Write-progress deadline of connections in microseconds */
+    size_t m_maxPendingOutput{8 * 1024 * 1024};         /**< Pending output that pauses reading, 0 if disabled */
+    MetricGauge m_sessionGauge{[this]()
+                               { return static_cast<double>(sessionCount()); }}; /**< Exports the session count */
 };
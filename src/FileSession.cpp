@@ -8,12 +8,18 @@
 #include <string.h>
 #include <sstream>
 #include <list>
+#include <vector>
+#include <strings.h>
+#include <atomic>
 #include "../net/TcpConnection.h"
+#include "../net/EventLoop.h"
 #include "../net/ProtocolStream.h"
 #include "../base/AsyncLog.h"
 #include "../base/Singleton.h"
+#include "../base/Metrics.h"
 #include "FileMsg.h"
 #include "FileManager.h"
+#include "DiskExecutor.h"
 
 using namespace net;
 
@@ -22,16 +28,140 @@ using namespace net;
  */
 #define MAX_PACKAGE_SIZE 50 * 1024 * 1024
 
+/**
+ * @brief File data written per slice of a streamed upload package (256KB)
+ *
+ * Upload packages larger than this are written to disk as they arrive instead of
+ * being buffered whole, bounding the input buffer of a connection to about one slice.
+ */
+#define UPLOAD_STREAM_SLICE_SIZE (256 * 1024)
+
+/**
+ * @brief Most ranges one range download request may ask for
+ */
+#define MAX_DOWNLOAD_RANGES 16
+
+/**
+ * @brief File data sent for one range of a range download (16MB)
+ *
+ * Longer ranges are cut short, the client asks for the rest from the offset after
+ * the data it received. Keeps response packages well below MAX_PACKAGE_SIZE.
+ */
+#define MAX_RANGE_LENGTH (16 * 1024 * 1024)
+
+/**
+ * @brief Queued file regions above which no more requests are parsed
+ *
+ * Every queued region keeps a file open until it is sent. A client asking for
+ * many tiny ranges and not reading the responses stays far below the high water
+ * mark of the pending output bytes, so the regions are bounded separately: reading
+ * and parsing pause until the output has drained.
+ */
+#define MAX_PENDING_FILE_REGIONS 64
+
+/**
+ * @brief Source of session IDs, which spread sessions over the disk threads
+ */
+static std::atomic<int32_t> g_nextSessionId(0);
+
+/**
+ * @brief One chunk in this many is traced, 0 disables chunk tracing
+ */
+static int g_chunkLogSampling = 0;
+
+namespace
+{
+    /**
+     * @brief Request counters and transfer latencies of all sessions
+     *
+     * Recorded from the IO loops and the disk threads, exported by the metrics endpoint.
+     */
+    struct SessionMetrics
+    {
+        MetricCounter uploadRequests;
+        MetricCounter downloadRequests;
+        MetricCounter downloadStreamRequests;
+        MetricCounter downloadCancelRequests;
+        MetricCounter downloadRangeRequests;
+        MetricHistogram uploadChunkTime;
+        MetricHistogram downloadChunkTime;
+        MetricHistogram diskWriteTime;
+        MetricHistogram diskReadTime;
+
+        SessionMetrics()
+        {
+            MetricsRegistry &registry = Singleton<MetricsRegistry>::Instance();
+            registry.add("fileserver_requests_total", "File requests received.", "cmd=\"upload\"", &uploadRequests);
+            registry.add("fileserver_requests_total", "File requests received.", "cmd=\"download\"", &downloadRequests);
+            registry.add("fileserver_requests_total", "File requests received.", "cmd=\"download_stream\"", &downloadStreamRequests);
+            registry.add("fileserver_requests_total", "File requests received.", "cmd=\"download_cancel\"", &downloadCancelRequests);
+            registry.add("fileserver_requests_total", "File requests received.", "cmd=\"download_range\"", &downloadRangeRequests);
+            registry.add("fileserver_upload_chunk_seconds", "Time from receiving an upload chunk to answering it, disk I/O included.", "", &uploadChunkTime);
+            registry.add("fileserver_download_chunk_seconds", "Time to handle a download chunk until it is queued for sending.", "", &downloadChunkTime);
+            registry.add("fileserver_disk_write_seconds", "Time of a write or flush of upload data.", "", &diskWriteTime);
+            registry.add("fileserver_disk_read_seconds", "Time of opening a file to download, or of reading a finished upload to verify it.", "", &diskReadTime);
+        }
+    };
+
+    SessionMetrics &sessionMetrics()
+    {
+        static SessionMetrics metrics;
+        return metrics;
+    }
+
+    /**
+     * @brief Opens a file of the cache read-only
+     *
+     * A file of a flat cache may be moved into its fan-out directory at any time,
+     * try the fan-out path, the flat path, then the fan-out path once more.
+     *
+     * @return The descriptor, -1 with errno set if the file can not be opened
+     */
+    int openCachedFile(const std::string &filemd5)
+    {
+        FileManager &fileManager = Singleton<FileManager>::Instance();
+        int fd = -1;
+        for (int i = 0; i < 3 && fd < 0; ++i)
+        {
+            string filename = fileManager.getFilePath(filemd5, i == 1);
+            fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0 && errno != ENOENT)
+                break;
+        }
+        return fd;
+    }
+}
+
 /**
  * @brief Constructor for FileSession
  * @param conn Shared pointer to the TCP connection
  * @param filebasedir Base directory for file operations
  */
 FileSession::FileSession(const std::shared_ptr<TcpConnection> &conn, const char *filebasedir) : TcpSession(conn),
-                                                                                                m_id(0),
+                                                                                                m_id(++g_nextSessionId),
                                                                                                 m_seq(0),
                                                                                                 m_strFileBaseDir(filebasedir),
-                                                                                                m_bFileUploading(false)
+                                                                                                m_bFileUploading(false),
+                                                                                                m_bDownloadStreaming(false),
+                                                                                                m_streamSeq(0),
+                                                                                                m_bUploadStreaming(false),
+                                                                                                m_bUploadDiscard(false),
+                                                                                                m_uploadOffset(0),
+                                                                                                m_uploadFileSize(0),
+                                                                                                m_uploadDataLength(0),
+                                                                                                m_uploadDataRemaining(0),
+                                                                                                m_uploadTrailingRemaining(0),
+                                                                                                m_uploadChunkStart(0),
+                                                                                                m_bDiskPending(false),
+                                                                                                m_uploadHashedLength(0),
+                                                                                                m_bUploadHashSynced(false),
+                                                                                                m_strPeer(conn->peerAddress().toIpPort()),
+                                                                                                m_transferKind(NULL),
+                                                                                                m_transferFileSize(0),
+                                                                                                m_transferBytes(0),
+                                                                                                m_transferStart(0),
+                                                                                                m_chunkCounter(0),
+                                                                                                m_bTraceChunk(false)
 {
 }
 
@@ -40,6 +170,15 @@ FileSession::FileSession(const std::shared_ptr<TcpConnection> &conn, const char
  */
 FileSession::~FileSession()
 {
+    // A connection closed mid-transfer leaves its file open
+    if (m_transferKind != NULL)
+        endTransfer("aborted");
+    resetFile();
+}
+
+void FileSession::setChunkLogSampling(int everyNthChunk)
+{
+    g_chunkLogSampling = everyNthChunk > 0 ? everyNthChunk : 0;
 }
 
 /**
@@ -55,6 +194,35 @@ void FileSession::onRead(const std::shared_ptr<TcpConnection> &conn, ByteBuffer
 {
     while (true)
     {
+        // A disk task owns the file and may still read the buffer, parsing resumes once it is done
+        if (m_bDiskPending)
+            return;
+
+        // Too many files held open by queued output, parsing resumes once it has drained
+        if (conn->pendingFileRegions() > MAX_PENDING_FILE_REGIONS)
+        {
+            conn->pauseRead(TcpConnection::kReadPausedByOutput);
+            return;
+        }
+
+        // The body of a large upload package is being written as it arrives
+        if (m_bUploadStreaming)
+        {
+            if (!consumeUploadStream(conn, pBuffer))
+            {
+                LOGE("Process error, close TcpConnection, client: %s",
+                     conn->peerAddress().toIpPort().c_str());
+                conn->forceClose();
+                return;
+            }
+
+            // Wait for more of the package body or for the disk
+            if (m_bUploadStreaming)
+                return;
+
+            continue;
+        }
+
         // Step 1: Check if buffer contains enough data for a full header
         if (pBuffer->readableBytes() < (size_t)sizeof(file_msg_header))
         {
@@ -80,20 +248,30 @@ void FileSession::onRead(const std::shared_ptr<TcpConnection> &conn, ByteBuffer
         // Step 4: Check if buffer contains the full package (header + body)
         if (pBuffer->readableBytes() < (size_t)header.packagesize + sizeof(file_msg_header))
         {
-            // Not enough data yet for a full package
-            return;
+            // Not enough data yet for a full package, large uploads are written as they arrive
+            bool started = false;
+            if (header.packagesize > UPLOAD_STREAM_SLICE_SIZE && !beginUploadStream(conn, pBuffer, header.packagesize, started))
+            {
+                LOGE("Process error, close TcpConnection, client: %s",
+                     conn->peerAddress().toIpPort().c_str());
+                conn->forceClose();
+                return;
+            }
+
+            if (!started)
+                return;
+
+            continue;
         }
 
-        // Step 5: Extract and process the package
+        // Step 5: Process the package body in place, the buffer is not touched until it returns
         pBuffer->retrieve(sizeof(file_msg_header)); // Discard the header bytes
-        std::string inbuf;
-        inbuf.append(pBuffer->peek(), header.packagesize); // Copy the package body
-        pBuffer->retrieve(header.packagesize);             // Remove the package body from the buffer
+        bool ok = process(conn, pBuffer->peek(), header.packagesize);
+        pBuffer->retrieve(header.packagesize); // Remove the package body from the buffer
 
-        // Step 6: Delegate the message to the business logic processor
-        if (!process(conn, inbuf.c_str(), inbuf.length()))
+        // Step 6: If processing failed, consider the connection compromised or invalid
+        if (!ok)
         {
-            // If processing failed, consider the connection compromised or invalid
             LOGE("Process error, close TcpConnection, client: %s",
                  conn->peerAddress().toIpPort().c_str());
             conn->forceClose();
@@ -107,6 +285,7 @@ void FileSession::onRead(const std::shared_ptr<TcpConnection> &conn, ByteBuffer
  * @brief Process a complete data packet
  *
  * Deserializes the packet data and routes to the appropriate handler based on command type.
+ * The file data is not copied out of inbuf, it is only valid until this returns.
  *
  * @param conn Shared pointer to the TCP connection
  * @param inbuf Input buffer containing the data
@@ -152,24 +331,45 @@ bool FileSession::process(const std::shared_ptr<TcpConnection> &conn, const char
         return false;
     }
 
-    string filedata;
+    const char *filedata;
     size_t filedatalength;
-    if (!readStream.ReadString(&filedata, 0, filedatalength))
+    if (!readStream.ReadCCString(&filedata, 0, filedatalength))
     {
         LOGE("read filedata error, client: %s", conn->peerAddress().toIpPort().c_str());
         return false;
     }
 
-    LOGI("Request from client: cmd: %d, seq: %d, filemd5: %s, md5length: %d, offset: %lld, filesize: %lld, filedata length: %lld, header.packagesize: %lld, client: %s",
-         cmd, m_seq, filemd5.c_str(), md5length, offset, filesize, (int64_t)filedata.length(), (int64_t)length, conn->peerAddress().toIpPort().c_str());
+    // The md5 becomes a path under the cache directory
+    if (!FileManager::isValidFileName(filemd5))
+    {
+        LOGE("invalid filemd5: %s, client: %s", filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
 
-    // LOG_DEBUG_BIN((unsigned char*)filedata.c_str(), filedatalength);
+    m_bTraceChunk = sampleChunk();
+    if (m_bTraceChunk)
+    {
+        LOGI("Request from client: cmd: %d, seq: %d, filemd5: %s, md5length: %d, offset: %lld, filesize: %lld, filedata length: %lld, header.packagesize: %lld, client: %s",
+             cmd, m_seq, filemd5.c_str(), md5length, offset, filesize, (int64_t)filedatalength, (int64_t)length, m_strPeer.c_str());
+    }
+
+    // LOG_DEBUG_BIN((unsigned char*)filedata, filedatalength);
+
+    // While a stream is being pushed the file state belongs to it, only a cancel
+    // and range downloads, which use no session file state, are accepted
+    if (m_bDownloadStreaming && cmd != msg_type_download_cancel_req && cmd != msg_type_download_range_req)
+    {
+        LOGE("cmd %d not allowed during streaming download, filemd5: %s, client: %s",
+             cmd, m_strStreamFileMd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
 
     switch (cmd)
     {
         // client upload file
     case msg_type_upload_req:
-        return onUploadFileResponse(filemd5, offset, filesize, filedata, conn);
+        sessionMetrics().uploadRequests.add();
+        return onUploadFileResponse(filemd5, offset, filesize, filedata, filedatalength, conn);
 
         // client download file
     case msg_type_download_req:
@@ -183,9 +383,66 @@ bool FileSession::process(const std::shared_ptr<TcpConnection> &conn, const char
 
         // if (filedatalength != 0)
         //     return false;
+        sessionMetrics().downloadRequests.add();
         return onDownloadFileResponse(filemd5, clientNetType, conn);
     }
 
+        // client download file, server pushes every chunk
+    case msg_type_download_stream_req:
+    {
+        int32_t clientNetType;
+        if (!readStream.ReadInt32(clientNetType))
+        {
+            LOGE("read clientNetType error, client: %s", conn->peerAddress().toIpPort().c_str());
+            return false;
+        }
+
+        sessionMetrics().downloadStreamRequests.add();
+        return onDownloadStreamRequest(filemd5, clientNetType, conn);
+    }
+
+        // client cancels streaming download
+    case msg_type_download_cancel_req:
+        sessionMetrics().downloadCancelRequests.add();
+        return onDownloadCancelRequest(filemd5, conn);
+
+        // client downloads explicit ranges of a file
+    case msg_type_download_range_req:
+    {
+        int32_t clientNetType;
+        if (!readStream.ReadInt32(clientNetType))
+        {
+            LOGE("read clientNetType error, client: %s", conn->peerAddress().toIpPort().c_str());
+            return false;
+        }
+
+        // The first range travels in the offset and filesize fields, a count and more ranges may follow
+        std::vector<DownloadRange> ranges(1, DownloadRange{offset, filesize});
+        if (!readStream.IsEnd())
+        {
+            int32_t rangeCount;
+            if (!readStream.ReadInt32(rangeCount) || rangeCount < 0 || rangeCount >= MAX_DOWNLOAD_RANGES)
+            {
+                LOGE("read range count error, client: %s", conn->peerAddress().toIpPort().c_str());
+                return false;
+            }
+
+            for (int32_t i = 0; i < rangeCount; ++i)
+            {
+                DownloadRange range;
+                if (!readStream.ReadInt64(range.offset) || !readStream.ReadInt64(range.length))
+                {
+                    LOGE("read range error, client: %s", conn->peerAddress().toIpPort().c_str());
+                    return false;
+                }
+                ranges.push_back(range);
+            }
+        }
+
+        sessionMetrics().downloadRangeRequests.add();
+        return onDownloadRangeRequest(filemd5, clientNetType, ranges, conn);
+    }
+
     default:
         // pBuffer->retrieveAll();
         LOGE("unsupport cmd, cmd: %d, client: %s", cmd, conn->peerAddress().toIpPort().c_str());
@@ -209,13 +466,55 @@ bool FileSession::process(const std::shared_ptr<TcpConnection> &conn, const char
  * @param filemd5   The MD5 hash of the file used as its unique identifier.
  * @param offset    The file write offset indicating where to start writing this chunk.
  * @param filesize  The total expected size of the file.
- * @param filedata  The binary content of the file chunk to be written.
+ * @param filedata  The binary content of the file chunk to be written, pointing into the input buffer.
+ * @param filedatalength The length of the file chunk.
  * @param conn      Shared pointer to the TcpConnection associated with the client.
  * @return true     If the upload chunk is handled successfully.
  * @return false    If any error occurs during the process.
  */
-bool FileSession::onUploadFileResponse(const std::string &filemd5, int64_t offset, int64_t filesize, const std::string &filedata, const std::shared_ptr<TcpConnection> &conn)
+bool FileSession::onUploadFileResponse(const std::string &filemd5, int64_t offset, int64_t filesize, const char *filedata, size_t filedatalength, const std::shared_ptr<TcpConnection> &conn)
 {
+    m_uploadChunkStart = monotonicMicroseconds();
+
+    // filedata stays valid on the disk thread, the input buffer is not read into until it is done
+    submitDiskTask(conn, [this, filemd5, offset, filesize, filedata, filedatalength, conn]()
+                   {
+                       bool complete = false;
+                       if (!beginUploadChunk(filemd5, offset, filesize, complete, conn))
+                           return false;
+
+                       // The file is already on the server, the chunk is dropped
+                       if (complete)
+                           return true;
+
+                       if (!writeUploadChunk(filemd5, filedata, filedatalength, conn))
+                           return false;
+
+                       return finishUploadChunk(filemd5, offset, filesize, static_cast<int64_t>(filedatalength), conn);
+                   });
+
+    return true;
+}
+
+/**
+ * @brief Prepares the file an upload chunk is written to.
+ *
+ * Opens the file for the first chunk (offset 0) and seeks to the chunk offset. If the
+ * file is already on the server and no upload is in progress, the completion response
+ * is sent right away and the chunk data must be dropped by the caller.
+ *
+ * @param filemd5   The MD5 hash of the file.
+ * @param offset    The file write offset of the chunk.
+ * @param filesize  The total expected size of the file.
+ * @param complete  Set to true if the file is already complete on the server.
+ * @param conn      Shared pointer to the TcpConnection associated with the client.
+ * @return true     If the chunk can be written, or is to be dropped.
+ * @return false    If any error occurs.
+ */
+bool FileSession::beginUploadChunk(const std::string &filemd5, int64_t offset, int64_t filesize, bool &complete, const std::shared_ptr<TcpConnection> &conn)
+{
+    complete = false;
+
     // Validate: filemd5 must not be empty
     if (filemd5.empty())
     {
@@ -233,16 +532,19 @@ bool FileSession::onUploadFileResponse(const std::string &filemd5, int64_t offse
 
         LOGI("Response to client: cmd=msg_type_upload_resp, errorcode: file_msg_error_complete, filemd5: %s, offset: %lld, filesize: %lld, client: %s",
              filemd5.c_str(), offset, filesize, conn->peerAddress().toIpPort().c_str());
+        complete = true;
         return true;
     }
 
     // If offset is 0, this is the beginning of the upload
     if (offset == 0)
     {
-        std::string filename = m_strFileBaseDir + filemd5;
+        // Written aside and moved into the cache once verified
+        std::string filename = Singleton<FileManager>::Instance().getUploadPath(filemd5);
 
-        // Open file in binary write mode to prevent newline translation issues on Windows
-        m_fp = fopen(filename.c_str(), "wb");
+        // Open file in binary mode to prevent newline translation issues on Windows,
+        // readable in case the digest has to be computed from the file
+        m_fp = fopen(filename.c_str(), "wb+");
         if (m_fp == nullptr)
         {
             LOGE("fopen file error, filemd5: %s, client: %s", filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
@@ -250,6 +552,10 @@ bool FileSession::onUploadFileResponse(const std::string &filemd5, int64_t offse
         }
 
         m_bFileUploading = true; // Mark file as in-progress
+        beginTransfer("Upload", filemd5, filesize);
+        m_uploadMd5.reset();
+        m_uploadHashedLength = 0;
+        m_bUploadHashSynced = true;
     }
     else
     {
@@ -266,60 +572,363 @@ bool FileSession::onUploadFileResponse(const std::string &filemd5, int64_t offse
     // Move the file pointer to the correct offset
     if (fseek(m_fp, offset, SEEK_SET) == -1)
     {
-        LOGE("fseek error, filemd5: %s, errno: %d, errinfo: %s, filedata.length(): %lld, m_fp: 0x%x, client: %s",
-             filemd5.c_str(), errno, strerror(errno), filedata.length(), m_fp, conn->peerAddress().toIpPort().c_str());
+        LOGE("fseek error, filemd5: %s, errno: %d, errinfo: %s, offset: %lld, m_fp: 0x%x, client: %s",
+             filemd5.c_str(), errno, strerror(errno), offset, m_fp, conn->peerAddress().toIpPort().c_str());
         resetFile();
         return false;
     }
 
+    // Chunks are hashed as they are written while they arrive in order
+    if (offset != m_uploadHashedLength)
+        m_bUploadHashSynced = false;
+
+    return true;
+}
+
+/**
+ * @brief Writes a slice of upload chunk data at the current file position.
+ * @param filemd5   The MD5 hash of the file.
+ * @param filedata  The data to write.
+ * @param filedatalength The length of the data.
+ * @param conn      Shared pointer to the TcpConnection associated with the client.
+ * @return true     If the data was written, false otherwise.
+ */
+bool FileSession::writeUploadChunk(const std::string &filemd5, const char *filedata, size_t filedatalength, const std::shared_ptr<TcpConnection> &conn)
+{
     // Write binary data chunk to file
-    if (fwrite(filedata.c_str(), 1, filedata.length(), m_fp) != filedata.length())
+    int64_t writeStart = monotonicMicroseconds();
+    size_t written = fwrite(filedata, 1, filedatalength, m_fp);
+    sessionMetrics().diskWriteTime.record(monotonicMicroseconds() - writeStart);
+    if (written != filedatalength)
     {
+        LOGE("fwrite error, filemd5: %s, errno: %d, errinfo: %s, filedatalength: %lld, m_fp: 0x%x, client: %s",
+             filemd5.c_str(), errno, strerror(errno), (int64_t)filedatalength, m_fp, conn->peerAddress().toIpPort().c_str());
         resetFile();
-        LOGE("fwrite error, filemd5: %s, errno: %d, errinfo: %s, filedata.length(): %lld, m_fp: 0x%x, client: %s",
-             filemd5.c_str(), errno, strerror(errno), filedata.length(), m_fp, conn->peerAddress().toIpPort().c_str());
         return false;
     }
 
+    m_transferBytes += static_cast<int64_t>(filedatalength);
+    if (m_bUploadHashSynced)
+    {
+        m_uploadMd5.update(filedata, filedatalength);
+        m_uploadHashedLength += static_cast<int64_t>(filedatalength);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Flushes a fully written upload chunk and reports the progress to the client.
+ * @param filemd5   The MD5 hash of the file.
+ * @param offset    The file write offset of the chunk.
+ * @param filesize  The total expected size of the file.
+ * @param filedataLength The length of the chunk.
+ * @param conn      Shared pointer to the TcpConnection associated with the client.
+ * @return true     If the chunk was flushed, false otherwise.
+ */
+bool FileSession::finishUploadChunk(const std::string &filemd5, int64_t offset, int64_t filesize, int64_t filedataLength, const std::shared_ptr<TcpConnection> &conn)
+{
     // Ensure all written data is flushed to disk
-    if (fflush(m_fp) != 0)
+    int64_t flushStart = monotonicMicroseconds();
+    int flushed = fflush(m_fp);
+    sessionMetrics().diskWriteTime.record(monotonicMicroseconds() - flushStart);
+    if (flushed != 0)
     {
-        LOGE("fflush error, filemd5: %s, errno: %d, errinfo: %s, filedata.length(): %lld, m_fp: 0x%x, client: %s",
-             filemd5.c_str(), errno, strerror(errno), filedata.length(), m_fp, conn->peerAddress().toIpPort().c_str());
+        LOGE("fflush error, filemd5: %s, errno: %d, errinfo: %s, filedataLength: %lld, m_fp: 0x%x, client: %s",
+             filemd5.c_str(), errno, strerror(errno), filedataLength, m_fp, conn->peerAddress().toIpPort().c_str());
         return false;
     }
 
     // Determine current upload status
     int32_t errorcode = file_msg_error_progress;
-    int64_t filedataLength = static_cast<int64_t>(filedata.length());
 
     // Check for upload completion
     if (offset + filedataLength == filesize)
     {
+        // A file whose content does not match its md5 never becomes visible
+        if (!verifyUpload(filemd5, conn))
+        {
+            resetFile();
+            remove(Singleton<FileManager>::Instance().getUploadPath(filemd5).c_str());
+
+            std::string dummyfiledata;
+            send(msg_type_upload_resp, m_seq, file_msg_error_corrupted, filemd5, 0, filesize, dummyfiledata);
+
+            LOGE("Response to client: cmd=msg_type_upload_resp, errorcode: file_msg_error_corrupted, filemd5: %s, filesize: %lld, client: %s",
+                 filemd5.c_str(), filesize, conn->peerAddress().toIpPort().c_str());
+            endTransfer("corrupted");
+            return true;
+        }
+
         offset = filesize;
         errorcode = file_msg_error_complete;
-        Singleton<FileManager>::Instance().addFile(filemd5.c_str()); // Mark file as complete
-        resetFile();                                                 // Close and reset file handle
+        resetFile(); // Close and reset file handle
+
+        // Mark file as complete
+        if (!Singleton<FileManager>::Instance().commitUpload(filemd5))
+            return false;
     }
 
     std::string dummyfiledatax;
     send(msg_type_upload_resp, m_seq, errorcode, filemd5, offset, filesize, dummyfiledatax);
 
-    std::string errorcodestr = (errorcode == file_msg_error_complete) ? "file_msg_error_complete" : "file_msg_error_progress";
+    if (m_bTraceChunk)
+    {
+        LOGI("Response to client: cmd=msg_type_upload_resp, errorcode: %s, filemd5: %s, offset: %lld, filedataLength: %lld, filesize: %lld, upload percent: %d%%, client: %s",
+             (errorcode == file_msg_error_complete ? "file_msg_error_complete" : "file_msg_error_progress"),
+             filemd5.c_str(), offset, filedataLength, filesize, (int32_t)(offset * 100 / filesize), m_strPeer.c_str());
+    }
+
+    if (errorcode == file_msg_error_complete)
+        endTransfer("finished");
+
+    sessionMetrics().uploadChunkTime.record(monotonicMicroseconds() - m_uploadChunkStart);
+
+    return true;
+}
+
+/**
+ * @brief Checks the content of a complete upload against its md5.
+ *
+ * Uses the digest computed while the chunks were written, or reads the file once
+ * if the chunks did not arrive in order. Names that are not md5 digests are not checked.
+ *
+ * @param filemd5   The MD5 hash of the file.
+ * @param conn      Shared pointer to the TcpConnection associated with the client.
+ * @return true     If the content matches, false otherwise.
+ */
+bool FileSession::verifyUpload(const std::string &filemd5, const std::shared_ptr<TcpConnection> &conn)
+{
+    if (filemd5.length() != 32)
+        return true;
+
+    if (!m_bUploadHashSynced)
+    {
+        m_uploadMd5.reset();
+        std::vector<char> buffer(64 * 1024);
+        size_t length;
+        int64_t readStart = monotonicMicroseconds();
+        rewind(m_fp);
+        while ((length = fread(&buffer[0], 1, buffer.size(), m_fp)) > 0)
+            m_uploadMd5.update(&buffer[0], length);
+        sessionMetrics().diskReadTime.record(monotonicMicroseconds() - readStart);
+
+        if (ferror(m_fp))
+        {
+            LOGE("fread error, filemd5: %s, errno: %d, errinfo: %s, client: %s",
+                 filemd5.c_str(), errno, strerror(errno), conn->peerAddress().toIpPort().c_str());
+            return false;
+        }
+    }
+
+    std::string digest = m_uploadMd5.hexDigest();
+    if (strcasecmp(digest.c_str(), filemd5.c_str()) != 0)
+    {
+        LOGE("upload digest mismatch, filemd5: %s, digest: %s, client: %s",
+             filemd5.c_str(), digest.c_str(), conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Starts consuming a large upload package before its body is fully received.
+ *
+ * Decodes the fields in front of the file data from the buffered prefix of the body.
+ * Once they are all there, header and fields are retrieved from the buffer, the file
+ * is opened on the disk thread and the file data is written by consumeUploadStream()
+ * slice by slice as it arrives.
+ *
+ * @param conn        Shared pointer to the TCP connection
+ * @param pBuffer     Buffer holding the header and a prefix of the package body
+ * @param packagesize Size of the package body
+ * @param started     Set to true if the package is now consumed incrementally
+ * @return true if the package was started or has to be buffered whole, false on a protocol error
+ */
+bool FileSession::beginUploadStream(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer, int64_t packagesize, bool &started)
+{
+    started = false;
+
+    // Only the buffered prefix of the body is visible to the reader
+    const char *body = pBuffer->peek() + sizeof(file_msg_header);
+    BinaryStreamReader readStream(body, pBuffer->readableBytes() - sizeof(file_msg_header));
+    int32_t cmd;
+    int32_t seq;
+    std::string filemd5;
+    size_t md5length;
+    int64_t offset;
+    int64_t filesize;
+    size_t filedatalength;
+    if (!readStream.ReadInt32(cmd) || cmd != msg_type_upload_req)
+        return true;
+
+    // Fields not fully received yet, retried on the next read
+    if (!readStream.ReadInt32(seq) || !readStream.ReadString(&filemd5, 0, md5length) ||
+        !readStream.ReadInt64(offset) || !readStream.ReadInt64(filesize) || !readStream.ReadLength(filedatalength))
+        return true;
+
+    int64_t fieldslength = static_cast<int64_t>(readStream.GetCurrent() - body);
+    if (md5length == 0 || !FileManager::isValidFileName(filemd5) || static_cast<int64_t>(filedatalength) > packagesize - fieldslength)
+    {
+        LOGE("invalid upload package, filemd5: %s, filedatalength: %lld, packagesize: %lld, client: %s",
+             filemd5.c_str(), (int64_t)filedatalength, packagesize, conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    // While a stream is being pushed the file state belongs to it
+    if (m_bDownloadStreaming)
+    {
+        LOGE("cmd %d not allowed during streaming download, filemd5: %s, client: %s",
+             cmd, m_strStreamFileMd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    m_seq = seq;
+    m_bTraceChunk = sampleChunk();
+    if (m_bTraceChunk)
+    {
+        LOGI("Request from client: cmd: %d, seq: %d, filemd5: %s, md5length: %d, offset: %lld, filesize: %lld, filedata length: %lld, header.packagesize: %lld, streamed, client: %s",
+             cmd, m_seq, filemd5.c_str(), md5length, offset, filesize, (int64_t)filedatalength, packagesize, m_strPeer.c_str());
+    }
+
+    pBuffer->retrieve(sizeof(file_msg_header) + fieldslength);
+    m_bUploadStreaming = true;
+    m_bUploadDiscard = false;
+    m_strUploadFileMd5 = filemd5;
+    m_uploadOffset = offset;
+    m_uploadFileSize = filesize;
+    m_uploadDataLength = static_cast<int64_t>(filedatalength);
+    m_uploadDataRemaining = m_uploadDataLength;
+    m_uploadTrailingRemaining = packagesize - fieldslength - m_uploadDataLength;
+    m_uploadChunkStart = monotonicMicroseconds();
+    started = true;
+    sessionMetrics().uploadRequests.add();
+
+    submitDiskTask(conn, [this, filemd5, offset, filesize, conn]()
+                   { return beginUploadChunk(filemd5, offset, filesize, m_bUploadDiscard, conn); });
+
+    return true;
+}
+
+/**
+ * @brief Writes the received file data of the upload package being streamed.
+ *
+ * Data is written once a full slice, or the rest of the chunk, is buffered, so the
+ * input buffer never holds much more than UPLOAD_STREAM_SLICE_SIZE bytes of it.
+ * Each slice is one disk task, parsing resumes when it is written.
+ *
+ * @param conn    Shared pointer to the TCP connection
+ * @param pBuffer Buffer holding the next bytes of the package body
+ * @return true if no error occurred, false otherwise
+ */
+bool FileSession::consumeUploadStream(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer)
+{
+    while (m_uploadDataRemaining > 0)
+    {
+        int64_t length = static_cast<int64_t>(pBuffer->readableBytes());
+        if (length > m_uploadDataRemaining)
+            length = m_uploadDataRemaining;
+
+        if (length < m_uploadDataRemaining && length < UPLOAD_STREAM_SLICE_SIZE)
+            return true;
 
-    LOGI("Response to client: cmd=msg_type_upload_resp, errorcode: %s, filemd5: %s, offset: %lld, filedataLength: %lld, filesize: %lld, upload percent: %d%%, client: %s",
-         errorcodestr.c_str(), filemd5.c_str(), offset, filedataLength, filesize, (int32_t)(offset * 100 / filesize), conn->peerAddress().toIpPort().c_str());
+        const char *filedata = pBuffer->peek();
+        pBuffer->retrieve(static_cast<size_t>(length));
+        m_uploadDataRemaining -= length;
+        if (m_bUploadDiscard)
+            continue;
 
+        // The slice is written straight from the input buffer, which is not read into until it is done
+        std::string filemd5 = m_strUploadFileMd5;
+        size_t filedatalength = static_cast<size_t>(length);
+        submitDiskTask(conn, [this, filemd5, filedata, filedatalength, conn]()
+                       { return writeUploadChunk(filemd5, filedata, filedatalength, conn); });
+        return true;
+    }
+
+    // Fields after the file data are not used by uploads, they are dropped as they arrive
+    int64_t trailing = static_cast<int64_t>(pBuffer->readableBytes());
+    if (trailing > m_uploadTrailingRemaining)
+        trailing = m_uploadTrailingRemaining;
+
+    pBuffer->retrieve(static_cast<size_t>(trailing));
+    m_uploadTrailingRemaining -= trailing;
+    if (m_uploadTrailingRemaining > 0)
+        return true;
+
+    m_bUploadStreaming = false;
+    if (m_bUploadDiscard)
+        return true;
+
+    std::string filemd5 = m_strUploadFileMd5;
+    int64_t offset = m_uploadOffset;
+    int64_t filesize = m_uploadFileSize;
+    int64_t filedataLength = m_uploadDataLength;
+    submitDiskTask(conn, [this, filemd5, offset, filesize, filedataLength, conn]()
+                   { return finishUploadChunk(filemd5, offset, filesize, filedataLength, conn); });
     return true;
 }
 
+/**
+ * @brief Runs file I/O of the session on its disk thread.
+ *
+ * Reading from the connection stops and parsing of buffered packages pauses until
+ * the task is done, so the task owns the file state and may read the input buffer.
+ * An uploader faster than the disk is held back by TCP flow control instead of
+ * growing the input buffer.
+ * The result is posted back to the connection's loop.
+ *
+ * @param conn Shared pointer to the TCP connection
+ * @param task The I/O to run, returns false on an error that closes the connection
+ */
+void FileSession::submitDiskTask(const std::shared_ptr<TcpConnection> &conn, const std::function<bool()> &task)
+{
+    m_bDiskPending = true;
+    conn->pauseRead(TcpConnection::kReadPausedByDisk);
+
+    std::shared_ptr<FileSession> self = shared_from_this();
+    Singleton<DiskExecutor>::Instance().submit(static_cast<size_t>(m_id), [self, conn, task]()
+                                               {
+                                                   bool ok = task();
+                                                   conn->getLoop()->queueInLoop([self, conn, ok]()
+                                                                                { self->onDiskTaskDone(conn, ok); });
+                                               });
+}
+
+/**
+ * @brief Resumes the session once its disk task is done, on the connection's loop.
+ * @param conn Shared pointer to the TCP connection
+ * @param ok   Result of the task
+ */
+void FileSession::onDiskTaskDone(const std::shared_ptr<TcpConnection> &conn, bool ok)
+{
+    m_bDiskPending = false;
+    if (!ok)
+    {
+        LOGE("Process error, close TcpConnection, client: %s",
+             conn->peerAddress().toIpPort().c_str());
+        conn->forceClose();
+        return;
+    }
+
+    if (!conn->connected())
+        return;
+
+    conn->resumeRead(TcpConnection::kReadPausedByDisk);
+
+    // Packages buffered before the task was submitted are parsed now
+    onRead(conn, conn->inputBuffer(), Timestamp::now());
+}
+
 /**
  * @brief Handles a client's request to download a file by sending a chunk of the file.
  *
  * This function first checks the validity of the requested file. If the file exists,
  * it opens the file (if not already opened), calculates the appropriate chunk size
- * based on the client's network type (Wi-Fi or cellular), reads a chunk from disk,
- * and sends it to the client along with current progress or completion status.
+ * based on the client's network type (Wi-Fi or cellular), and sends the chunk to the
+ * client along with current progress or completion status. The chunk is never read
+ * into user space: the connection copies it from the file with sendfile().
  *
  * @param filemd5         The MD5 hash identifying the file to download.
  * @param clientNetType   The type of client's network (e.g., Wi-Fi or cellular).
@@ -329,6 +938,8 @@ bool FileSession::onUploadFileResponse(const std::string &filemd5, int64_t offse
  */
 bool FileSession::onDownloadFileResponse(const std::string &filemd5, int32_t clientNetType, const std::shared_ptr<TcpConnection> &conn)
 {
+    int64_t chunkStart = monotonicMicroseconds();
+
     // Validate input: filemd5 must not be empty
     if (filemd5.empty())
     {
@@ -345,90 +956,368 @@ bool FileSession::onDownloadFileResponse(const std::string &filemd5, int32_t cli
         send(msg_type_download_resp, m_seq, file_msg_error_not_exist, filemd5, notExsitFileOffset, notExsitFileSize, dummyfiledata);
 
         LOGE("File not found: filemd5: %s, clientNetType: %d, client: %s", filemd5.c_str(), clientNetType, conn->peerAddress().toIpPort().c_str());
-        LOGI("Response to client: cmd=msg_type_download_resp, errorcode=file_msg_error_not_exist, filemd5=%s, clientNetType=%d, offset=0, filesize=0, filedataLength=0, client=%s",
-             filemd5.c_str(), clientNetType, conn->peerAddress().toIpPort().c_str());
+        if (m_bTraceChunk)
+        {
+            LOGI("Response to client: cmd=msg_type_download_resp, errorcode=file_msg_error_not_exist, filemd5=%s, clientNetType=%d, offset=0, filesize=0, filedataLength=0, client=%s",
+                 filemd5.c_str(), clientNetType, m_strPeer.c_str());
+        }
         return true;
     }
 
     // Open file for reading if not already open
     if (m_fp == NULL)
     {
-        string filename = m_strFileBaseDir + filemd5;
-        m_fp = fopen(filename.c_str(), "rb+");
-        if (m_fp == NULL)
-        {
-            LOGE("Failed to open file: filemd5: %s, clientNetType: %d, client: %s", filemd5.c_str(), clientNetType, conn->peerAddress().toIpPort().c_str());
+        if (!openDownloadFile(filemd5, conn))
             return false;
-        }
 
-        // Seek to end to determine file size
-        if (fseek(m_fp, 0, SEEK_END) == -1)
-        {
-            LOGE("fseek to end failed, filemd5: %s, errno: %d, client: %s", filemd5.c_str(), errno, conn->peerAddress().toIpPort().c_str());
-            return false;
-        }
-
-        m_currentDownloadFileSize = ftell(m_fp);
-        if (m_currentDownloadFileSize <= 0)
-        {
-            LOGE("Invalid file size: %lld, filemd5: %s, client: %s", m_currentDownloadFileSize, filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
-            return false;
-        }
-
-        // Seek back to beginning to prepare for reading
-        if (fseek(m_fp, 0, SEEK_SET) == -1)
-        {
-            LOGE("fseek to start failed, filemd5: %s, client: %s", filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
-            return false;
-        }
+        m_downloadPacer.reset(clientNetType);
+        beginTransfer("Download", filemd5, m_currentDownloadFileSize);
     }
 
-    string filedata;
-    int64_t currentSendSize = 512 * 1024; // Default chunk size for Wi-Fi clients
-
-    // For cellular clients, reduce chunk size to 64KB
-    if (clientNetType == client_net_type_cellular)
-        currentSendSize = 64 * 1024;
+    // Chunk size follows the measured bandwidth-delay product of the connection
+    m_downloadPacer.update(conn);
+    int64_t currentSendSize = m_downloadPacer.chunkSize();
 
     // Adjust chunk size if reaching file end
     if (m_currentDownloadFileSize <= m_currentDownloadFileOffset + currentSendSize)
         currentSendSize = m_currentDownloadFileSize - m_currentDownloadFileOffset;
 
-    char buffer[512 * 1024] = {0};
-
-    // Read chunk from file
-    if (currentSendSize <= 0 || fread(buffer, currentSendSize, 1, m_fp) != 1)
+    if (currentSendSize <= 0)
     {
-        LOGE("fread error, filemd5: %s, errno: %d, msg: %s, size: %lld, client: %s",
-             filemd5.c_str(), errno, strerror(errno), currentSendSize, conn->peerAddress().toIpPort().c_str());
+        LOGE("Invalid chunk size, filemd5: %s, size: %lld, client: %s",
+             filemd5.c_str(), currentSendSize, conn->peerAddress().toIpPort().c_str());
+        resetFile();
+        return false;
     }
 
     int64_t sendoffset = m_currentDownloadFileOffset;
     m_currentDownloadFileOffset += currentSendSize;
-    filedata.append(buffer, currentSendSize);
+    m_transferBytes += currentSendSize;
 
     // Determine progress or completion
     int errorcode = file_msg_error_progress;
     if (m_currentDownloadFileOffset == m_currentDownloadFileSize)
         errorcode = file_msg_error_complete;
 
-    // Send response with chunk to client
-    send(msg_type_download_resp, m_seq, errorcode, filemd5, sendoffset, m_currentDownloadFileSize, filedata);
+    // Send response header, the chunk itself goes out with sendfile() from the open file
+    bool outputWasEmpty = conn->pendingOutputBytes() == 0;
+    sendFileData(msg_type_download_resp, m_seq, errorcode, filemd5, sendoffset, m_currentDownloadFileSize, fileno(m_fp), currentSendSize);
+    m_downloadPacer.onQueued(currentSendSize, outputWasEmpty);
 
     // Log response details
-    LOGI("Response to client: cmd=msg_type_download_resp, errorcode=%s, filemd5=%s, clientNetType=%d, offset=%lld, filesize=%lld, dataLen=%zu, percent=%d%%, client=%s",
-         (errorcode == file_msg_error_progress ? "file_msg_error_progress" : "file_msg_error_complete"),
-         filemd5.c_str(), clientNetType, sendoffset, m_currentDownloadFileSize,
-         filedata.length(), (int)(m_currentDownloadFileOffset * 100 / m_currentDownloadFileSize),
-         conn->peerAddress().toIpPort().c_str());
+    if (m_bTraceChunk)
+    {
+        LOGI("Response to client: cmd=msg_type_download_resp, errorcode=%s, filemd5=%s, clientNetType=%d, offset=%lld, filesize=%lld, dataLen=%lld, percent=%d%%, rtt=%lldus, rate=%.0fB/s, client=%s",
+             (errorcode == file_msg_error_progress ? "file_msg_error_progress" : "file_msg_error_complete"),
+             filemd5.c_str(), clientNetType, sendoffset, m_currentDownloadFileSize,
+             currentSendSize, (int)(m_currentDownloadFileOffset * 100 / m_currentDownloadFileSize),
+             m_downloadPacer.rttUs(), m_downloadPacer.rate(), m_strPeer.c_str());
+    }
 
     // If download is complete, reset internal file state
     if (errorcode == file_msg_error_complete)
+    {
+        endTransfer("finished");
         resetFile();
+    }
+
+    sessionMetrics().downloadChunkTime.record(monotonicMicroseconds() - chunkStart);
+    return true;
+}
+
+/**
+ * @brief Starts a streaming download of the requested file.
+ *
+ * Instead of one request round trip per chunk, the client asks once and the server
+ * keeps pushing msg_type_download_resp chunks, all carrying the seq of this request.
+ * Chunks are queued while the connection's pending output stays below the
+ * streaming window of m_downloadPacer, sized from the measured bandwidth-delay
+ * product, and the write-complete callback refills the window, so throughput is
+ * bounded by bandwidth rather than RTT.
+ *
+ * @param filemd5         The MD5 hash identifying the file to download.
+ * @param clientNetType   The type of client's network (e.g., Wi-Fi or cellular).
+ * @param conn            Shared pointer to the TCP connection to the client.
+ * @return true           If the stream was started (or the file does not exist).
+ * @return false          If an error occurs.
+ */
+bool FileSession::onDownloadStreamRequest(const std::string &filemd5, int32_t clientNetType, const std::shared_ptr<TcpConnection> &conn)
+{
+    if (filemd5.empty())
+    {
+        LOGE("Empty filemd5, client: %s", conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    // An upload or a request-driven download still owns the file state
+    if (m_fp != NULL)
+    {
+        LOGE("streaming download requested while another transfer is in progress, filemd5: %s, client: %s",
+             filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    if (!Singleton<FileManager>::Instance().isFileExsit(filemd5.c_str()))
+    {
+        string dummyfiledata;
+        send(msg_type_download_resp, m_seq, file_msg_error_not_exist, filemd5, 0, 0, dummyfiledata);
+
+        LOGE("File not found: filemd5: %s, clientNetType: %d, client: %s", filemd5.c_str(), clientNetType, conn->peerAddress().toIpPort().c_str());
+        return true;
+    }
+
+    if (!openDownloadFile(filemd5, conn))
+        return false;
+
+    m_bDownloadStreaming = true;
+    m_streamSeq = m_seq;
+    m_strStreamFileMd5 = filemd5;
+    m_downloadPacer.reset(clientNetType);
 
+    beginTransfer("Streaming download", filemd5, m_currentDownloadFileSize);
+
+    pumpDownloadStream(conn);
     return true;
 }
 
+/**
+ * @brief Serves explicit byte ranges of a file.
+ *
+ * Unlike the other downloads this keeps no file state in the session: the file is
+ * opened for this request only and every range is sent with sendfile() at its own
+ * offset, all of them from one shared descriptor, so a client can resume an interrupted download where it stopped or fetch
+ * segments of one file over several connections in parallel.
+ *
+ * Each range is answered with one msg_type_download_resp carrying the seq of the
+ * request, the range offset, the file size and up to MAX_RANGE_LENGTH bytes of data.
+ * The last response of the request carries file_msg_error_complete, the others
+ * file_msg_error_progress. A range starting outside the file is answered with a single
+ * file_msg_error_range and nothing else is sent.
+ *
+ * @param filemd5         The MD5 hash identifying the file to download.
+ * @param clientNetType   The type of client's network (e.g., Wi-Fi or cellular).
+ * @param ranges          The ranges to send, in order.
+ * @param conn            Shared pointer to the TCP connection to the client.
+ * @return true           If the ranges were queued (or the file or a range does not exist).
+ * @return false          If an error occurs.
+ */
+bool FileSession::onDownloadRangeRequest(const std::string &filemd5, int32_t clientNetType, const std::vector<DownloadRange> &ranges, const std::shared_ptr<TcpConnection> &conn)
+{
+    int64_t chunkStart = monotonicMicroseconds();
+    string dummyfiledata;
+
+    if (!Singleton<FileManager>::Instance().isFileExsit(filemd5.c_str()))
+    {
+        send(msg_type_download_resp, m_seq, file_msg_error_not_exist, filemd5, 0, 0, dummyfiledata);
+
+        LOGE("File not found: filemd5: %s, clientNetType: %d, client: %s", filemd5.c_str(), clientNetType, conn->peerAddress().toIpPort().c_str());
+        return true;
+    }
+
+    int64_t openStart = monotonicMicroseconds();
+    int fd = openCachedFile(filemd5);
+    sessionMetrics().diskReadTime.record(monotonicMicroseconds() - openStart);
+    if (fd < 0)
+    {
+        LOGE("Failed to open file: filemd5: %s, errno: %d, client: %s", filemd5.c_str(), errno, conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    // All ranges share the descriptor, it is closed once the last of them is sent
+    SharedFilePtr file = std::make_shared<SharedFile>(fd);
+
+    struct stat fileStat;
+    if (::fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        LOGE("Invalid file, filemd5: %s, errno: %d, client: %s", filemd5.c_str(), errno, conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+    int64_t filesize = fileStat.st_size;
+
+    // The request is answered as a whole, check every range before sending any
+    for (const DownloadRange &range : ranges)
+    {
+        if (range.offset < 0 || range.offset >= filesize || range.length < 0)
+        {
+            send(msg_type_download_resp, m_seq, file_msg_error_range, filemd5, range.offset, filesize, dummyfiledata);
+
+            LOGE("Invalid range, filemd5: %s, offset: %lld, length: %lld, filesize: %lld, client: %s",
+                 filemd5.c_str(), range.offset, range.length, filesize, conn->peerAddress().toIpPort().c_str());
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        int64_t length = ranges[i].length;
+        if (length == 0 || length > filesize - ranges[i].offset)
+            length = filesize - ranges[i].offset;
+        if (length > MAX_RANGE_LENGTH)
+            length = MAX_RANGE_LENGTH;
+
+        int errorcode = (i + 1 == ranges.size()) ? file_msg_error_complete : file_msg_error_progress;
+        sendFileData(msg_type_download_resp, m_seq, errorcode, filemd5, ranges[i].offset, filesize, file, length);
+
+        if (m_bTraceChunk)
+        {
+            LOGI("Response to client: cmd=msg_type_download_resp, range %d/%d, filemd5=%s, clientNetType=%d, offset=%lld, filesize=%lld, dataLen=%lld, client=%s",
+                 (int)i + 1, (int)ranges.size(), filemd5.c_str(), clientNetType, ranges[i].offset, filesize, length, m_strPeer.c_str());
+        }
+    }
+
+    sessionMetrics().downloadChunkTime.record(monotonicMicroseconds() - chunkStart);
+    return true;
+}
+
+/**
+ * @brief Cancels the in-progress streaming download.
+ *
+ * Chunks already queued on the connection are still delivered; the client discards
+ * them until it receives the msg_type_download_resp carrying file_msg_error_cancelled.
+ *
+ * @param filemd5 The MD5 hash identifying the file being streamed.
+ * @param conn    Shared pointer to the TCP connection to the client.
+ * @return true   Always, cancelling an idle session is a no-op.
+ */
+bool FileSession::onDownloadCancelRequest(const std::string &filemd5, const std::shared_ptr<TcpConnection> &conn)
+{
+    if (!m_bDownloadStreaming || filemd5 != m_strStreamFileMd5)
+    {
+        LOGW("No streaming download to cancel, filemd5: %s, client: %s", filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        return true;
+    }
+
+    int64_t offset = m_currentDownloadFileOffset;
+    int64_t filesize = m_currentDownloadFileSize;
+    m_bDownloadStreaming = false;
+    endTransfer("cancelled");
+    resetFile();
+
+    string dummyfiledata;
+    send(msg_type_download_resp, m_seq, file_msg_error_cancelled, filemd5, offset, filesize, dummyfiledata);
+    return true;
+}
+
+void FileSession::onWriteComplete(const std::shared_ptr<TcpConnection> &conn)
+{
+    m_downloadPacer.onDrained();
+    if (m_bDownloadStreaming)
+        pumpDownloadStream(conn);
+
+    // Packages left unparsed while too many file regions were queued
+    if (conn->connected() && conn->inputBuffer()->readableBytes() > 0)
+        onRead(conn, conn->inputBuffer(), Timestamp::now());
+}
+
+bool FileSession::openDownloadFile(const std::string &filemd5, const std::shared_ptr<TcpConnection> &conn)
+{
+    int64_t openStart = monotonicMicroseconds();
+    int fd = openCachedFile(filemd5);
+    if (fd >= 0)
+    {
+        m_fp = fdopen(fd, "rb");
+        if (m_fp == NULL)
+            ::close(fd);
+    }
+    sessionMetrics().diskReadTime.record(monotonicMicroseconds() - openStart);
+
+    if (m_fp == NULL)
+    {
+        LOGE("Failed to open file: filemd5: %s, client: %s", filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        return false;
+    }
+
+    // Seek to end to determine file size
+    if (fseek(m_fp, 0, SEEK_END) == -1)
+    {
+        LOGE("fseek to end failed, filemd5: %s, errno: %d, client: %s", filemd5.c_str(), errno, conn->peerAddress().toIpPort().c_str());
+        resetFile();
+        return false;
+    }
+
+    m_currentDownloadFileSize = ftell(m_fp);
+    if (m_currentDownloadFileSize <= 0)
+    {
+        LOGE("Invalid file size: %lld, filemd5: %s, client: %s", m_currentDownloadFileSize, filemd5.c_str(), conn->peerAddress().toIpPort().c_str());
+        resetFile();
+        return false;
+    }
+
+    // Chunks are sent with explicit offsets, the stream position is irrelevant
+    m_currentDownloadFileOffset = 0;
+    return true;
+}
+
+void FileSession::pumpDownloadStream(const std::shared_ptr<TcpConnection> &conn)
+{
+    m_downloadPacer.update(conn);
+    while (m_bDownloadStreaming && static_cast<int64_t>(conn->pendingOutputBytes()) < m_downloadPacer.streamWindow())
+    {
+        int64_t chunkStart = monotonicMicroseconds();
+        int64_t currentSendSize = m_downloadPacer.streamChunkSize();
+        if (m_currentDownloadFileSize <= m_currentDownloadFileOffset + currentSendSize)
+            currentSendSize = m_currentDownloadFileSize - m_currentDownloadFileOffset;
+
+        int64_t sendoffset = m_currentDownloadFileOffset;
+        m_currentDownloadFileOffset += currentSendSize;
+        m_transferBytes += currentSendSize;
+
+        int errorcode = file_msg_error_progress;
+        if (m_currentDownloadFileOffset == m_currentDownloadFileSize)
+            errorcode = file_msg_error_complete;
+
+        bool outputWasEmpty = conn->pendingOutputBytes() == 0;
+        sendFileData(msg_type_download_resp, m_streamSeq, errorcode, m_strStreamFileMd5, sendoffset, m_currentDownloadFileSize, fileno(m_fp), currentSendSize);
+        m_downloadPacer.onQueued(currentSendSize, outputWasEmpty);
+
+        if (sampleChunk())
+        {
+            LOGI("Streaming download chunk, filemd5: %s, offset: %lld, filesize: %lld, dataLen: %lld, client: %s",
+                 m_strStreamFileMd5.c_str(), sendoffset, m_currentDownloadFileSize, currentSendSize, m_strPeer.c_str());
+        }
+
+        if (errorcode == file_msg_error_complete)
+        {
+            m_bDownloadStreaming = false;
+            endTransfer("finished");
+            resetFile();
+        }
+
+        sessionMetrics().downloadChunkTime.record(monotonicMicroseconds() - chunkStart);
+    }
+}
+
+bool FileSession::sampleChunk()
+{
+    return g_chunkLogSampling > 0 && ++m_chunkCounter % g_chunkLogSampling == 0;
+}
+
+void FileSession::beginTransfer(const char *kind, const std::string &filemd5, int64_t filesize)
+{
+    // An upload restarted from offset 0 replaces the one in progress
+    if (m_transferKind != NULL)
+        endTransfer("restarted");
+
+    m_transferKind = kind;
+    m_strTransferFileMd5 = filemd5;
+    m_transferFileSize = filesize;
+    m_transferBytes = 0;
+    m_transferStart = monotonicMicroseconds();
+
+    LOGI("%s started, filemd5: %s, filesize: %lld, client: %s", kind, filemd5.c_str(), filesize, m_strPeer.c_str());
+}
+
+void FileSession::endTransfer(const char *result)
+{
+    int64_t durationUs = monotonicMicroseconds() - m_transferStart;
+    double throughput = durationUs > 0 ? static_cast<double>(m_transferBytes) / durationUs : 0.0; // bytes/us == MB/s
+
+    LOGI("%s %s, filemd5: %s, filesize: %lld, bytes: %lld, duration: %lld ms, throughput: %.2f MB/s, client: %s",
+         m_transferKind, result, m_strTransferFileMd5.c_str(), m_transferFileSize, m_transferBytes,
+         durationUs / 1000, throughput, m_strPeer.c_str());
+    m_transferKind = NULL;
+}
+
 void FileSession::resetFile()
 {
     if (m_fp != NULL)
@@ -6,8 +6,13 @@
  **/
 
 #pragma once
+#include <memory>
+#include <functional>
+#include <vector>
 #include "../net/ByteBuffer.h"
+#include "../utils/MD5.h"
 #include "TcpSession.h"
+#include "DownloadPacer.h"
 
 /**
  * @class FileSession
@@ -15,8 +20,9 @@
  *
  * Extends TcpSession to provide file transfer functionality including
  * upload and download operations with progress tracking.
+ * Upload file I/O runs on the DiskExecutor, never on the event loop.
  */
-class FileSession : public TcpSession
+class FileSession : public TcpSession, public std::enable_shared_from_this<FileSession>
 {
 public:
     /**
@@ -55,6 +61,26 @@ public:
      */
     void onRead(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer, Timestamp receivTime);
 
+    /**
+     * @brief Callback for the connection's output queue draining
+     *
+     * Pushes the next chunks of an in-progress streaming download.
+     *
+     * @param conn Shared pointer to the TCP connection
+     */
+    void onWriteComplete(const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Set how many chunks a chunk trace line is logged for
+     *
+     * Transfers are always logged once when they start and once when they end.
+     * With sampling on, the request and response of one chunk in everyNthChunk
+     * are logged as well. Set before sessions are created.
+     *
+     * @param everyNthChunk Sampling interval, 1 traces every chunk, 0 disables tracing
+     */
+    static void setChunkLogSampling(int everyNthChunk);
+
 private:
     /**
      * @brief Process received data
@@ -73,11 +99,84 @@ private:
      * @param filemd5 MD5 hash of the file
      * @param offset Current file offset
      * @param filesize Total file size
+     * @param filedata File data content, points into the connection's input buffer
+     * @param filedatalength Length of the file data
+     * @param conn Shared pointer to the TCP connection
+     * @return true if handling succeeded, false otherwise
+     */
+    bool onUploadFileResponse(const std::string &filemd5, int64_t offset, int64_t filesize, const char *filedata, size_t filedatalength, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Open or check the file an upload chunk is written to and seek to the chunk
+     * @param filemd5 MD5 hash of the file
+     * @param offset Current file offset
+     * @param filesize Total file size
+     * @param complete Set to true if the file is already complete and the chunk is dropped
+     * @param conn Shared pointer to the TCP connection
+     * @return true if handling succeeded, false otherwise
+     */
+    bool beginUploadChunk(const std::string &filemd5, int64_t offset, int64_t filesize, bool &complete, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Write upload chunk data at the current file position
+     * @param filemd5 MD5 hash of the file
      * @param filedata File data content
+     * @param filedatalength Length of the file data
+     * @param conn Shared pointer to the TCP connection
+     * @return true if the data was written, false otherwise
+     */
+    bool writeUploadChunk(const std::string &filemd5, const char *filedata, size_t filedatalength, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Flush a written upload chunk and send the upload response
+     * @param filemd5 MD5 hash of the file
+     * @param offset File offset of the chunk
+     * @param filesize Total file size
+     * @param filedataLength Length of the chunk
      * @param conn Shared pointer to the TCP connection
      * @return true if handling succeeded, false otherwise
      */
-    bool onUploadFileResponse(const std::string &filemd5, int64_t offset, int64_t filesize, const std::string &filedata, const std::shared_ptr<TcpConnection> &conn);
+    bool finishUploadChunk(const std::string &filemd5, int64_t offset, int64_t filesize, int64_t filedataLength, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Check the content of a complete upload against its md5
+     * @param filemd5 MD5 hash of the file
+     * @param conn Shared pointer to the TCP connection
+     * @return true if the content matches, false otherwise
+     */
+    bool verifyUpload(const std::string &filemd5, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Start writing a large upload package before it is fully received
+     * @param conn Shared pointer to the TCP connection
+     * @param pBuffer Buffer holding the header and a prefix of the package body
+     * @param packagesize Size of the package body
+     * @param started Set to true if the package is now consumed as it arrives
+     * @return true unless the package is invalid
+     */
+    bool beginUploadStream(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer, int64_t packagesize, bool &started);
+
+    /**
+     * @brief Write the received file data of the upload package being streamed
+     * @param conn Shared pointer to the TCP connection
+     * @param pBuffer Buffer holding the next bytes of the package body
+     * @return true if no error occurred, false otherwise
+     */
+    bool consumeUploadStream(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer);
+
+    /**
+     * @brief Run file I/O on the session's disk thread, pausing the connection until it is done
+     * @param conn Shared pointer to the TCP connection
+     * @param task The I/O to run, returns false on an error that closes the connection
+     */
+    void submitDiskTask(const std::shared_ptr<TcpConnection> &conn, const std::function<bool()> &task);
+
+    /**
+     * @brief Resume the connection once the disk task is done
+     * @param conn Shared pointer to the TCP connection
+     * @param ok Result of the disk task
+     */
+    void onDiskTaskDone(const std::shared_ptr<TcpConnection> &conn, bool ok);
 
     /**
      * @brief Handle file download response
@@ -88,6 +187,56 @@ private:
      */
     bool onDownloadFileResponse(const std::string &filemd5, int32_t clientNetType, const std::shared_ptr<TcpConnection> &conn);
 
+    /**
+     * @brief Start a streaming download: the client asks once and the server pushes every chunk
+     * @param filemd5 MD5 hash of the file
+     * @param clientNetType Network type of the client
+     * @param conn Shared pointer to the TCP connection
+     * @return true if handling succeeded, false otherwise
+     */
+    bool onDownloadStreamRequest(const std::string &filemd5, int32_t clientNetType, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Byte range of a range download, a length of 0 reaches to the end of the file
+     */
+    struct DownloadRange
+    {
+        int64_t offset;
+        int64_t length;
+    };
+
+    /**
+     * @brief Serve explicit byte ranges of a file without keeping any file state in the session
+     * @param filemd5 MD5 hash of the file
+     * @param clientNetType Network type of the client
+     * @param ranges Ranges to send, in the order they are answered
+     * @param conn Shared pointer to the TCP connection
+     * @return true if handling succeeded, false otherwise
+     */
+    bool onDownloadRangeRequest(const std::string &filemd5, int32_t clientNetType, const std::vector<DownloadRange> &ranges, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Cancel the in-progress streaming download
+     * @param filemd5 MD5 hash of the file
+     * @param conn Shared pointer to the TCP connection
+     * @return true if handling succeeded, false otherwise
+     */
+    bool onDownloadCancelRequest(const std::string &filemd5, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Open the file to download and record its size
+     * @param filemd5 MD5 hash of the file
+     * @param conn Shared pointer to the TCP connection
+     * @return true if the file is open and not empty, false otherwise
+     */
+    bool openDownloadFile(const std::string &filemd5, const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Queue streaming download chunks until the stream window is full
+     * @param conn Shared pointer to the TCP connection
+     */
+    void pumpDownloadStream(const std::shared_ptr<TcpConnection> &conn);
+
     /**
      * @brief Reset file state
      *
@@ -95,6 +244,26 @@ private:
      */
     void resetFile();
 
+    /**
+     * @brief Decide whether the chunk being handled is traced
+     * @return true for one chunk in every setChunkLogSampling() chunks
+     */
+    bool sampleChunk();
+
+    /**
+     * @brief Log the start of a transfer and start timing it
+     * @param kind Kind of transfer, e.g. "Upload"
+     * @param filemd5 MD5 hash of the file
+     * @param filesize Total file size
+     */
+    void beginTransfer(const char *kind, const std::string &filemd5, int64_t filesize);
+
+    /**
+     * @brief Log the end of the transfer with its duration, bytes and throughput
+     * @param result How it ended, e.g. "finished"
+     */
+    void endTransfer(const char *result);
+
 private:
     int32_t m_id;  /**< Session ID */
     int32_t m_seq; /**< Current session data packet sequence number */
@@ -105,4 +274,38 @@ private:
     int64_t m_currentDownloadFileSize{};   /**< Size of the file being downloaded (should be reset to 0 after completion) */
     std::string m_strFileBaseDir;          /**< Base directory for file operations */
     bool m_bFileUploading;                 /**< Flag indicating whether a file is currently being uploaded */
+
+    // Streaming download state
+    bool m_bDownloadStreaming;       /**< Flag indicating whether chunks are pushed without further requests */
+    int32_t m_streamSeq;             /**< Sequence number of the streaming download request */
+    std::string m_strStreamFileMd5;  /**< MD5 of the file being streamed */
+    DownloadPacer m_downloadPacer;   /**< Chunk size and streaming window of downloads */
+
+    // Streaming upload package state
+    bool m_bUploadStreaming;           /**< Flag indicating whether an upload package body is consumed as it arrives */
+    bool m_bUploadDiscard;             /**< Flag indicating whether the package's file data is dropped */
+    std::string m_strUploadFileMd5;    /**< MD5 of the file the package uploads */
+    int64_t m_uploadOffset;            /**< File offset of the package's chunk */
+    int64_t m_uploadFileSize;          /**< Total size of the file being uploaded */
+    int64_t m_uploadDataLength;        /**< Length of the package's chunk */
+    int64_t m_uploadDataRemaining;     /**< Chunk bytes not written yet */
+    int64_t m_uploadTrailingRemaining; /**< Package bytes after the chunk not received yet */
+    int64_t m_uploadChunkStart;        /**< Monotonic time in microseconds the current chunk arrived */
+
+    bool m_bDiskPending; /**< Flag indicating whether a disk task owns the file state */
+
+    // Digest of the file being uploaded
+    MD5 m_uploadMd5;              /**< Digest of the chunks written in order */
+    int64_t m_uploadHashedLength; /**< Bytes hashed into m_uploadMd5 */
+    bool m_bUploadHashSynced;     /**< Flag indicating whether every chunk arrived in order and was hashed */
+
+    // Transfer summary and chunk tracing
+    std::string m_strPeer;            /**< Client address, formatted once for the session's log lines */
+    const char *m_transferKind;       /**< Kind of the transfer in progress, NULL if none */
+    std::string m_strTransferFileMd5; /**< MD5 of the file being transferred */
+    int64_t m_transferFileSize;       /**< Total size of the file being transferred */
+    int64_t m_transferBytes;          /**< File bytes received or queued for sending so far */
+    int64_t m_transferStart;          /**< Monotonic time in microseconds the transfer started */
+    int32_t m_chunkCounter;           /**< Chunks handled, drives the trace sampling */
+    bool m_bTraceChunk;               /**< Flag indicating whether the current chunk is traced */
 };
\ No newline at end of file
@@ -0,0 +1,116 @@
+/**
+ * @file MetricsServer.cpp
+ * @brief Plaintext HTTP endpoint serving the metrics for Prometheus.
+ * @author xiebaoma
+ * @date 2025-06-06
+ */
+
+#include "MetricsServer.h"
+#include <string.h>
+#include "../net/InetAddress.h"
+#include "../base/AsyncLog.h"
+#include "../base/Singleton.h"
+#include "../base/Metrics.h"
+
+/**
+ * @brief Longest request header accepted, scrapers send a few hundred bytes
+ */
+#define MAX_REQUEST_HEADER_SIZE (8 * 1024)
+
+/**
+ * @brief Starts listening for scrapes in the given loop.
+ *
+ * @param ip    IP address to bind.
+ * @param port  Port number to listen on.
+ * @param loop  Event loop serving the scrapes.
+ * @return true Always, a port that can not be bound aborts the process.
+ */
+bool MetricsServer::init(const char *ip, short port, EventLoop *loop)
+{
+    InetAddress addr(ip, port);
+    m_server = std::make_unique<TcpServer>(loop, addr, "MetricsServer", TcpServer::kNoReusePort);
+    m_server->setConnectionCallback(std::bind(&MetricsServer::onConnected, this, std::placeholders::_1));
+
+    // Scrapes are rare and short, they are served by the loop itself
+    m_server->start(0);
+
+    LOGI("Metrics endpoint listening on %s", m_server->hostport().c_str());
+    return true;
+}
+
+/**
+ * @brief Stops listening and closes the scrape connections.
+ */
+void MetricsServer::uninit()
+{
+    if (m_server)
+    {
+        m_server->stop();
+    }
+}
+
+/**
+ * @brief Installs the request callback on a new scrape connection.
+ *
+ * @param conn Shared pointer to the TcpConnection.
+ */
+void MetricsServer::onConnected(const std::shared_ptr<TcpConnection> &conn)
+{
+    if (conn->connected())
+    {
+        conn->setMessageCallback(std::bind(&MetricsServer::onRead, this,
+                                           std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    }
+}
+
+/**
+ * @brief Answers the request once its header is complete, then closes the connection.
+ *
+ * Only the request line is looked at: GET /metrics gets the metrics, any other
+ * path 404 and any other method 405.
+ *
+ * @param conn        Shared pointer to the TcpConnection.
+ * @param pBuffer     Buffer holding the request.
+ * @param receiveTime Timestamp when the data was received.
+ */
+void MetricsServer::onRead(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer, Timestamp receiveTime)
+{
+    const char *headerEnd = pBuffer->findString("\r\n\r\n");
+    if (headerEnd == NULL)
+    {
+        if (pBuffer->readableBytes() > MAX_REQUEST_HEADER_SIZE)
+        {
+            LOGW("Metrics request header too long, client: %s", conn->peerAddress().toIpPort().c_str());
+            conn->forceClose();
+        }
+        return;
+    }
+
+    std::string requestLine(pBuffer->peek(), pBuffer->findCRLF());
+    pBuffer->retrieveAll();
+
+    std::string status;
+    std::string body;
+    if (strncmp(requestLine.c_str(), "GET ", 4) != 0)
+    {
+        status = "405 Method Not Allowed";
+    }
+    else if (requestLine.compare(4, 9, "/metrics ") == 0 || requestLine.compare(4, 9, "/metrics?") == 0)
+    {
+        status = "200 OK";
+        body = Singleton<MetricsRegistry>::Instance().render();
+    }
+    else
+    {
+        status = "404 Not Found";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "Connection: close\r\n"
+                           "\r\n";
+    response += body;
+    conn->send(response);
+    conn->shutdown();
+}
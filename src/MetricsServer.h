@@ -0,0 +1,61 @@
+/**
+ *  @file MetricsServer.h
+ *  @brief Plaintext HTTP endpoint serving the metrics for Prometheus
+ *  @author xiebaoma
+ *  @date 2025-06-06
+ **/
+#pragma once
+#include <memory>
+#include "../net/TcpServer.h"
+#include "../net/EventLoop.h"
+
+using namespace net;
+
+/**
+ * @class MetricsServer
+ * @brief Answers GET /metrics with the MetricsRegistry in the Prometheus text format
+ *
+ * Listens on its own port and runs in the main loop, apart from the IO loops it
+ * reports on. Each connection gets one response and is then closed.
+ */
+class MetricsServer final
+{
+public:
+    MetricsServer() = default;
+    ~MetricsServer() = default;
+
+    MetricsServer(const MetricsServer &rhs) = delete;
+    MetricsServer &operator=(const MetricsServer &rhs) = delete;
+
+    /**
+     * @brief Start listening
+     * @param ip IP address to bind
+     * @param port Port to listen on
+     * @param loop Event loop serving the scrapes
+     * @return true if the server is listening
+     */
+    bool init(const char *ip, short port, EventLoop *loop);
+
+    /**
+     * @brief Stop listening and close the scrape connections
+     */
+    void uninit();
+
+private:
+    /**
+     * @brief Callback for new and closed scrape connections
+     * @param conn Shared pointer to the TCP connection
+     */
+    void onConnected(const std::shared_ptr<TcpConnection> &conn);
+
+    /**
+     * @brief Callback for request data, answers once the request header is complete
+     * @param conn Shared pointer to the TCP connection
+     * @param pBuffer Buffer holding the request
+     * @param receiveTime Timestamp when the data was received
+     */
+    void onRead(const std::shared_ptr<TcpConnection> &conn, ByteBuffer *pBuffer, Timestamp receiveTime);
+
+private:
+    std::unique_ptr<TcpServer> m_server; /**< TCP server instance */
+};
@@ -64,6 +64,94 @@ void TcpSession::send(int32_t cmd, int32_t seq, int32_t errorcode,
     }
 }
 
+/**
+ * @brief Send file data to the client straight from a file descriptor
+ *
+ * Serializes every field up to the filedata length prefix, then queues the
+ * file region behind it so the payload never enters user space.
+ *
+ * @param cmd Command type
+ * @param seq Sequence number
+ * @param errorcode Error code
+ * @param filemd5 MD5 hash of the file
+ * @param offset File offset position
+ * @param filesize Total file size
+ * @param fd Open descriptor of the file
+ * @param filedatalength Number of file bytes to send
+ */
+void TcpSession::sendFileData(int32_t cmd, int32_t seq, int32_t errorcode,
+                              const std::string &filemd5, int64_t offset,
+                              int64_t filesize, int fd, int64_t filedatalength)
+{
+    if (!sendFileDataHeader(cmd, seq, errorcode, filemd5, offset, filesize, filedatalength) || filedatalength <= 0)
+        return;
+
+    std::shared_ptr<TcpConnection> conn = tmpConn_.lock();
+    if (conn)
+        conn->sendFile(fd, offset, filedatalength);
+}
+
+/**
+ * @brief Send file data to the client from a file shared by several responses
+ *
+ * Same as the descriptor overload, but every region queued from the file holds
+ * a reference to it instead of a duplicated descriptor.
+ *
+ * @param cmd Command type
+ * @param seq Sequence number
+ * @param errorcode Error code
+ * @param filemd5 MD5 hash of the file
+ * @param offset File offset position
+ * @param filesize Total file size
+ * @param file Open file, closed once no queued region refers to it
+ * @param filedatalength Number of file bytes to send
+ */
+void TcpSession::sendFileData(int32_t cmd, int32_t seq, int32_t errorcode,
+                              const std::string &filemd5, int64_t offset,
+                              int64_t filesize, const SharedFilePtr &file, int64_t filedatalength)
+{
+    if (!sendFileDataHeader(cmd, seq, errorcode, filemd5, offset, filesize, filedatalength) || filedatalength <= 0)
+        return;
+
+    std::shared_ptr<TcpConnection> conn = tmpConn_.lock();
+    if (conn)
+        conn->sendFile(file, offset, filedatalength);
+}
+
+/**
+ * @brief Send every field of a file data package up to the filedata length prefix
+ *
+ * @return false if the package could not be serialized, nothing was sent then
+ */
+bool TcpSession::sendFileDataHeader(int32_t cmd, int32_t seq, int32_t errorcode,
+                                    const std::string &filemd5, int64_t offset,
+                                    int64_t filesize, int64_t filedatalength)
+{
+    try
+    {
+        std::string outbuf;
+        net::BinaryStreamWriter writeStream(&outbuf);
+
+        writeStream.WriteInt32(cmd);
+        writeStream.WriteInt32(seq);
+        writeStream.WriteInt32(errorcode);
+        writeStream.WriteString(filemd5);
+        writeStream.WriteInt64(offset);
+        writeStream.WriteInt64(filesize);
+        writeStream.WriteLength(static_cast<size_t>(filedatalength));
+
+        writeStream.Flush(static_cast<size_t>(filedatalength));
+        sendPackage(outbuf.c_str(), static_cast<int64_t>(outbuf.length()), filedatalength);
+    }
+    catch (const std::exception &ex)
+    {
+        LOGE("TcpSession::sendFileData - Exception during serialization: %s", ex.what());
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Send a data package through the TCP connection
  * 
@@ -73,8 +161,9 @@ void TcpSession::send(int32_t cmd, int32_t seq, int32_t errorcode,
  * 
  * @param body Pointer to the data body
  * @param bodylength Length of the data body
+ * @param trailinglength Body bytes the caller sends separately right after this package
  */
-void TcpSession::sendPackage(const char *body, int64_t bodylength)
+void TcpSession::sendPackage(const char *body, int64_t bodylength, int64_t trailinglength /* = 0*/)
 {
     if (!body || bodylength <= 0)
     {
@@ -83,7 +172,7 @@ void TcpSession::sendPackage(const char *body, int64_t bodylength)
     }
 
     std::string strPackageData;
-    file_msg_header header = {bodylength};
+    file_msg_header header = {bodylength + trailinglength};
 
     strPackageData.reserve(sizeof(header) + bodylength); // Avoid multiple realloc operations
     strPackageData.append(reinterpret_cast<const char *>(&header), sizeof(header));
@@ -96,7 +185,7 @@ void TcpSession::sendPackage(const char *body, int64_t bodylength)
         return;
     }
 
-    LOGI("Sending data: total package length = %zu, body length = %lld",
+    LOGD("Sending data: total package length = %zu, body length = %lld",
          strPackageData.length(), bodylength);
     // Optional: Dump binary data in debug mode
     // LOG_DEBUG_BIN(reinterpret_cast<const unsigned char*>(strPackageData.data()), strPackageData.length());
@@ -66,13 +66,47 @@ public:
      */
     void send(int32_t cmd, int32_t seq, int32_t errorcode, const std::string &filemd5, int64_t offset, int64_t filesize, const std::string &filedata);
 
+    /**
+     * @brief Send file data to the client straight from a file descriptor
+     *
+     * Same wire format as send(), but the filedata field is copied from
+     * [offset, offset + filedatalength) of fd by the kernel (sendfile).
+     *
+     * @param cmd Command type
+     * @param seq Sequence number
+     * @param errorcode Error code
+     * @param filemd5 MD5 hash of the file
+     * @param offset File offset position
+     * @param filesize Total file size
+     * @param fd Open descriptor of the file
+     * @param filedatalength Number of file bytes to send
+     */
+    void sendFileData(int32_t cmd, int32_t seq, int32_t errorcode, const std::string &filemd5, int64_t offset, int64_t filesize, int fd, int64_t filedatalength);
+
+    /**
+     * @brief Send file data to the client from a file shared by several responses
+     *
+     * Regions queued from the file hold a reference to it, they take no descriptor of their own.
+     *
+     * @param file Open file, closed once no queued region refers to it
+     * @see sendFileData(int32_t, int32_t, int32_t, const std::string &, int64_t, int64_t, int, int64_t)
+     */
+    void sendFileData(int32_t cmd, int32_t seq, int32_t errorcode, const std::string &filemd5, int64_t offset, int64_t filesize, const SharedFilePtr &file, int64_t filedatalength);
+
 private:
+    /**
+     * @brief Send the fields of a file data package up to the filedata length prefix
+     * @return false if serialization failed and nothing was sent
+     */
+    bool sendFileDataHeader(int32_t cmd, int32_t seq, int32_t errorcode, const std::string &filemd5, int64_t offset, int64_t filesize, int64_t filedatalength);
+
     /**
      * @brief Send a data package
      * @param body Pointer to the data body
      * @param bodylength Length of the data body (supports large files using int64_t)
+     * @param trailinglength Body bytes the caller sends separately right after this package
      */
-    void sendPackage(const char *body, int64_t bodylength);
+    void sendPackage(const char *body, int64_t bodylength, int64_t trailinglength = 0);
 
 protected:
     // TcpSession must use a weak pointer to reference TcpConnection because TcpConnection
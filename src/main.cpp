@@ -12,7 +12,9 @@
 #include "../base/ConfigFileReader.h"
 #include "../base/AsyncLog.h"
 #include "../net/EventLoop.h"
+#include "../net/Poller.h"
 #include "FileManager.h"
+#include "DiskExecutor.h"
 
 #ifndef WIN32
 #include <string.h>
@@ -20,6 +22,7 @@
 #endif
 
 #include "FileServer.h"
+#include "MetricsServer.h"
 
 using namespace net;
 
@@ -42,6 +45,9 @@ void prog_exit(int signo)
 {
     std::cout << "program recv signal [" << signo << "] to exit." << std::endl;
 
+    Singleton<MetricsServer>::Instance().uninit();
+    // Disk tasks post their completions to the IO loops, finish them while the loops are alive
+    Singleton<DiskExecutor>::Instance().uninit();
     Singleton<FileServer>::Instance().uninit();
     g_mainLoop.quit();
 }
@@ -121,24 +127,123 @@ int main(int argc, char *argv[])
     const char *logfilename = config.getConfigName("logfilename");
     logFileFullPath += logfilename;
 
+    // Each thread logs into its own buffer of logbuffersize KB, the writer thread writes them
+    // out in batches. logoverflow = block makes a thread wait when its buffer is full, the
+    // default drop discards the line and the writer logs how many were dropped
+    const char *logbuffersize = config.getConfigName("logbuffersize");
+    const char *logoverflow = config.getConfigName("logoverflow");
+    CAsyncLog::setBuffering(logbuffersize != NULL ? (size_t)atoi(logbuffersize) * 1024 : 1024 * 1024,
+                            logoverflow != NULL && strcmp(logoverflow, "block") == 0 ? LOG_OVERFLOW_BLOCK : LOG_OVERFLOW_DROP);
+
     // Initialize the asynchronous logger
     CAsyncLog::init(logFileFullPath.c_str());
 
     // Initialize the file manager with the file cache directory
+    // The cache directory is indexed in the background, filescanthreads threads stat new files.
+    // filecachefanout spreads files over that many levels of 2 hex char subdirectories,
+    // raising it from 0 moves the files of a flat cache while the server runs
     const char *filecachedir = config.getConfigName("filecachedir");
-    Singleton<FileManager>::Instance().init(filecachedir);
+    const char *filescanthreads = config.getConfigName("filescanthreads");
+    int scanThreads = filescanthreads != NULL ? atoi(filescanthreads) : 4;
+    const char *filecachefanout = config.getConfigName("filecachefanout");
+    int fanout = filecachefanout != NULL ? atoi(filecachefanout) : 0;
+    Singleton<FileManager>::Instance().init(filecachedir, scanThreads, fanout);
+
+    // Upload file I/O runs on diskthreads threads so a slow disk does not stall the IO loops,
+    // 0 keeps it on the IO loops
+    const char *diskthreads = config.getConfigName("diskthreads");
+    Singleton<DiskExecutor>::Instance().init(diskthreads != NULL ? atoi(diskthreads) : 4);
+
+    // Transfers are logged when they start and end. chunklogsample = N also logs one chunk
+    // request and response in N, 0 (the default) logs no chunks
+    const char *chunklogsample = config.getConfigName("chunklogsample");
+    FileSession::setChunkLogSampling(chunklogsample != NULL ? atoi(chunklogsample) : 0);
+
+    // poller = io_uring switches the IO loops from epoll to io_uring, falling back to epoll
+    // when the kernel lacks support. The main loop is created before the config is read and
+    // keeps epoll, it only accepts connections.
+    const char *poller = config.getConfigName("poller");
+    if (poller != NULL && strcmp(poller, "io_uring") == 0)
+        Poller::setDefaultType(Poller::kPollerIoUring);
+
+    // Connections are closed after idletimeout seconds without traffic, or when a partly received
+    // package (readtimeout) or pending output (writetimeout) makes no progress for that long, 0 disables
+    const char *idletimeout = config.getConfigName("idletimeout");
+    const char *readtimeout = config.getConfigName("readtimeout");
+    const char *writetimeout = config.getConfigName("writetimeout");
+    Singleton<FileServer>::Instance().setTimeouts(idletimeout != NULL ? atoi(idletimeout) : 300,
+                                                  readtimeout != NULL ? atoi(readtimeout) : 60,
+                                                  writetimeout != NULL ? atoi(writetimeout) : 60);
+
+    // A connection with more than maxpendingoutput KB of responses waiting for the client is
+    // not read from until they are sent, 0 disables the limit
+    const char *maxpendingoutput = config.getConfigName("maxpendingoutput");
+    Singleton<FileServer>::Instance().setMaxPendingOutput(maxpendingoutput != NULL ? (size_t)atoi(maxpendingoutput) * 1024 : 8 * 1024 * 1024);
+
+    // iothreads = auto runs one IO loop per CPU the process may use, cgroup quota included.
+    // iothreadaffinity = cpu pins each loop to one CPU, numa pins each loop to the CPUs of one
+    // NUMA node in turn, so a loop and the buffers it allocates stay on one node
+    const char *iothreads = config.getConfigName("iothreads");
+    int ioThreadCount = 6;
+    if (iothreads != NULL)
+        ioThreadCount = strcmp(iothreads, "auto") == 0 ? EventLoopThreadPool::availableCpus() : atoi(iothreads);
+    const char *iothreadaffinity = config.getConfigName("iothreadaffinity");
+    EventLoopThreadPool::AffinityMode ioThreadAffinity = EventLoopThreadPool::kAffinityNone;
+    if (iothreadaffinity != NULL && strcmp(iothreadaffinity, "cpu") == 0)
+        ioThreadAffinity = EventLoopThreadPool::kAffinityCpu;
+    else if (iothreadaffinity != NULL && strcmp(iothreadaffinity, "numa") == 0)
+        ioThreadAffinity = EventLoopThreadPool::kAffinityNuma;
+    Singleton<FileServer>::Instance().setIoThreads(ioThreadCount, ioThreadAffinity);
+
+    // acceptmode = loop gives each IO loop its own SO_REUSEPORT listener instead of accepting
+    // in the main loop, acceptmode = cpu also lets the kernel pick the loop by receiving CPU,
+    // which matches iothreadaffinity = cpu
+    const char *acceptmode = config.getConfigName("acceptmode");
+    if (acceptmode != NULL && strcmp(acceptmode, "loop") == 0)
+        Singleton<FileServer>::Instance().setAcceptMode(TcpServer::kAcceptInEachLoop);
+    else if (acceptmode != NULL && strcmp(acceptmode, "cpu") == 0)
+        Singleton<FileServer>::Instance().setAcceptMode(TcpServer::kAcceptInEachLoopByCpu);
+
+    // placement = leastconn | leastbytes | p2c makes the main loop give a new connection to the
+    // IO loop with the fewest connections, the fewest unwritten output bytes, or the less loaded
+    // of two random loops, instead of round-robin. statsinterval logs the loop load every that
+    // many seconds, 0 disables it
+    const char *placement = config.getConfigName("placement");
+    if (placement != NULL && strcmp(placement, "leastconn") == 0)
+        Singleton<FileServer>::Instance().setPlacementPolicy(EventLoopThreadPool::kPlaceLeastConnections);
+    else if (placement != NULL && strcmp(placement, "leastbytes") == 0)
+        Singleton<FileServer>::Instance().setPlacementPolicy(EventLoopThreadPool::kPlaceLeastPendingBytes);
+    else if (placement != NULL && strcmp(placement, "p2c") == 0)
+        Singleton<FileServer>::Instance().setPlacementPolicy(EventLoopThreadPool::kPlacePowerOfTwoChoices);
+    const char *statsinterval = config.getConfigName("statsinterval");
+    Singleton<FileServer>::Instance().setStatsInterval(statsinterval != NULL ? atoi(statsinterval) : 60);
 
     // Retrieve listening IP and port from config and initialize the file server
     const char *listenip = config.getConfigName("listenip");
     short listenport = (short)atol(config.getConfigName("listenport"));
     Singleton<FileServer>::Instance().init(listenip, listenport, &g_mainLoop, filecachedir);
 
+    // metricsport serves GET /metrics in the Prometheus text format on listenip: request counts,
+    // chunk and disk latencies and per IO loop load and latencies. Unset or 0 disables it
+    const char *metricsport = config.getConfigName("metricsport");
+    if (metricsport != NULL && atoi(metricsport) > 0)
+        Singleton<MetricsServer>::Instance().init(listenip, (short)atoi(metricsport), &g_mainLoop);
+
     LOGI("FileServer initialization completed. Ready to accept client connections.");
 
     // Enter the main event loop
     g_mainLoop.loop();
 
+    // Finish queued disk I/O before the index is persisted, prog_exit() already did on a signal
+    Singleton<DiskExecutor>::Instance().uninit();
+
+    // Persist the file index so the next start only reconciles changes
+    Singleton<FileManager>::Instance().uninit();
+
     LOGI("FileServer exited.");
 
+    // Write out the lines still buffered
+    CAsyncLog::uninit();
+
     return 0;
 }
@@ -0,0 +1,155 @@
+/**
+ * 增量计算MD5摘要 (RFC 1321)
+ * xiebaoma
+ * 2025-06-06
+ */
+#include "MD5.h"
+
+#include <string.h>
+
+namespace
+{
+    const uint32_t kSines[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+    const int kShifts[64] = {
+        7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+        5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+        4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+        6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+    inline uint32_t rotateLeft(uint32_t x, int c)
+    {
+        return (x << c) | (x >> (32 - c));
+    }
+}
+
+MD5::MD5()
+{
+    reset();
+}
+
+void MD5::reset()
+{
+    m_state[0] = 0x67452301;
+    m_state[1] = 0xefcdab89;
+    m_state[2] = 0x98badcfe;
+    m_state[3] = 0x10325476;
+    m_length = 0;
+}
+
+void MD5::update(const void *data, size_t length)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    size_t buffered = static_cast<size_t>(m_length % 64);
+    m_length += length;
+
+    // Complete the buffered block first
+    if (buffered > 0)
+    {
+        size_t fill = 64 - buffered;
+        if (length < fill)
+        {
+            memcpy(m_buffer + buffered, p, length);
+            return;
+        }
+
+        memcpy(m_buffer + buffered, p, fill);
+        transform(m_buffer);
+        p += fill;
+        length -= fill;
+    }
+
+    // Whole blocks are hashed in place
+    for (; length >= 64; p += 64, length -= 64)
+        transform(p);
+
+    memcpy(m_buffer, p, length);
+}
+
+std::string MD5::hexDigest()
+{
+    // Pad with 0x80, zeros and the bit length so the data ends on a block boundary
+    uint64_t bits = m_length * 8;
+    unsigned char padding[72] = {0x80};
+    size_t buffered = static_cast<size_t>(m_length % 64);
+    size_t padlength = (buffered < 56 ? 56 : 120) - buffered;
+    for (int i = 0; i < 8; ++i)
+        padding[padlength + i] = static_cast<unsigned char>(bits >> (8 * i));
+    update(padding, padlength + 8);
+
+    static const char kHex[] = "0123456789abcdef";
+    std::string digest;
+    digest.reserve(32);
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            unsigned char byte = static_cast<unsigned char>(m_state[i] >> (8 * j));
+            digest += kHex[byte >> 4];
+            digest += kHex[byte & 0x0f];
+        }
+    }
+
+    return digest;
+}
+
+void MD5::transform(const unsigned char *block)
+{
+    uint32_t words[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        words[i] = static_cast<uint32_t>(block[i * 4]) |
+                   (static_cast<uint32_t>(block[i * 4 + 1]) << 8) |
+                   (static_cast<uint32_t>(block[i * 4 + 2]) << 16) |
+                   (static_cast<uint32_t>(block[i * 4 + 3]) << 24);
+    }
+
+    uint32_t a = m_state[0];
+    uint32_t b = m_state[1];
+    uint32_t c = m_state[2];
+    uint32_t d = m_state[3];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t f;
+        int g;
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+
+        uint32_t temp = d;
+        d = c;
+        c = b;
+        b = b + rotateLeft(a + f + kSines[i] + words[g], kShifts[i]);
+        a = temp;
+    }
+
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+}
@@ -0,0 +1,53 @@
+/**
+ * 增量计算MD5摘要 (RFC 1321)
+ * xiebaoma
+ * 2025-06-06
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/**
+ * @class MD5
+ * @brief Incremental MD5 digest
+ *
+ * Data can be fed in pieces of any size, the digest equals the one of the
+ * concatenated data.
+ */
+class MD5 final
+{
+public:
+    MD5();
+
+    /**
+     * @brief Restart the digest
+     */
+    void reset();
+
+    /**
+     * @brief Hash the next piece of data
+     * @param data Pointer to the data
+     * @param length Length of the data
+     */
+    void update(const void *data, size_t length);
+
+    /**
+     * @brief Finish the digest, reset() before hashing again
+     * @return The digest as 32 lowercase hex chars
+     */
+    std::string hexDigest();
+
+private:
+    /**
+     * @brief Hash one 64-byte block
+     * @param block The block
+     */
+    void transform(const unsigned char *block);
+
+private:
+    uint32_t m_state[4];        /**< A, B, C, D */
+    uint64_t m_length;          /**< Bytes hashed so far */
+    unsigned char m_buffer[64]; /**< Bytes of the block not complete yet */
+};